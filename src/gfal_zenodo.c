@@ -17,6 +17,14 @@
 // Plugin entry point
 
 #include "gfal_zenodo.h"
+#include "gfal_zenodo_cache.h"
+#include "gfal_zenodo_etag.h"
+#include "gfal_zenodo_filecache.h"
+#include "gfal_zenodo_hedge.h"
+#include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_index.h"
+#include "gfal_zenodo_retry.h"
+#include "gfal_zenodo_stats.h"
 #include <gfal_plugins_api.h>
 #include <ctype.h>
 #include <stdlib.h>
@@ -48,6 +56,9 @@ static gboolean gfal2_zenodo_check_url(plugin_handle plugin_data,
         case GFAL_PLUGIN_OPENDIR:
         case GFAL_PLUGIN_OPEN:
         case GFAL_PLUGIN_UNLINK:
+        case GFAL_PLUGIN_CHECKSUM:
+        case GFAL_PLUGIN_GETXATTR:
+        case GFAL_PLUGIN_LISTXATTR:
             return strncmp(url, "zenodo:", 7) == 0;
         default:
             return FALSE;
@@ -59,7 +70,24 @@ static gboolean gfal2_zenodo_check_url(plugin_handle plugin_data,
 static void gfal2_zenodo_delete_data(plugin_handle plugin_data)
 {
     ZenodoHandle* zenodo = (ZenodoHandle*)(plugin_data);
-    curl_easy_cleanup(zenodo->curl_handle);
+    g_slist_free_full(zenodo->curl_pool, (GDestroyNotify)curl_easy_cleanup);
+    curl_share_cleanup(zenodo->curl_share);
+    gfal2_zenodo_stats_free(zenodo->stats);
+    gfal2_zenodo_cache_free(zenodo->stat_cache);
+    gfal2_zenodo_index_free(zenodo->name_index);
+    gfal2_zenodo_etag_free(zenodo->etag_cache);
+    gfal2_zenodo_rate_free(zenodo->rate_limiter);
+    gfal2_zenodo_hedge_free(zenodo->hedge);
+    gfal2_zenodo_filecache_free(zenodo->file_cache);
+    g_slist_free_full(zenodo->buffer_pool, (GDestroyNotify)gfal2_zenodo_buffer_free);
+    g_mutex_clear(&zenodo->buffer_lock);
+    g_free(zenodo->access_token);
+    g_mutex_clear(&zenodo->token_lock);
+    g_cond_clear(&zenodo->token_cond);
+    g_mutex_clear(&zenodo->curl_pool_lock);
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+        g_mutex_clear(&zenodo->curl_share_locks[i]);
     free(zenodo);
 }
 
@@ -98,22 +126,139 @@ static int gfal2_zenodo_debug_callback(CURL *handle, curl_infotype type,
 
 
 // Set logging
-static void gfal2_zenodo_set_logging(ZenodoHandle* zenodo)
+static void gfal2_zenodo_set_logging(CURL* curl)
 {
-    curl_easy_setopt(zenodo->curl_handle, CURLOPT_VERBOSE, 1);
-    curl_easy_setopt(zenodo->curl_handle, CURLOPT_DEBUGFUNCTION, gfal2_zenodo_debug_callback);
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
+    curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, gfal2_zenodo_debug_callback);
 }
 
 // Set certification authorities
-static void gfal2_zenodo_set_ca(ZenodoHandle* zenodo)
+static void gfal2_zenodo_set_ca(ZenodoHandle* zenodo, CURL* curl)
 {
-	curl_easy_setopt(zenodo->curl_handle, CURLOPT_CAPATH, "/etc/grid-security/certificates");
+	curl_easy_setopt(curl, CURLOPT_CAPATH, "/etc/grid-security/certificates");
 	gboolean insecure_mode = gfal2_get_opt_boolean_with_default(zenodo->gfal2_context, "HTTP PLUGIN", "INSECURE", FALSE);
 	if (insecure_mode) {
-		curl_easy_setopt(zenodo->curl_handle, CURLOPT_SSL_VERIFYPEER, 0);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
 	}
 }
 
+
+// Apply the plugin settings to a new or reset handle
+static void gfal2_zenodo_setup_curl_handle(ZenodoHandle* zenodo, CURL* curl)
+{
+    gfal2_zenodo_set_logging(curl);
+    gfal2_zenodo_set_ca(zenodo, curl);
+    // Handles are used from several threads
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+    curl_easy_setopt(curl, CURLOPT_SHARE, zenodo->curl_share);
+    // The cache is shared, but trimmed to the limit of the handle returning a
+    // connection, which otherwise is 4 per handle in flight
+    curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, zenodo->max_connections);
+
+    if (zenodo->http2) {
+        // Negotiated through ALPN, servers without HTTP/2 get HTTP/1.1
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        // No CURLOPT_PIPEWAIT: with libcurl 7.88, transfers waiting for a connection
+        // being set up were at times never started, and bulk requests hung
+    }
+    if (zenodo->tcp_keepidle > 0) {
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, zenodo->tcp_keepidle);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, zenodo->tcp_keepintvl);
+    }
+    if (zenodo->buffer_size > 0)
+        curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, zenodo->buffer_size);
+    if (zenodo->upload_buffer_size > 0)
+        curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, zenodo->upload_buffer_size);
+}
+
+
+// Read the transport settings
+static void gfal2_zenodo_load_transport(ZenodoHandle* zenodo)
+{
+    gfal2_context_t context = zenodo->gfal2_context;
+    zenodo->http2 = gfal2_get_opt_boolean_with_default(context, "ZENODO", "HTTP2", FALSE);
+    // Keep-alive is opt-in, like the rest of the transport tuning
+    zenodo->tcp_keepidle = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "TCP_KEEPIDLE", 0);
+    zenodo->tcp_keepintvl = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "TCP_KEEPINTVL", 0);
+    if (zenodo->tcp_keepintvl < 1)
+        zenodo->tcp_keepintvl = MAX(zenodo->tcp_keepidle, 1);
+    zenodo->buffer_size = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "BUFFER_SIZE", 0);
+    zenodo->upload_buffer_size = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "UPLOAD_BUFFER_SIZE", 0);
+    zenodo->max_connections = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "MAX_CONNECTIONS", ZENODO_MAX_CONNECTIONS_DEFAULT);
+    if (zenodo->max_connections < 1)
+        zenodo->max_connections = 1;
+}
+
+
+CURL* gfal2_zenodo_curl_acquire(ZenodoHandle* zenodo)
+{
+    CURL* curl = NULL;
+
+    g_mutex_lock(&zenodo->curl_pool_lock);
+    if (zenodo->curl_pool) {
+        curl = zenodo->curl_pool->data;
+        zenodo->curl_pool = g_slist_delete_link(zenodo->curl_pool, zenodo->curl_pool);
+    }
+    g_mutex_unlock(&zenodo->curl_pool_lock);
+
+    if (!curl) {
+        curl = curl_easy_init();
+        gfal2_zenodo_setup_curl_handle(zenodo, curl);
+    }
+    return curl;
+}
+
+
+void gfal2_zenodo_curl_release(ZenodoHandle* zenodo, CURL* curl)
+{
+    // Forget the options of the last request, live connections are kept by the share
+    curl_easy_reset(curl);
+    gfal2_zenodo_setup_curl_handle(zenodo, curl);
+
+    g_mutex_lock(&zenodo->curl_pool_lock);
+    zenodo->curl_pool = g_slist_prepend(zenodo->curl_pool, curl);
+    g_mutex_unlock(&zenodo->curl_pool_lock);
+}
+
+
+// Locking for the curl share
+static void gfal2_zenodo_share_lock(CURL* handle, curl_lock_data data,
+        curl_lock_access access, void* userptr)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)userptr;
+    g_mutex_lock(&zenodo->curl_share_locks[data]);
+}
+
+
+static void gfal2_zenodo_share_unlock(CURL* handle, curl_lock_data data, void* userptr)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)userptr;
+    g_mutex_unlock(&zenodo->curl_share_locks[data]);
+}
+
+
+static void gfal2_zenodo_setup_share(ZenodoHandle* zenodo)
+{
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+        g_mutex_init(&zenodo->curl_share_locks[i]);
+
+    zenodo->curl_share = curl_share_init();
+    curl_share_setopt(zenodo->curl_share, CURLSHOPT_LOCKFUNC, gfal2_zenodo_share_lock);
+    curl_share_setopt(zenodo->curl_share, CURLSHOPT_UNLOCKFUNC, gfal2_zenodo_share_unlock);
+    curl_share_setopt(zenodo->curl_share, CURLSHOPT_USERDATA, zenodo);
+    curl_share_setopt(zenodo->curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(zenodo->curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    // Requires libcurl >= 7.57, older versions just keep one connection cache per handle
+    curl_share_setopt(zenodo->curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
 // GFAL2 will look for this symbol to register the plugin
 gfal_plugin_interface gfal_plugin_init(gfal2_context_t handle, GError** err)
 {
@@ -121,11 +266,21 @@ gfal_plugin_interface gfal_plugin_init(gfal2_context_t handle, GError** err)
     memset(&zenodo_plugin, 0, sizeof(gfal_plugin_interface));
 
     ZenodoHandle* zenodo = calloc(1, sizeof(ZenodoHandle));
-    zenodo->curl_handle = curl_easy_init();
     zenodo->gfal2_context = handle;
-
-    gfal2_zenodo_set_logging(zenodo);
-    gfal2_zenodo_set_ca(zenodo);
+    curl_global_init(CURL_GLOBAL_ALL);
+    gfal2_zenodo_load_transport(zenodo);
+    gfal2_zenodo_setup_share(zenodo);
+    g_mutex_init(&zenodo->curl_pool_lock);
+    g_mutex_init(&zenodo->buffer_lock);
+    g_mutex_init(&zenodo->token_lock);
+    g_cond_init(&zenodo->token_cond);
+    zenodo->stat_cache = gfal2_zenodo_cache_new(handle);
+    zenodo->name_index = gfal2_zenodo_index_new(handle);
+    zenodo->etag_cache = gfal2_zenodo_etag_new(handle);
+    zenodo->rate_limiter = gfal2_zenodo_rate_new(handle);
+    zenodo->hedge = gfal2_zenodo_hedge_new(handle);
+    zenodo->file_cache = gfal2_zenodo_filecache_new(handle);
+    zenodo->stats = gfal2_zenodo_stats_new(handle, zenodo);
 
     zenodo_plugin.plugin_data = zenodo;
     zenodo_plugin.plugin_delete = gfal2_zenodo_delete_data;
@@ -143,13 +298,27 @@ gfal_plugin_interface gfal_plugin_init(gfal2_context_t handle, GError** err)
     zenodo_plugin.mkdirpG = gfal2_zenodo_mkdir;
     zenodo_plugin.rmdirG = gfal2_zenodo_rmdir;
     zenodo_plugin.unlinkG = gfal2_zenodo_unlink;
+#ifdef HAVE_GFAL_UNLINK_LIST
+    zenodo_plugin.unlink_listG = gfal2_zenodo_unlink_list;
+#endif
     zenodo_plugin.renameG = gfal2_zenodo_rename;
 
+    zenodo_plugin.getxattrG = gfal2_zenodo_getxattr;
+    zenodo_plugin.listxattrG = gfal2_zenodo_listxattr;
+
     zenodo_plugin.openG = gfal2_zenodo_fopen;
     zenodo_plugin.closeG = gfal2_zenodo_fclose;
     zenodo_plugin.readG = gfal2_zenodo_fread;
     zenodo_plugin.writeG = gfal2_zenodo_fwrite;
     zenodo_plugin.lseekG = gfal2_zenodo_fseek;
 
+    zenodo_plugin.checksum_calcG = gfal2_zenodo_checksum;
+
+    zenodo_plugin.check_plugin_url_transfer = gfal2_zenodo_check_url_transfer;
+    zenodo_plugin.copy_file = gfal2_zenodo_copy_file;
+#ifdef HAVE_GFAL_COPY_BULK
+    zenodo_plugin.copy_bulk = gfal2_zenodo_copy_bulk;
+#endif
+
     return zenodo_plugin;
 }
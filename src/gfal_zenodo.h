@@ -21,14 +21,61 @@
 #include <gfal_api.h>
 #include <gfal_plugins_api.h>
 #include <json.h>
+#include <transfer/gfal_transfer_plugins.h>
+
+// Size of the shared connection cache
+#define ZENODO_MAX_CONNECTIONS_DEFAULT 64
 
 
 /*
  * Internal plugin context
  */
 struct ZenodoHandle {
-    CURL* curl_handle;
     gfal2_context_t gfal2_context;
+
+    // Idle curl handles, checked out per request
+    // They all share DNS, TLS sessions and connections
+    CURLSH* curl_share;
+    GMutex curl_share_locks[CURL_LOCK_DATA_LAST];
+    GMutex curl_pool_lock;
+    GSList* curl_pool;
+    // Transport settings, read once from the configuration
+    gboolean http2;
+    long tcp_keepidle;
+    long tcp_keepintvl;
+    long buffer_size;
+    long upload_buffer_size;
+    long max_connections;
+
+    // Pool of response buffers
+    GMutex buffer_lock;
+    GSList* buffer_pool;
+
+    // Metadata cache
+    struct ZenodoStatCache* stat_cache;
+    // Title and filename to id
+    struct ZenodoNameIndex* name_index;
+    // Validators of metadata responses, for conditional requests
+    struct ZenodoEtagCache* etag_cache;
+    // Local copies of file contents, NULL if disabled
+    struct ZenodoFileCache* file_cache;
+    // Client side rate limiting and retry policy
+    struct ZenodoRateLimiter* rate_limiter;
+    // Duplicates of slow metadata requests, NULL if disabled
+    struct ZenodoHedge* hedge;
+    // Performance counters
+    struct ZenodoStats* stats;
+    // OAuth token, loaded from the configuration on first use and refreshed
+    // by one thread at a time. Times are monotonic, in microseconds
+    GMutex token_lock;
+    GCond token_cond;
+    gboolean token_loaded;
+    gboolean token_refreshable;
+    gboolean token_refreshing;
+    gchar* access_token;
+    gint64 token_expires;
+    gint64 token_refreshed;
+    gint64 token_margin;
 };
 typedef struct ZenodoHandle ZenodoHandle;
 
@@ -42,6 +89,13 @@ const GQuark zenodo_domain();
  */
 const char* gfal2_zenodo_getName();
 
+/*
+ * Check out a curl handle configured with the plugin settings
+ * Handles are pooled, and must be given back with gfal2_zenodo_curl_release
+ */
+CURL* gfal2_zenodo_curl_acquire(ZenodoHandle* zenodo);
+void gfal2_zenodo_curl_release(ZenodoHandle* zenodo, CURL* curl);
+
 /*
  * Directory operations
  */
@@ -64,6 +118,37 @@ int gfal2_zenodo_rmdir(plugin_handle, const char*, GError**);
 int gfal2_zenodo_unlink(plugin_handle, const char*, GError**);
 int gfal2_zenodo_rename(plugin_handle, const char*, const char*, GError**);
 
+/*
+ * Create a deposition with the given title. If name is not NULL, it gets the
+ * id qualified name of the new deposition, as found in listings
+ * mkdir does the same, but gfal2 has no way to return the name
+ */
+int gfal2_zenodo_create_deposition(plugin_handle, const char* domain, const char* title,
+        char* name, size_t namesize, GError** error);
+
+/*
+ * Delete nbfiles urls at once, with the requests running concurrently
+ * Registered as unlink_listG when the installed gfal2 has that hook
+ */
+int gfal2_zenodo_unlink_list(plugin_handle, int nbfiles, const char* const* uris,
+        GError** errors);
+
+/*
+ * Stat nbfiles urls at once, with the requests running concurrently
+ * Each url gets its own entry in stats and errors
+ * Returns -1 if any of them failed
+ * gfal2 has no bulk stat hook, so this is only reachable through the plugin symbol
+ */
+int gfal2_zenodo_bulk_stat(plugin_handle, int nbfiles, const char* const* urls,
+        struct stat* stats, GError** errors);
+
+/*
+ * Extended attributes
+ * The root url has ZENODO_STATS_XATTR, with the performance counters as JSON
+ */
+ssize_t gfal2_zenodo_getxattr(plugin_handle, const char*, const char*, void*, size_t, GError**);
+ssize_t gfal2_zenodo_listxattr(plugin_handle, const char*, char*, size_t, GError**);
+
 /*
  * IO operations
  */
@@ -73,4 +158,39 @@ ssize_t gfal2_zenodo_fwrite(plugin_handle, gfal_file_handle, const void*, size_t
 int gfal2_zenodo_fclose(plugin_handle, gfal_file_handle, GError **);
 off_t gfal2_zenodo_fseek(plugin_handle, gfal_file_handle, off_t, int, GError**);
 
+/*
+ * Upload nbfiles local files (paths or file:// urls) into the deposition
+ * at deposition_url, up to UPLOAD_CONCURRENCY at the same time. Each file
+ * keeps its name, and gets its own entry in errors
+ * Returns -1 if any of them failed
+ */
+int gfal2_zenodo_upload_files(plugin_handle, const char* deposition_url, int nbfiles,
+        const char* const* sources, GError** errors);
+
+/*
+ * Same, but the file i is stored as names[i], and if md5s is not NULL, its
+ * non empty entries are compared with what was sent
+ * Used by copy_bulk when the sources are local and all the destinations are
+ * in the same deposition
+ */
+int gfal2_zenodo_upload_batch(plugin_handle, const char* deposition_url, int nbfiles,
+        const char* const* sources, const char* const* names, const char* const* md5s,
+        GError** errors);
+
+/*
+ * Checksum operations
+ */
+int gfal2_zenodo_checksum(plugin_handle, const char*, const char*, char*, size_t, off_t, size_t, GError**);
+
+/*
+ * Copy operations
+ */
+int gfal2_zenodo_check_url_transfer(plugin_handle, gfal2_context_t, const char*, const char*, gfal_url2_check);
+int gfal2_zenodo_copy_file(plugin_handle, gfal2_context_t, gfalt_params_t, const char*, const char*, GError**);
+#ifdef HAVE_GFAL_COPY_BULK
+int gfal2_zenodo_copy_bulk(plugin_handle, gfal2_context_t, gfalt_params_t, size_t nbfiles,
+        const char* const* srcs, const char* const* dsts, const char* const* checksums,
+        GError** op_error, GError*** file_errors);
+#endif
+
 #endif
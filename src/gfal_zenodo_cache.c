@@ -0,0 +1,237 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// In memory metadata cache
+
+#include <string.h>
+#include "gfal_zenodo_cache.h"
+#include "gfal_zenodo_statmap.h"
+
+// Cache defaults, in seconds
+#define ZENODO_STAT_CACHE_TTL_DEFAULT 60
+#define ZENODO_STAT_CACHE_NEGATIVE_TTL_DEFAULT 5
+#define ZENODO_STAT_CACHE_MAX_ENTRIES_DEFAULT 100000
+
+
+struct ZenodoCacheEntry {
+    struct stat st;
+    gboolean negative;
+    gint64 expires;
+};
+typedef struct ZenodoCacheEntry ZenodoCacheEntry;
+
+
+struct ZenodoStatCache {
+    GMutex lock;
+    GHashTable* entries;
+    gint64 ttl;
+    gint64 negative_ttl;
+    guint max_entries;
+    // Shared with other processes, NULL if not configured
+    ZenodoStatMap* map;
+
+    guint64 hits;
+    guint64 negative_hits;
+    guint64 misses;
+};
+
+
+static void gfal2_zenodo_cache_key(char* key, size_t keysize, const char* domain,
+        const char* deposition, const char* file)
+{
+    snprintf(key, keysize, "%s/%s/%s", domain, deposition, file ? file : "");
+}
+
+
+ZenodoStatCache* gfal2_zenodo_cache_new(gfal2_context_t context)
+{
+    ZenodoStatCache* cache = g_malloc0(sizeof(*cache));
+    g_mutex_init(&cache->lock);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    cache->ttl = (gint64)gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "STAT_CACHE_TTL", ZENODO_STAT_CACHE_TTL_DEFAULT) * G_USEC_PER_SEC;
+    cache->negative_ttl = (gint64)gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "STAT_CACHE_NEGATIVE_TTL", ZENODO_STAT_CACHE_NEGATIVE_TTL_DEFAULT) * G_USEC_PER_SEC;
+    cache->max_entries = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "STAT_CACHE_MAX_ENTRIES", ZENODO_STAT_CACHE_MAX_ENTRIES_DEFAULT);
+    cache->map = gfal2_zenodo_statmap_new(context);
+    return cache;
+}
+
+
+void gfal2_zenodo_cache_free(ZenodoStatCache* cache)
+{
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo stat cache: %llu hits, %llu negative hits, %llu misses",
+            (unsigned long long)cache->hits, (unsigned long long)cache->negative_hits,
+            (unsigned long long)cache->misses);
+    gfal2_zenodo_statmap_free(cache->map);
+    g_hash_table_destroy(cache->entries);
+    g_mutex_clear(&cache->lock);
+    g_free(cache);
+}
+
+
+// Drop expired entries, or everything if that is not enough. Called with the lock held
+static void gfal2_zenodo_cache_purge(ZenodoStatCache* cache)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    gint64 now = g_get_monotonic_time();
+
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (((ZenodoCacheEntry*)value)->expires < now)
+            g_hash_table_iter_remove(&iter);
+    }
+
+    if (g_hash_table_size(cache->entries) >= cache->max_entries)
+        g_hash_table_remove_all(cache->entries);
+}
+
+
+int gfal2_zenodo_cache_get(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file, struct stat* st)
+{
+    char key[GFAL_URL_MAX_LEN];
+    int ret = 0;
+
+    gfal2_zenodo_cache_key(key, sizeof(key), domain, deposition, file);
+
+    g_mutex_lock(&cache->lock);
+    ZenodoCacheEntry* entry = g_hash_table_lookup(cache->entries, key);
+    if (entry && entry->expires < g_get_monotonic_time()) {
+        g_hash_table_remove(cache->entries, key);
+        entry = NULL;
+    }
+
+    // Maybe another process knows
+    if (!entry && cache->map) {
+        struct stat mapped;
+        gint64 ttl = 0;
+        int found = gfal2_zenodo_statmap_get(cache->map, domain, deposition, file, &mapped, &ttl);
+        if (found != 0) {
+            entry = g_malloc0(sizeof(*entry));
+            entry->st = mapped;
+            entry->negative = (found < 0);
+            entry->expires = g_get_monotonic_time() + ttl;
+            if (g_hash_table_size(cache->entries) >= cache->max_entries)
+                gfal2_zenodo_cache_purge(cache);
+            g_hash_table_replace(cache->entries, g_strdup(key), entry);
+        }
+    }
+
+    if (!entry) {
+        ++cache->misses;
+    }
+    else if (entry->negative) {
+        ++cache->negative_hits;
+        ret = -1;
+    }
+    else {
+        ++cache->hits;
+        *st = entry->st;
+        ret = 1;
+    }
+    g_mutex_unlock(&cache->lock);
+
+    gfal_log(GFAL_VERBOSE_DEBUG, "Zenodo stat cache %s for %s",
+            ret == 0 ? "miss" : (ret > 0 ? "hit" : "negative hit"), key);
+    return ret;
+}
+
+
+static void gfal2_zenodo_cache_insert(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file, const struct stat* st, gint64 ttl)
+{
+    if (ttl <= 0)
+        return;
+
+    char key[GFAL_URL_MAX_LEN];
+    gfal2_zenodo_cache_key(key, sizeof(key), domain, deposition, file);
+
+    ZenodoCacheEntry* entry = g_malloc0(sizeof(*entry));
+    if (st)
+        entry->st = *st;
+    else
+        entry->negative = TRUE;
+    entry->expires = g_get_monotonic_time() + ttl;
+
+    g_mutex_lock(&cache->lock);
+    if (g_hash_table_size(cache->entries) >= cache->max_entries)
+        gfal2_zenodo_cache_purge(cache);
+    g_hash_table_replace(cache->entries, g_strdup(key), entry);
+    if (cache->map)
+        gfal2_zenodo_statmap_put(cache->map, domain, deposition, file, st, ttl);
+    g_mutex_unlock(&cache->lock);
+}
+
+
+void gfal2_zenodo_cache_put(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file, const struct stat* st)
+{
+    gfal2_zenodo_cache_insert(cache, domain, deposition, file, st, cache->ttl);
+}
+
+
+void gfal2_zenodo_cache_put_negative(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file)
+{
+    gfal2_zenodo_cache_insert(cache, domain, deposition, file, NULL, cache->negative_ttl);
+}
+
+
+void gfal2_zenodo_cache_invalidate(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file)
+{
+    char key[GFAL_URL_MAX_LEN];
+
+    g_mutex_lock(&cache->lock);
+
+    gfal2_zenodo_cache_key(key, sizeof(key), domain, deposition, NULL);
+    g_hash_table_remove(cache->entries, key);
+
+    if (file && file[0]) {
+        gfal2_zenodo_cache_key(key, sizeof(key), domain, deposition, file);
+        g_hash_table_remove(cache->entries, key);
+    }
+    else {
+        GHashTableIter iter;
+        gpointer entry_key, value;
+        size_t keylen = strlen(key);
+
+        g_hash_table_iter_init(&iter, cache->entries);
+        while (g_hash_table_iter_next(&iter, &entry_key, &value)) {
+            if (strncmp(entry_key, key, keylen) == 0)
+                g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    if (cache->map)
+        gfal2_zenodo_statmap_invalidate(cache->map, domain, deposition, file);
+
+    g_mutex_unlock(&cache->lock);
+}
+
+
+void gfal2_zenodo_cache_counters(ZenodoStatCache* cache, guint64* hits,
+        guint64* negative_hits, guint64* misses)
+{
+    g_mutex_lock(&cache->lock);
+    *hits = cache->hits;
+    *negative_hits = cache->negative_hits;
+    *misses = cache->misses;
+    g_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,59 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_CACHE_H
+#define _GFAL_ZENODO_CACHE_H
+
+#include "gfal_zenodo.h"
+
+/*
+ * In memory metadata cache, keyed by (domain, deposition, file)
+ * Filled by listings and stat, consulted by stat
+ * Entries can be negative (the resource does not exist)
+ * With STAT_CACHE_DIR, entries are also shared with other processes, see
+ * gfal_zenodo_statmap.h
+ */
+typedef struct ZenodoStatCache ZenodoStatCache;
+
+ZenodoStatCache* gfal2_zenodo_cache_new(gfal2_context_t context);
+void gfal2_zenodo_cache_free(ZenodoStatCache* cache);
+
+/*
+ * Returns 1 on hit, -1 on a negative hit, 0 on miss
+ */
+int gfal2_zenodo_cache_get(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file, struct stat* st);
+
+void gfal2_zenodo_cache_put(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file, const struct stat* st);
+
+void gfal2_zenodo_cache_put_negative(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file);
+
+/*
+ * Drop the entry, and the one of its deposition since its contents changed
+ * If file is empty, all the files of the deposition are dropped as well
+ */
+void gfal2_zenodo_cache_invalidate(ZenodoStatCache* cache, const char* domain,
+        const char* deposition, const char* file);
+
+/*
+ * Hit and miss counters
+ */
+void gfal2_zenodo_cache_counters(ZenodoStatCache* cache, guint64* hits,
+        guint64* negative_hits, guint64* misses);
+
+#endif
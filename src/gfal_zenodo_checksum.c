@@ -0,0 +1,162 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Checksums, served from the file metadata when possible
+
+#include <json.h>
+#include <string.h>
+#include "gfal_zenodo.h"
+#include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_index.h"
+#include "gfal_zenodo_stats.h"
+
+// Smallest read used to hash the data, whatever DOWNLOAD_CHUNK_SIZE says
+#define ZENODO_CHECKSUM_MIN_CHUNK_SIZE (64 * 1024)
+
+
+// Zenodo stores the MD5 of each file, sometimes prefixed by the algorithm
+static int gfal2_zenodo_stored_checksum(ZenodoHandle* zenodo, const ZenodoResource* zr,
+        char* out, size_t outsize, GError** error)
+{
+    GError* tmp_err = NULL;
+    ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(zenodo);
+
+    if (gfal2_zenodo_get(zenodo, buffer, &tmp_err, zr->domain,
+            "/api/deposit/depositions/%s/files/%s", zr->deposition, zr->file) < 0) {
+        gfal2_zenodo_buffer_release(zenodo, buffer);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    json_object* root = json_tokener_parse(buffer->data);
+    gfal2_zenodo_buffer_release(zenodo, buffer);
+
+    json_object* checksum = NULL;
+    if (root)
+        json_object_object_get_ex(root, "checksum", &checksum);
+    if (!checksum) {
+        json_object_put(root);
+        gfal2_set_error(error, zenodo_domain(), ENOTSUP, __func__,
+                "The file metadata has no checksum");
+        return -1;
+    }
+
+    const char* value = json_object_get_string(checksum);
+    if (g_ascii_strncasecmp(value, "md5:", 4) == 0)
+        value += 4;
+    g_strlcpy(out, value, outsize);
+
+    json_object_put(root);
+    return 0;
+}
+
+
+// Hash the data itself, reading it with (possibly parallel) ranged requests
+static int gfal2_zenodo_streamed_checksum(ZenodoHandle* zenodo, const ZenodoResource* zr,
+        const char* type, off_t start_offset, size_t data_length,
+        char* out, size_t outsize, GError** error)
+{
+    GError* tmp_err = NULL;
+    ZenodoChecksum checksum;
+    char download_url[GFAL_URL_MAX_LEN];
+    off_t size = 0;
+
+    if (gfal2_zenodo_checksum_init(&checksum, type, &tmp_err) < 0 ||
+        gfal2_zenodo_resolve_download(zenodo, zr, download_url, sizeof(download_url),
+                &size, NULL, 0, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    off_t end = size;
+    if (data_length > 0 && start_offset + (off_t)data_length < end)
+        end = start_offset + data_length;
+
+    // Large enough to keep all the download streams busy
+    int streams = gfal2_get_opt_integer_with_default(zenodo->gfal2_context, "ZENODO",
+            "DOWNLOAD_STREAMS", ZENODO_DOWNLOAD_STREAMS_DEFAULT);
+    gint64 chunk_size = gfal2_get_opt_integer_with_default(zenodo->gfal2_context, "ZENODO",
+            "DOWNLOAD_CHUNK_SIZE", ZENODO_DOWNLOAD_CHUNK_SIZE_DEFAULT);
+    if (chunk_size < ZENODO_CHECKSUM_MIN_CHUNK_SIZE)
+        chunk_size = ZENODO_CHECKSUM_MIN_CHUNK_SIZE;
+    size_t buffer_size = chunk_size * MAX(streams, 1);
+    char* buffer = g_malloc(buffer_size);
+
+    off_t offset = start_offset;
+    while (offset < end) {
+        size_t len = MIN(buffer_size, (size_t)(end - offset));
+        ssize_t ret = gfal2_zenodo_get_range_parallel(zenodo, buffer, len, offset, &tmp_err,
+                zr->domain, download_url);
+        if (ret <= 0)
+            break;
+        gfal2_zenodo_checksum_update(&checksum, buffer, ret);
+        offset += ret;
+    }
+    g_free(buffer);
+
+    // The hash of part of the range is not the checksum of the range
+    if (!tmp_err && offset < end)
+        gfal2_set_error(&tmp_err, zenodo_domain(), EIO, __func__,
+                "Short read: %lld out of %lld bytes", (long long)(offset - start_offset),
+                (long long)(end - start_offset));
+
+    gfal2_zenodo_checksum_final(&checksum, out, outsize);
+    if (tmp_err) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+    return 0;
+}
+
+
+int gfal2_zenodo_checksum(plugin_handle plugin_data, const char* url, const char* check_type,
+        char* checksum_buffer, size_t buffer_length, off_t start_offset, size_t data_length,
+        GError** error)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    gfal2_zenodo_stats_call(zenodo->stats, ZenodoOpRead);
+    GError* tmp_err = NULL;
+    ZenodoResource zr;
+
+    if (gfal2_zenodo_resource_lookup(zenodo, &zr, url, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    if (zr.type != ZenodoFile) {
+        gfal2_set_error(error, zenodo_domain(), EISDIR, __func__, "Only files have a checksum");
+        return -1;
+    }
+
+    // The whole file MD5 is known by the server
+    if (g_ascii_strcasecmp(check_type, "MD5") == 0 && start_offset == 0 && data_length == 0) {
+        if (gfal2_zenodo_stored_checksum(zenodo, &zr, checksum_buffer, buffer_length, &tmp_err) == 0)
+            return 0;
+        if (tmp_err->code != ENOTSUP) {
+            gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+            return -1;
+        }
+        gfal_log(GFAL_VERBOSE_VERBOSE, "%s, computing it", tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
+    if (gfal2_zenodo_streamed_checksum(zenodo, &zr, check_type, start_offset, data_length,
+            checksum_buffer, buffer_length, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+    return 0;
+}
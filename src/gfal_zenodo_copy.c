@@ -0,0 +1,684 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Streaming copy between Zenodo and any other gfal2 url
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gfal_zenodo.h"
+#include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_index.h"
+#include "gfal_zenodo_stats.h"
+
+// Copy buffer defaults
+#define ZENODO_COPY_BUFFER_SIZE_DEFAULT (4 * 1024 * 1024)
+#define ZENODO_COPY_BUFFER_COUNT 2
+
+// Sides compared with the transferred data, same values as gfalt_checksum_mode_t
+#define ZENODO_CHECKSUM_NONE 0
+#define ZENODO_CHECKSUM_SOURCE 1
+#define ZENODO_CHECKSUM_TARGET 2
+#define ZENODO_CHECKSUM_BOTH (ZENODO_CHECKSUM_SOURCE | ZENODO_CHECKSUM_TARGET)
+
+
+struct ZenodoCopyBuffer {
+    char* data;
+    size_t size;
+    // > 0 data, 0 end of file, < 0 error
+    ssize_t len;
+};
+typedef struct ZenodoCopyBuffer ZenodoCopyBuffer;
+
+
+// The source is read on its own thread while the destination is written,
+// buffers go back and forth between the two sides through a pair of queues
+struct ZenodoCopy {
+    gfal2_context_t context;
+    int src_fd;
+    GAsyncQueue* free_buffers;
+    GAsyncQueue* full_buffers;
+    GError* read_error;
+    gint abort;
+};
+typedef struct ZenodoCopy ZenodoCopy;
+
+
+int gfal2_zenodo_check_url_transfer(plugin_handle plugin_data, gfal2_context_t context,
+        const char* src, const char* dst, gfal_url2_check check)
+{
+#ifdef HAVE_GFAL_COPY_BULK
+    if (check != GFAL_FILE_COPY && check != GFAL_BULK_COPY)
+        return FALSE;
+#else
+    if (check != GFAL_FILE_COPY)
+        return FALSE;
+#endif
+    return strncmp(src, "zenodo:", 7) == 0 || strncmp(dst, "zenodo:", 7) == 0;
+}
+
+
+static gpointer gfal2_zenodo_copy_reader(gpointer userdata)
+{
+    ZenodoCopy* copy = (ZenodoCopy*)userdata;
+    ZenodoCopyBuffer* buffer;
+
+    do {
+        buffer = g_async_queue_pop(copy->free_buffers);
+        if (g_atomic_int_get(&copy->abort))
+            buffer->len = 0;
+        else
+            buffer->len = gfal2_read(copy->context, copy->src_fd, buffer->data, buffer->size,
+                    &copy->read_error);
+        g_async_queue_push(copy->full_buffers, buffer);
+    } while (buffer->len > 0);
+
+    return NULL;
+}
+
+
+static void gfal2_zenodo_copy_monitor(gfalt_params_t params, const char* src, const char* dst,
+        size_t done, time_t start, size_t* last_done, time_t* last_time)
+{
+    time_t now = time(NULL);
+    if (now == *last_time)
+        return;
+
+    gfalt_hook_transfer_plugin_t hook;
+    hook.bytes_transfered = done;
+    hook.transfer_time = now - start;
+    hook.average_baudrate = hook.transfer_time > 0 ? done / hook.transfer_time : 0;
+    hook.instant_baudrate = (done - *last_done) / (now - *last_time);
+
+    gfalt_transfer_status_t state = gfalt_transfer_status_create(&hook);
+    plugin_trigger_monitor(params, state, src, dst);
+    gfalt_transfer_status_delete(state);
+
+    *last_done = done;
+    *last_time = now;
+}
+
+
+// Compare the checksum of the streamed data with the one reported by a side, if it has one
+static int gfal2_zenodo_copy_compare_checksum(gfal2_context_t context, const char* url,
+        const char* type, const char* streamed, GError** error)
+{
+    GError* tmp_err = NULL;
+    char remote[128];
+
+    if (gfal2_checksum(context, url, type, 0, 0, remote, sizeof(remote), &tmp_err) < 0) {
+        // Each plugin has its own way of saying it has no checksum
+        if (tmp_err->code == ENOSYS || tmp_err->code == ENOTSUP ||
+            tmp_err->code == EPROTONOSUPPORT) {
+            gfal_log(GFAL_VERBOSE_VERBOSE, "Can not get the %s checksum of %s, skipping: %s",
+                    type, url, tmp_err->message);
+            g_error_free(tmp_err);
+            return 0;
+        }
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    if (g_ascii_strcasecmp(remote, streamed) != 0) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                "Checksum mismatch for %s: %s != %s", url, remote, streamed);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int gfal2_zenodo_copy_verify(gfal2_context_t context, gfalt_params_t params,
+        const char* src, const char* dst, int mode, const char* type,
+        const char* user_checksum, const char* streamed, GError** error)
+{
+    plugin_trigger_event(params, zenodo_domain(), GFAL_EVENT_NONE, GFAL_EVENT_CHECKSUM_ENTER,
+            "%s %s", type, streamed);
+
+    if (user_checksum[0] && g_ascii_strcasecmp(user_checksum, streamed) != 0) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                "Checksum mismatch: user provided %s, transferred %s", user_checksum, streamed);
+        return -1;
+    }
+
+    if ((mode & ZENODO_CHECKSUM_SOURCE) &&
+        gfal2_zenodo_copy_compare_checksum(context, src, type, streamed, error) < 0)
+        return -1;
+    if ((mode & ZENODO_CHECKSUM_TARGET) &&
+        gfal2_zenodo_copy_compare_checksum(context, dst, type, streamed, error) < 0)
+        return -1;
+
+    plugin_trigger_event(params, zenodo_domain(), GFAL_EVENT_NONE, GFAL_EVENT_CHECKSUM_EXIT,
+            "%s %s", type, streamed);
+    return 0;
+}
+
+
+// Verify the checksum, and clean up the destination on failure
+static int gfal2_zenodo_copy_finish(gfal2_context_t context, gfalt_params_t params,
+        const char* src, const char* dst, ZenodoChecksum* checksum, int checksum_mode,
+        const char* checksum_type, const char* user_checksum, size_t done,
+        GError* tmp_err, GError** error)
+{
+    char streamed[128] = {0};
+
+    if (checksum)
+        gfal2_zenodo_checksum_final(checksum, streamed, sizeof(streamed));
+
+    if (!tmp_err && checksum)
+        gfal2_zenodo_copy_verify(context, params, src, dst, checksum_mode, checksum_type,
+                user_checksum, streamed, &tmp_err);
+
+    if (tmp_err) {
+        gfal2_unlink(context, dst, NULL);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    plugin_trigger_event(params, zenodo_domain(), GFAL_EVENT_NONE, GFAL_EVENT_TRANSFER_EXIT,
+            "%zu bytes", done);
+    return 0;
+}
+
+
+// Progress of a parallel download into a local file
+// Chunks complete in any order, and are hashed as soon as all the ones
+// before them are, while they are still in the page cache. Hashing reads
+// them back, so it is done by a thread of its own, not to hold up the
+// transfers sharing the multi handle
+struct ZenodoCopyProgress {
+    gfalt_params_t params;
+    const char* src;
+    const char* dst;
+    int fd;
+    size_t done;
+    time_t start;
+    size_t last_done;
+    time_t last_time;
+
+    ZenodoChecksum* checksum;
+    // Completed chunks, for the hashing thread, ended by an offset of -1
+    GAsyncQueue* completed;
+    GThread* hasher;
+
+    // Owned by the hashing thread until it is joined
+    char* buffer;
+    size_t buffer_size;
+    // Completed chunks not hashed yet, offset => length
+    GHashTable* pending;
+    off_t hashed;
+    GError* error;
+};
+typedef struct ZenodoCopyProgress ZenodoCopyProgress;
+
+typedef struct {
+    off_t offset;
+    size_t length;
+} ZenodoCopyChunk;
+
+
+// Hash [offset, offset + length) of the destination
+static int gfal2_zenodo_copy_hash_range(ZenodoCopyProgress* progress, off_t offset,
+        size_t length)
+{
+    while (length > 0) {
+        ssize_t ret = pread(progress->fd, progress->buffer, MIN(length, progress->buffer_size),
+                offset);
+        if (ret <= 0) {
+            gfal2_set_error(&progress->error, zenodo_domain(), ret < 0 ? errno : EIO, __func__,
+                    "Could not read back %s: %s", progress->dst,
+                    ret < 0 ? strerror(errno) : "unexpected end of file");
+            return -1;
+        }
+        gfal2_zenodo_checksum_update(progress->checksum, progress->buffer, ret);
+        offset += ret;
+        length -= ret;
+    }
+    return 0;
+}
+
+
+static gpointer gfal2_zenodo_copy_hasher(gpointer userdata)
+{
+    ZenodoCopyProgress* progress = (ZenodoCopyProgress*)userdata;
+    ZenodoCopyChunk* chunk;
+
+    while ((chunk = g_async_queue_pop(progress->completed))->offset >= 0) {
+        // After an error, only drain the queue
+        if (!progress->error) {
+            gint64* key = g_new(gint64, 1);
+            *key = chunk->offset;
+            g_hash_table_insert(progress->pending, key, GSIZE_TO_POINTER(chunk->length));
+        }
+        g_free(chunk);
+
+        gint64 next = progress->hashed;
+        gpointer value;
+        while (!progress->error &&
+               g_hash_table_lookup_extended(progress->pending, &next, NULL, &value)) {
+            size_t len = GPOINTER_TO_SIZE(value);
+            g_hash_table_remove(progress->pending, &next);
+            if (gfal2_zenodo_copy_hash_range(progress, progress->hashed, len) < 0)
+                break;
+            progress->hashed += len;
+            next = progress->hashed;
+        }
+    }
+    g_free(chunk);
+
+    return NULL;
+}
+
+
+static void gfal2_zenodo_copy_chunk_done(off_t offset, size_t length, void* data)
+{
+    ZenodoCopyProgress* progress = (ZenodoCopyProgress*)data;
+
+    progress->done += length;
+    gfal2_zenodo_copy_monitor(progress->params, progress->src, progress->dst, progress->done,
+            progress->start, &progress->last_done, &progress->last_time);
+
+    if (!progress->checksum || length == 0)
+        return;
+
+    ZenodoCopyChunk* chunk = g_new(ZenodoCopyChunk, 1);
+    chunk->offset = offset;
+    chunk->length = length;
+    g_async_queue_push(progress->completed, chunk);
+}
+
+
+// Zenodo to a local file: the chunks are fetched in parallel and written at their offsets
+// Progress is reported, and the checksum computed, as chunks complete
+static int gfal2_zenodo_copy_to_local(ZenodoHandle* zenodo, gfalt_params_t params,
+        const char* src, const char* dst, ZenodoChecksum* checksum, size_t buffer_size,
+        size_t* done, GError** error)
+{
+    GError* tmp_err = NULL;
+    ZenodoResource zr;
+    char download_url[GFAL_URL_MAX_LEN];
+    off_t size = 0;
+    const char* path = dst + 7;
+
+    gfal2_zenodo_stats_call(zenodo->stats, ZenodoOpRead);
+
+    if (gfal2_zenodo_resource_lookup(zenodo, &zr, src, &tmp_err) < 0 ||
+        gfal2_zenodo_resolve_download(zenodo, &zr, download_url, sizeof(download_url),
+                &size, NULL, 0, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    // Read and write, so chunks can be hashed back
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        gfal2_set_error(error, zenodo_domain(), errno, __func__,
+                "Could not open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        gfal2_set_error(error, zenodo_domain(), errno, __func__,
+                "Could not allocate %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    ZenodoCopyProgress progress;
+    memset(&progress, 0, sizeof(progress));
+    progress.params = params;
+    progress.src = src;
+    progress.dst = dst;
+    progress.fd = fd;
+    progress.start = progress.last_time = time(NULL);
+    if (checksum) {
+        progress.checksum = checksum;
+        progress.buffer_size = buffer_size;
+        progress.buffer = g_malloc(buffer_size);
+        progress.pending = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+        progress.completed = g_async_queue_new();
+        progress.hasher = g_thread_new("zenodo-hash", gfal2_zenodo_copy_hasher, &progress);
+    }
+
+    ssize_t ret = 0;
+    if (size > 0)
+        ret = gfal2_zenodo_get_range_to_fd(zenodo, fd, size, 0, gfal2_zenodo_copy_chunk_done,
+                &progress, &tmp_err, zr.domain, download_url);
+
+    if (progress.hasher) {
+        ZenodoCopyChunk* end = g_new(ZenodoCopyChunk, 1);
+        end->offset = -1;
+        end->length = 0;
+        g_async_queue_push(progress.completed, end);
+        g_thread_join(progress.hasher);
+        g_async_queue_unref(progress.completed);
+    }
+    if (ret >= 0 && ret != size)
+        gfal2_set_error(&tmp_err, zenodo_domain(), EIO, __func__,
+                "Short transfer: %zd out of %lld bytes", ret, (long long)size);
+
+    if (!tmp_err && progress.error) {
+        tmp_err = progress.error;
+        progress.error = NULL;
+    }
+    else if (!tmp_err && checksum && progress.hashed != size) {
+        gfal2_set_error(&tmp_err, zenodo_domain(), EIO, __func__,
+                "Only %lld out of %lld bytes were hashed", (long long)progress.hashed,
+                (long long)size);
+    }
+
+    if (close(fd) < 0 && !tmp_err)
+        gfal2_set_error(&tmp_err, zenodo_domain(), errno, __func__,
+                "Could not close %s: %s", path, strerror(errno));
+
+    if (progress.error)
+        g_error_free(progress.error);
+    if (progress.pending)
+        g_hash_table_destroy(progress.pending);
+    g_free(progress.buffer);
+
+    if (tmp_err) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    *done = size;
+    return 0;
+}
+
+
+int gfal2_zenodo_copy_file(plugin_handle plugin_data, gfal2_context_t context,
+        gfalt_params_t params, const char* src, const char* dst, GError** error)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    GError* tmp_err = NULL;
+    struct stat st;
+
+    // Overwrite
+    if (!gfalt_get_replace_existing_file(params, NULL) &&
+        gfal2_stat(context, dst, &st, NULL) == 0) {
+        gfal2_set_error(error, zenodo_domain(), EEXIST, __func__,
+                "The destination exists and overwrite is not enabled");
+        return -1;
+    }
+
+    // Checksum
+    char checksum_type[64] = "MD5", user_checksum[128] = {0}, streamed[128] = {0};
+#ifdef HAVE_GFALT_GET_CHECKSUM
+    // Which sides are compared with the transferred data is up to the user
+    int checksum_mode = gfalt_get_checksum(params, checksum_type, sizeof(checksum_type),
+            user_checksum, sizeof(user_checksum), NULL);
+#else
+    int checksum_mode = ZENODO_CHECKSUM_NONE;
+    if (gfalt_get_checksum_check(params, NULL)) {
+        checksum_mode = ZENODO_CHECKSUM_BOTH;
+        gfalt_get_user_defined_checksum(params, checksum_type, sizeof(checksum_type),
+                user_checksum, sizeof(user_checksum), NULL);
+    }
+#endif
+    gboolean checksum_check = (checksum_mode != ZENODO_CHECKSUM_NONE);
+    ZenodoChecksum checksum;
+    if (checksum_check) {
+        if (!checksum_type[0])
+            g_strlcpy(checksum_type, "MD5", sizeof(checksum_type));
+        if (gfal2_zenodo_checksum_init(&checksum, checksum_type, &tmp_err) < 0) {
+            gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+            return -1;
+        }
+    }
+
+    plugin_trigger_event(params, zenodo_domain(), GFAL_EVENT_NONE, GFAL_EVENT_TRANSFER_ENTER,
+            "%s => %s", src, dst);
+
+    size_t buffer_size = gfal2_get_opt_integer_with_default(zenodo->gfal2_context,
+            "ZENODO", "COPY_BUFFER_SIZE", ZENODO_COPY_BUFFER_SIZE_DEFAULT);
+    size_t done = 0;
+
+    // Downloads into a local file can skip the streaming pipeline
+    int streams = gfal2_get_opt_integer_with_default(zenodo->gfal2_context,
+            "ZENODO", "DOWNLOAD_STREAMS", ZENODO_DOWNLOAD_STREAMS_DEFAULT);
+    if (streams > 1 && strncmp(src, "zenodo:", 7) == 0 && strncmp(dst, "file://", 7) == 0) {
+        gfal2_zenodo_copy_to_local(zenodo, params, src, dst, checksum_check ? &checksum : NULL,
+                buffer_size, &done, &tmp_err);
+        return gfal2_zenodo_copy_finish(context, params, src, dst,
+                checksum_check ? &checksum : NULL, checksum_mode, checksum_type, user_checksum,
+                done, tmp_err, error);
+    }
+
+    ZenodoCopy copy;
+    memset(&copy, 0, sizeof(copy));
+    copy.context = context;
+
+    copy.src_fd = gfal2_open(context, src, O_RDONLY, &tmp_err);
+    if (copy.src_fd < 0) {
+        if (checksum_check)
+            gfal2_zenodo_checksum_final(&checksum, streamed, sizeof(streamed));
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    int dst_fd = gfal2_open(context, dst, O_WRONLY | O_CREAT | O_TRUNC, &tmp_err);
+    if (dst_fd < 0) {
+        if (checksum_check)
+            gfal2_zenodo_checksum_final(&checksum, streamed, sizeof(streamed));
+        gfal2_close(context, copy.src_fd, NULL);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    // Double buffering
+    ZenodoCopyBuffer buffers[ZENODO_COPY_BUFFER_COUNT];
+    copy.free_buffers = g_async_queue_new();
+    copy.full_buffers = g_async_queue_new();
+    int i;
+    for (i = 0; i < ZENODO_COPY_BUFFER_COUNT; ++i) {
+        buffers[i].data = g_malloc(buffer_size);
+        buffers[i].size = buffer_size;
+        g_async_queue_push(copy.free_buffers, &buffers[i]);
+    }
+
+    GThread* reader = g_thread_new("zenodo-copy", gfal2_zenodo_copy_reader, &copy);
+
+    time_t start = time(NULL), last_time = start;
+    size_t last_done = 0;
+    ZenodoCopyBuffer* buffer;
+
+    while ((buffer = g_async_queue_pop(copy.full_buffers))->len > 0) {
+        if (!tmp_err) {
+            ssize_t written = 0;
+            while (written < buffer->len && !tmp_err) {
+                ssize_t ret = gfal2_write(context, dst_fd, buffer->data + written,
+                        buffer->len - written, &tmp_err);
+                if (ret > 0)
+                    written += ret;
+                else if (!tmp_err)
+                    gfal2_set_error(&tmp_err, zenodo_domain(), EIO, __func__,
+                            "The destination did not accept any data");
+            }
+            if (checksum_check)
+                gfal2_zenodo_checksum_update(&checksum, buffer->data, buffer->len);
+            done += written;
+            gfal2_zenodo_copy_monitor(params, src, dst, done, start, &last_done, &last_time);
+        }
+        // On a write error stop the reader, and keep draining until it is done
+        if (tmp_err)
+            g_atomic_int_set(&copy.abort, 1);
+        g_async_queue_push(copy.free_buffers, buffer);
+    }
+
+    g_thread_join(reader);
+    if (!tmp_err && copy.read_error)
+        tmp_err = copy.read_error;
+    else if (copy.read_error)
+        g_error_free(copy.read_error);
+
+    gfal2_close(context, copy.src_fd, NULL);
+    if (gfal2_close(context, dst_fd, tmp_err ? NULL : &tmp_err) < 0 && !tmp_err)
+        tmp_err = g_error_new(zenodo_domain(), EIO, "Failed to close the destination");
+
+    for (i = 0; i < ZENODO_COPY_BUFFER_COUNT; ++i)
+        g_free(buffers[i].data);
+    g_async_queue_unref(copy.free_buffers);
+    g_async_queue_unref(copy.full_buffers);
+
+    return gfal2_zenodo_copy_finish(context, params, src, dst,
+            checksum_check ? &checksum : NULL, checksum_mode, checksum_type, user_checksum,
+            done, tmp_err, error);
+}
+
+
+#ifdef HAVE_GFAL_COPY_BULK
+
+// The deposition url of a destination file, if it is given by name (uploads
+// are addressed by name), or NULL
+static gchar* gfal2_zenodo_copy_bulk_deposition(const char* dst, const char** name,
+        char* namebuf, size_t namesize)
+{
+    ZenodoResource zr;
+    if (strncmp(dst, "zenodo:", 7) != 0 || gfal2_zenodo_resource_from_uri(&zr, dst, NULL) < 0 ||
+        zr.type != ZenodoFile || !zr.file_name[0])
+        return NULL;
+    const char* slash = strrchr(dst, '/');
+    g_strlcpy(namebuf, zr.file_name, namesize);
+    *name = namebuf;
+    return g_strndup(dst, slash - dst);
+}
+
+
+// Only MD5 can be compared with what is sent
+static const char* gfal2_zenodo_copy_bulk_md5(const char* checksum)
+{
+    if (checksum && g_ascii_strncasecmp(checksum, "MD5:", 4) == 0)
+        return checksum + 4;
+    if (checksum && checksum[0])
+        gfal_log(GFAL_VERBOSE_VERBOSE, "Only MD5 is checked on bulk uploads, ignoring %s",
+                checksum);
+    return NULL;
+}
+
+
+// Local files into one deposition go as a single concurrent batch, anything
+// else is copied one pair at a time
+int gfal2_zenodo_copy_bulk(plugin_handle plugin_data, gfal2_context_t context,
+        gfalt_params_t params, size_t nbfiles, const char* const* srcs, const char* const* dsts,
+        const char* const* checksums, GError** op_error, GError*** file_errors)
+{
+    GError** errors = g_new0(GError*, nbfiles);
+    *file_errors = errors;
+    if (nbfiles == 0)
+        return 0;
+
+    const char** names = g_new0(const char*, nbfiles);
+    char (*namebufs)[NAME_MAX + 1] = g_malloc(nbfiles * sizeof(*namebufs));
+    gchar* deposition = NULL;
+    gboolean batch = TRUE;
+    size_t i;
+
+    for (i = 0; i < nbfiles && batch; ++i) {
+        gchar* this_deposition = gfal2_zenodo_copy_bulk_deposition(dsts[i], &names[i],
+                namebufs[i], sizeof(namebufs[i]));
+        batch = strncmp(srcs[i], "file://", 7) == 0 && this_deposition &&
+                (!deposition || strcmp(deposition, this_deposition) == 0);
+        if (!deposition)
+            deposition = this_deposition;
+        else
+            g_free(this_deposition);
+    }
+
+    int failed = 0;
+    if (!batch) {
+        for (i = 0; i < nbfiles; ++i) {
+            if (gfal2_zenodo_copy_file(plugin_data, context, params, srcs[i], dsts[i],
+                    &errors[i]) < 0)
+                ++failed;
+        }
+        g_free(deposition);
+        g_free(namebufs);
+        g_free(names);
+        return failed ? -1 : 0;
+    }
+
+    // Without overwrite, existing destinations are left alone
+    gboolean* skip = g_new0(gboolean, nbfiles);
+    if (!gfalt_get_replace_existing_file(params, NULL)) {
+        struct stat* stats = g_new0(struct stat, nbfiles);
+        GError** stat_errors = g_new0(GError*, nbfiles);
+        gfal2_zenodo_bulk_stat(plugin_data, nbfiles, dsts, stats, stat_errors);
+        for (i = 0; i < nbfiles; ++i) {
+            if (!stat_errors[i]) {
+                gfal2_set_error(&errors[i], zenodo_domain(), EEXIST, __func__,
+                        "The destination exists and overwrite is not enabled");
+                skip[i] = TRUE;
+                ++failed;
+            }
+            else if (stat_errors[i]->code != ENOENT) {
+                gfal2_propagate_prefixed_error(&errors[i], stat_errors[i], __func__);
+                stat_errors[i] = NULL;
+                skip[i] = TRUE;
+                ++failed;
+            }
+            if (stat_errors[i])
+                g_error_free(stat_errors[i]);
+        }
+        g_free(stat_errors);
+        g_free(stats);
+    }
+
+    const char** batch_srcs = g_new(const char*, nbfiles);
+    const char** batch_names = g_new(const char*, nbfiles);
+    const char** batch_md5s = g_new(const char*, nbfiles);
+    size_t* owner = g_new(size_t, nbfiles);
+    int n = 0;
+    for (i = 0; i < nbfiles; ++i) {
+        if (skip[i])
+            continue;
+        batch_srcs[n] = srcs[i];
+        batch_names[n] = names[i];
+        batch_md5s[n] = gfal2_zenodo_copy_bulk_md5(checksums ? checksums[i] : NULL);
+        owner[n++] = i;
+    }
+
+    if (n > 0) {
+        plugin_trigger_event(params, zenodo_domain(), GFAL_EVENT_NONE, GFAL_EVENT_TRANSFER_ENTER,
+                "%d files => %s", n, deposition);
+        GError** batch_errors = g_new0(GError*, n);
+        gfal2_zenodo_upload_batch(plugin_data, deposition, n, batch_srcs, batch_names,
+                batch_md5s, batch_errors);
+        int batch_failed = 0;
+        for (i = 0; i < (size_t)n; ++i) {
+            if (batch_errors[i]) {
+                errors[owner[i]] = batch_errors[i];
+                ++batch_failed;
+            }
+        }
+        g_free(batch_errors);
+        failed += batch_failed;
+        plugin_trigger_event(params, zenodo_domain(), GFAL_EVENT_NONE, GFAL_EVENT_TRANSFER_EXIT,
+                "%d files, %d failed", n, batch_failed);
+    }
+
+    g_free(owner);
+    g_free(batch_md5s);
+    g_free(batch_names);
+    g_free(batch_srcs);
+    g_free(skip);
+    g_free(deposition);
+    g_free(namebufs);
+    g_free(names);
+    return failed ? -1 : 0;
+}
+
+#endif
@@ -17,69 +17,450 @@
 // Directory listing functions
 
 #include <json.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include "gfal_zenodo.h"
+#include "gfal_zenodo_cache.h"
+#include "gfal_zenodo_etag.h"
 #include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_index.h"
+#include "gfal_zenodo_listing.h"
+#include "gfal_zenodo_stats.h"
+
+
+// Listing defaults
+#define ZENODO_LIST_PAGE_SIZE_DEFAULT 100
+#define ZENODO_LIST_CONCURRENCY_DEFAULT 4
+
+
+// A page of the listing, fetched either in the foreground or by the prefetch pool
+struct ZenodoPage {
+    int number;
+    ZenodoListing listing;
+    int length;
+    GError* error;
+    gboolean ready;
+};
+typedef struct ZenodoPage ZenodoPage;
 
 
 struct ZenodoDir {
-    struct json_object* root;
-    struct array_list* contents;
-	int content_length;
+    ZenodoHandle* zenodo;
+    ZenodoResource zr;
+    ZenodoResourceType type;
+    ZenodoListSchema schema;
+
+    // Search parameters from the url, appended to each page request
+    gchar* search;
+
+    int page_size;
+    // Entries in the first page, the server may serve less than page_size
+    int first_length;
+    // 0 if the server did not tell
+    int total_pages;
+    int last_scheduled;
+    // Pages fetched ahead of the one being consumed, at most
+    int lookahead;
+    // Set once a page failed, the listing can not go on past it
+    GError* error;
+
+    // Page being consumed
+    ZenodoPage* page;
 	int i;
 	struct dirent ent;
-    ZenodoResourceType type;
+
+    // Pages being fetched in the background, by number
+    GThreadPool* prefetch;
+    GHashTable* pages;
+    GMutex lock;
+    GCond cond;
 };
 typedef struct ZenodoDir ZenodoDir;
 
 
+static void gfal2_zenodo_page_free(ZenodoPage* page)
+{
+    if (!page)
+        return;
+    gfal2_zenodo_listing_clear(&page->listing);
+    if (page->error)
+        g_error_free(page->error);
+    g_free(page);
+}
+
+
+// Work out the number of pages from X-Total-Count, or from the rel="last" link
+// page_size is the number of entries the server actually returned per page
+static int gfal2_zenodo_total_pages(const ZenodoBuffer* buffer, int page_size)
+{
+    char value[2048];
+
+    if (gfal2_zenodo_buffer_header(buffer, "X-Total-Count", value, sizeof(value)) == 0) {
+        long total = atol(value);
+        return (int)((total + page_size - 1) / page_size);
+    }
+
+    if (gfal2_zenodo_buffer_header(buffer, "Link", value, sizeof(value)) == 0) {
+        char* last = strstr(value, "rel=\"last\"");
+        if (last) {
+            *last = '\0';
+            char* link = strrchr(value, '<');
+            char* page = link ? strstr(link, "page=") : NULL;
+            if (page && (page == link + 1 || page[-1] == '?' || page[-1] == '&'))
+                return atoi(page + 5);
+        }
+    }
+
+    return 0;
+}
+
+
+// 1 if the Link header has a rel="next", 0 if it has links but not that one,
+// -1 if there is no Link header
+static int gfal2_zenodo_link_next(const ZenodoBuffer* buffer)
+{
+    char value[2048];
+    if (gfal2_zenodo_buffer_header(buffer, "Link", value, sizeof(value)) < 0)
+        return -1;
+    return strstr(value, "rel=\"next\"") != NULL;
+}
+
+
+// Decoded page as kept by the revalidation cache
+struct ZenodoCachedPage {
+    gint32 total_pages;
+    // Followed by the packed listing
+};
+
+
+// Fetch one page of the listing
+// Pages that did not change since they were last fetched are not decoded again
+static void gfal2_zenodo_fetch_page(ZenodoDir* dir, ZenodoPage* page)
+{
+    ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(dir->zenodo);
+    GError* tmp_err = NULL;
+    char url[GFAL_URL_MAX_LEN];
+
+    switch (dir->schema) {
+        case ZenodoListDepositions:
+            gfal2_zenodo_format_url(url, sizeof(url), dir->zr.domain,
+                    "/api/deposit/depositions?page=%d&size=%d%s", page->number, dir->page_size,
+                    dir->search);
+            break;
+        case ZenodoListRecords:
+            gfal2_zenodo_format_url(url, sizeof(url), dir->zr.domain,
+                    "/api/records?page=%d&size=%d%s", page->number, dir->page_size, dir->search);
+            break;
+        default:
+            gfal2_zenodo_format_url(url, sizeof(url), dir->zr.domain,
+                    "/api/deposit/depositions/%s/files", dir->zr.deposition);
+    }
+
+    gpointer cached;
+    gsize cachedsize;
+    struct ZenodoCachedPage header;
+    ssize_t ret = gfal2_zenodo_get_conditional(dir->zenodo, buffer, &cached, &cachedsize,
+            &tmp_err, dir->zr.domain, url);
+
+    if (ret >= 0 && cached) {
+        memcpy(&header, cached, MIN(sizeof(header), cachedsize));
+        if (cachedsize < sizeof(header) || gfal2_zenodo_listing_unpack(&page->listing,
+                (const char*)cached + sizeof(header), cachedsize - sizeof(header)) < 0)
+            gfal2_set_error(&tmp_err, zenodo_domain(), EIO, __func__, "Corrupted cached listing");
+        else
+            page->length = page->listing.length;
+
+        if (page->number == 1 && dir->type == ZenodoRoot)
+            dir->total_pages = header.total_pages;
+        g_free(cached);
+    }
+    else if (ret >= 0) {
+        if (gfal2_zenodo_listing_decode(&page->listing, dir->schema, buffer->data, buffer->size,
+                &tmp_err) == 0) {
+            page->length = page->listing.length;
+            if (page->listing.has_next < 0)
+                page->listing.has_next = gfal2_zenodo_link_next(buffer);
+
+            // The server may cap the page size, so count with what it returned
+            if (page->number == 1 && dir->type == ZenodoRoot)
+                dir->total_pages = gfal2_zenodo_total_pages(buffer,
+                        page->length > 0 ? page->length : dir->page_size);
+
+            GString* packed = g_string_sized_new(sizeof(header) +
+                    page->length * sizeof(ZenodoListEntry) + page->listing.names->len + 64);
+            header.total_pages = dir->total_pages;
+            g_string_append_len(packed, (const gchar*)&header, sizeof(header));
+            gfal2_zenodo_listing_pack(&page->listing, packed);
+            gsize packedsize = packed->len;
+            gfal2_zenodo_etag_store(dir->zenodo->etag_cache, url, buffer,
+                    g_string_free(packed, FALSE), packedsize);
+        }
+    }
+    gfal2_zenodo_buffer_release(dir->zenodo, buffer);
+
+    if (tmp_err)
+        gfal2_propagate_prefixed_error(&page->error, tmp_err, __func__);
+}
+
+
+// Prefetch pool worker
+static void gfal2_zenodo_prefetch_worker(gpointer data, gpointer user_data)
+{
+    ZenodoPage* page = (ZenodoPage*)data;
+    ZenodoDir* dir = (ZenodoDir*)user_data;
+
+    gfal2_zenodo_stats_attribute(ZenodoOpList);
+    gfal2_zenodo_fetch_page(dir, page);
+
+    g_mutex_lock(&dir->lock);
+    page->ready = TRUE;
+    g_cond_broadcast(&dir->cond);
+    g_mutex_unlock(&dir->lock);
+}
+
+
+// Schedule the fetch of all pages up to (and including) number
+static void gfal2_zenodo_schedule_pages(ZenodoDir* dir, int number)
+{
+    g_mutex_lock(&dir->lock);
+    while (dir->last_scheduled < number) {
+        ZenodoPage* page = g_malloc0(sizeof(*page));
+        page->number = ++dir->last_scheduled;
+        g_hash_table_insert(dir->pages, GINT_TO_POINTER(page->number), page);
+        g_thread_pool_push(dir->prefetch, page, NULL);
+    }
+    g_mutex_unlock(&dir->lock);
+}
+
+
+// Wait for a scheduled page and take it out of the prefetched set
+static ZenodoPage* gfal2_zenodo_wait_page(ZenodoDir* dir, int number)
+{
+    g_mutex_lock(&dir->lock);
+    ZenodoPage* page = g_hash_table_lookup(dir->pages, GINT_TO_POINTER(number));
+    while (!page->ready)
+        g_cond_wait(&dir->cond, &dir->lock);
+    g_hash_table_steal(dir->pages, GINT_TO_POINTER(number));
+    g_mutex_unlock(&dir->lock);
+    return page;
+}
+
+
+// True if there may be more entries after the current page
+// The requested page size is not trusted, since servers may serve less
+static gboolean gfal2_zenodo_has_next_page(ZenodoDir* dir)
+{
+    if (dir->type != ZenodoRoot || dir->page->length == 0)
+        return FALSE;
+    // The response links to the next page, or the search envelope says so
+    if (dir->page->listing.has_next >= 0)
+        return dir->page->listing.has_next;
+    if (dir->total_pages > 0)
+        return dir->page->number < dir->total_pages;
+    // Without any hint, a page shorter than the first one is the last, and
+    // after the first one we can only ask for the next
+    return dir->page->number == 1 || dir->page->length >= dir->first_length;
+}
+
+
+// Keep up to lookahead pages after the current one scheduled
+// Without a known total only the next one, if there is one
+static void gfal2_zenodo_schedule_ahead(ZenodoDir* dir)
+{
+    if (dir->total_pages > 0)
+        gfal2_zenodo_schedule_pages(dir,
+                MIN(dir->total_pages, dir->page->number + dir->lookahead));
+    else if (gfal2_zenodo_has_next_page(dir))
+        gfal2_zenodo_schedule_pages(dir, dir->page->number + 1);
+}
+
+
+// Validate a date for a range query, either YYYY-MM-DD or a full timestamp
+static gboolean gfal2_zenodo_valid_date(const char* value)
+{
+    char full[64];
+    if (strlen(value) == 10) {
+        snprintf(full, sizeof(full), "%sT00:00:00", value);
+        value = full;
+    }
+    return gfal2_zenodo_parse_time(value) >= 0;
+}
+
+
+// Translate the query of the url (q, status, sort, modified_since, records)
+// into the search parameters of the listing
+static int gfal2_zenodo_list_query(ZenodoDir* dir, const char* query, GError** error)
+{
+    GString* search = g_string_new(NULL);
+    GString* q = g_string_new(NULL);
+    gchar* modified_since = NULL;
+    int ret = 0;
+
+    gchar** pairs = g_strsplit(query, "&", -1);
+    gchar** pair;
+    for (pair = pairs; *pair && ret == 0; ++pair) {
+        if (!**pair)
+            continue;
+
+        char* equal = strchr(*pair, '=');
+        if (equal)
+            *equal = '\0';
+        // Forms encode spaces as +
+        char* plus;
+        for (plus = equal ? equal + 1 : NULL; plus && (plus = strchr(plus, '+')); )
+            *plus = ' ';
+        gchar* value = g_uri_unescape_string(equal ? equal + 1 : "", NULL);
+        const char* key = *pair;
+
+        if (!value) {
+            gfal2_set_error(error, zenodo_domain(), EINVAL, __func__, "Malformed value for %s", key);
+            ret = -1;
+        }
+        else if (strcmp(key, "records") == 0) {
+            if (strcmp(value, "0") != 0 && g_ascii_strcasecmp(value, "false") != 0)
+                dir->schema = ZenodoListRecords;
+        }
+        else if (strcmp(key, "q") == 0) {
+            if (value[0])
+                g_string_append_printf(q, "%s(%s)", q->len ? " AND " : "", value);
+        }
+        else if (strcmp(key, "status") == 0) {
+            if (strcmp(value, "draft") != 0 && strcmp(value, "published") != 0) {
+                gfal2_set_error(error, zenodo_domain(), EINVAL, __func__,
+                        "status must be draft or published");
+                ret = -1;
+            }
+            else {
+                g_string_append_printf(search, "&status=%s", value);
+            }
+        }
+        else if (strcmp(key, "sort") == 0) {
+            const char* order = (value[0] == '-') ? value + 1 : value;
+            if (strcmp(order, "bestmatch") != 0 && strcmp(order, "mostrecent") != 0) {
+                gfal2_set_error(error, zenodo_domain(), EINVAL, __func__,
+                        "sort must be [-]bestmatch or [-]mostrecent");
+                ret = -1;
+            }
+            else {
+                g_string_append_printf(search, "&sort=%s", value);
+            }
+        }
+        else if (strcmp(key, "modified_since") == 0) {
+            if (!gfal2_zenodo_valid_date(value)) {
+                gfal2_set_error(error, zenodo_domain(), EINVAL, __func__,
+                        "modified_since must be a date or an ISO 8601 timestamp");
+                ret = -1;
+            }
+            else {
+                g_free(modified_since);
+                modified_since = g_strdup(value);
+            }
+        }
+        else {
+            gfal2_set_error(error, zenodo_domain(), EINVAL, __func__,
+                    "Unknown query parameter %s", key);
+            ret = -1;
+        }
+        g_free(value);
+    }
+    g_strfreev(pairs);
+
+    if (ret == 0 && dir->schema == ZenodoListRecords && strstr(search->str, "&status=")) {
+        gfal2_set_error(error, zenodo_domain(), EINVAL, __func__,
+                "Public records can not be filtered by status");
+        ret = -1;
+    }
+
+    // The date range goes into the query, on the field each index has
+    if (ret == 0 && modified_since) {
+        g_string_append_printf(q, "%s%s:[\"%s\" TO *]", q->len ? " AND " : "",
+                dir->schema == ZenodoListRecords ? "updated" : "modified", modified_since);
+    }
+    if (ret == 0 && q->len) {
+        gchar* escaped = g_uri_escape_string(q->str, NULL, FALSE);
+        g_string_append_printf(search, "&q=%s", escaped);
+        g_free(escaped);
+    }
+
+    g_free(modified_since);
+    g_string_free(q, TRUE);
+    dir->search = g_string_free(search, ret < 0);
+    return ret;
+}
+
+
 gfal_file_handle gfal2_zenodo_opendir(plugin_handle plugin_data,
         const char* url, GError** error)
 {
+	gfal2_zenodo_stats_call(((ZenodoHandle*)plugin_data)->stats, ZenodoOpList);
 	GError* tmp_err = NULL;
 	ZenodoResource zr;
 
-	if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+	if (gfal2_zenodo_resource_lookup(plugin_data, &zr, url, &tmp_err) < 0) {
 		gfal2_propagate_prefixed_error(error, tmp_err, __func__);
 		return NULL;
 	}
 
-	ZenodoDir* dir = NULL;
-	char buffer[102400];
-	json_object* root;
-
-	switch (zr.type) {
-		case ZenodoRoot:
-		    if (gfal2_zenodo_get(plugin_data, buffer, sizeof(buffer), &tmp_err,
-		    		zr.domain, "/api/deposit/depositions") < 0) {
-				gfal2_propagate_prefixed_error(error, tmp_err, __func__);
-				return NULL;
-			}
-			break;
-		case ZenodoDeposition:
-		    if (gfal2_zenodo_get(plugin_data, buffer, sizeof(buffer), &tmp_err,
-                    zr.domain, "/api/deposit/depositions/%s/files", zr.deposition) < 0) {
-                gfal2_propagate_prefixed_error(error, tmp_err, __func__);
-                return NULL;
-            }
-		    root = json_tokener_parse(buffer);
-		    break;
-		case ZenodoFile:
-			gfal2_set_error(error, zenodo_domain(), ENOTDIR, __func__, "Can not list a file");
-			return NULL;
+	if (zr.type == ZenodoFile) {
+	    gfal2_set_error(error, zenodo_domain(), ENOTDIR, __func__, "Can not list a file");
+	    return NULL;
 	}
 
-    root = json_tokener_parse(buffer);
-    if (!root) {
-        gfal2_set_error(error, zenodo_domain(), EIO, __func__, "Could not parse the response");
-        return NULL;
-    }
-    dir = g_malloc0(sizeof(*dir));
-    dir->root = root;
-    dir->type = zr.type;
-    dir->contents = json_object_get_array(root);
-    dir->content_length = json_object_array_length(root);
+	ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+	ZenodoDir* dir = g_malloc0(sizeof(*dir));
+	dir->zenodo = zenodo;
+	dir->zr = zr;
+	dir->type = zr.type;
+	dir->schema = (zr.type == ZenodoRoot) ? ZenodoListDepositions : ZenodoListFiles;
+
+	// Filters are sent to the server, so only the matching entries come back
+	const char* query = strchr(url, '?');
+	if (query && zr.type != ZenodoRoot) {
+	    gfal2_set_error(&tmp_err, zenodo_domain(), EINVAL, __func__,
+	            "Only the depositions and the records can be searched");
+	}
+	if (tmp_err || gfal2_zenodo_list_query(dir, query ? query + 1 : "", &tmp_err) < 0) {
+	    g_free(dir);
+	    gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+	    return NULL;
+	}
+
+	dir->page_size = gfal2_get_opt_integer_with_default(zenodo->gfal2_context,
+	        "ZENODO", "LIST_PAGE_SIZE", ZENODO_LIST_PAGE_SIZE_DEFAULT);
+	if (dir->page_size <= 0)
+	    dir->page_size = ZENODO_LIST_PAGE_SIZE_DEFAULT;
+
+	// First page in the foreground, so we return after one round trip
+	dir->page = g_malloc0(sizeof(ZenodoPage));
+	dir->page->number = 1;
+	dir->last_scheduled = 1;
+	gfal2_zenodo_fetch_page(dir, dir->page);
+	if (dir->page->error) {
+	    gfal2_propagate_prefixed_error(error, dir->page->error, __func__);
+	    dir->page->error = NULL;
+	    gfal2_zenodo_page_free(dir->page);
+	    g_free(dir->search);
+	    g_free(dir);
+	    return NULL;
+	}
+
+	dir->first_length = dir->page->length;
+
+	g_mutex_init(&dir->lock);
+	g_cond_init(&dir->cond);
+	dir->pages = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+	        (GDestroyNotify)gfal2_zenodo_page_free);
+
+	if (gfal2_zenodo_has_next_page(dir)) {
+	    int concurrency = gfal2_get_opt_integer_with_default(zenodo->gfal2_context,
+	            "ZENODO", "LIST_CONCURRENCY", ZENODO_LIST_CONCURRENCY_DEFAULT);
+	    dir->lookahead = MAX(concurrency, 1);
+	    dir->prefetch = g_thread_pool_new(gfal2_zenodo_prefetch_worker, dir,
+	            dir->lookahead, FALSE, NULL);
+	    // Pages are kept until they are read, so do not get too far ahead of the reader
+	    gfal2_zenodo_schedule_ahead(dir);
+	}
 
 	return gfal_file_handle_new2(gfal2_zenodo_getName(), dir, NULL, url);
 }
@@ -89,7 +470,16 @@ int gfal2_zenodo_closedir(plugin_handle plugin_data, gfal_file_handle dir_desc,
         GError** error)
 {
 	ZenodoDir* dir_handle = gfal_file_handle_get_fdesc(dir_desc);
-    json_object_put(dir_handle->root);
+	// Drop what has not started yet, and wait for what is running
+	if (dir_handle->prefetch)
+	    g_thread_pool_free(dir_handle->prefetch, TRUE, TRUE);
+	g_hash_table_destroy(dir_handle->pages);
+	gfal2_zenodo_page_free(dir_handle->page);
+	g_mutex_clear(&dir_handle->lock);
+	g_cond_clear(&dir_handle->cond);
+	g_free(dir_handle->search);
+	if (dir_handle->error)
+	    g_error_free(dir_handle->error);
     g_free(dir_handle);
     gfal_file_handle_delete(dir_desc);
     return 0;
@@ -133,18 +523,16 @@ struct dirent* gfal2_zenodo_deposition_to_stat(json_object* entry,
     }
 
     // Created
-    struct tm time;
+    time_t when;
     json_object_object_get_ex(entry, "created", &aux);
-    if (aux) {
-        strptime(json_object_get_string(aux), "%Y-%m-%dT%H:%M:%S%z", &time);
-        st->st_ctime = mktime(&time);
+    if (aux && (when = gfal2_zenodo_parse_time(json_object_get_string(aux))) > 0) {
+        st->st_ctime = when;
     }
 
     // Modified
     json_object_object_get_ex(entry, "modified", &aux);
-    if (aux) {
-        strptime(json_object_get_string(aux), "%Y-%m-%dT%H:%M:%S%z", &time);
-        st->st_mtime = mktime(&time);
+    if (aux && (when = gfal2_zenodo_parse_time(json_object_get_string(aux))) > 0) {
+        st->st_mtime = when;
     }
 
     // Access
@@ -199,20 +587,73 @@ struct dirent* gfal2_zenodo_readdirpp(plugin_handle plugin_data,
         gfal_file_handle dir_desc, struct stat* st, GError** error)
 {
     ZenodoDir* dir_handle = gfal_file_handle_get_fdesc(dir_desc);
+    gfal2_zenodo_stats_attribute(ZenodoOpList);
 
-    if (dir_handle->i >= dir_handle->content_length)
+    // A failed page is not the end of the listing, keep saying so
+    if (dir_handle->error) {
+        gfal2_propagate_prefixed_error(error, g_error_copy(dir_handle->error), __func__);
         return NULL;
+    }
 
-    json_object* entry = (json_object*)array_list_get_idx(dir_handle->contents, dir_handle->i++);
+    while (dir_handle->i >= dir_handle->page->length) {
+        if (!gfal2_zenodo_has_next_page(dir_handle)) {
+            // A filtered listing does not have all the names
+            if (dir_handle->schema != ZenodoListRecords && !dir_handle->search[0])
+                gfal2_zenodo_index_complete(dir_handle->zenodo->name_index, dir_handle->zr.domain,
+                        dir_handle->type == ZenodoRoot ? NULL : dir_handle->zr.deposition);
+            return NULL;
+        }
+
+        int next = dir_handle->page->number + 1;
+        gfal2_zenodo_schedule_pages(dir_handle, next);
+        ZenodoPage* page = gfal2_zenodo_wait_page(dir_handle, next);
+
+        gfal2_zenodo_page_free(dir_handle->page);
+        dir_handle->page = page;
+        dir_handle->i = 0;
+
+        if (page->error) {
+            dir_handle->error = page->error;
+            page->error = NULL;
+            page->length = 0;
+            gfal2_propagate_prefixed_error(error, g_error_copy(dir_handle->error), __func__);
+            return NULL;
+        }
+
+        // Prefetch the following pages while this one is consumed
+        gfal2_zenodo_schedule_ahead(dir_handle);
+    }
 
-    switch (dir_handle->type) {
-    case ZenodoRoot:
-        return gfal2_zenodo_deposition_to_stat(entry, &dir_handle->ent, st);
-    case ZenodoDeposition:
-        return gfal2_zenodo_file_to_stat(entry, &dir_handle->ent, st);
-    default:
-        gfal2_set_error(error, zenodo_domain(), ENOSYS, __func__,
-                "Not implemented for this type of resource");
-        return NULL;
+    const ZenodoListing* listing = &dir_handle->page->listing;
+    const char* name = listing->names->str + listing->entries[dir_handle->i].name;
+    struct dirent* dent = gfal2_zenodo_listing_entry(listing, dir_handle->i++,
+            &dir_handle->ent, st);
+
+    // Remember the entry, so a stat right after the listing is free,
+    // and so is resolving its title
+    char id[NAME_MAX + 1];
+    g_strlcpy(id, name, sizeof(id));
+    char* colon = strchr(id, ':');
+    if (colon)
+        *colon = '\0';
+    const char* title = strchr(name, ':');
+    // Records are not necessarily depositions of this account
+    if (dir_handle->schema == ZenodoListRecords)
+        return dent;
+
+    if (dir_handle->type == ZenodoRoot) {
+        gfal2_zenodo_cache_put(dir_handle->zenodo->stat_cache, dir_handle->zr.domain, id, NULL, st);
+        if (title)
+            gfal2_zenodo_index_put(dir_handle->zenodo->name_index, dir_handle->zr.domain, NULL,
+                    title + 1, id);
+    }
+    else {
+        gfal2_zenodo_cache_put(dir_handle->zenodo->stat_cache, dir_handle->zr.domain,
+                dir_handle->zr.deposition, id, st);
+        if (title)
+            gfal2_zenodo_index_put(dir_handle->zenodo->name_index, dir_handle->zr.domain,
+                    dir_handle->zr.deposition, title + 1, id);
     }
+
+    return dent;
 }
@@ -0,0 +1,152 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Validators of metadata responses
+
+#include <string.h>
+#include "gfal_zenodo_etag.h"
+
+#define ZENODO_ETAG_CACHE_MAX_ENTRIES_DEFAULT 10000
+
+
+struct ZenodoEtagEntry {
+    gchar* etag;
+    gchar* last_modified;
+    gpointer value;
+    gsize size;
+};
+typedef struct ZenodoEtagEntry ZenodoEtagEntry;
+
+
+struct ZenodoEtagCache {
+    GMutex lock;
+    GHashTable* entries;
+    guint max_entries;
+
+    guint64 not_modified;
+    guint64 modified;
+};
+
+
+static void gfal2_zenodo_etag_entry_free(gpointer data)
+{
+    ZenodoEtagEntry* entry = (ZenodoEtagEntry*)data;
+    g_free(entry->etag);
+    g_free(entry->last_modified);
+    g_free(entry->value);
+    g_free(entry);
+}
+
+
+ZenodoEtagCache* gfal2_zenodo_etag_new(gfal2_context_t context)
+{
+    ZenodoEtagCache* cache = g_malloc0(sizeof(*cache));
+    g_mutex_init(&cache->lock);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+            gfal2_zenodo_etag_entry_free);
+    cache->max_entries = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "ETAG_CACHE_MAX_ENTRIES", ZENODO_ETAG_CACHE_MAX_ENTRIES_DEFAULT);
+    return cache;
+}
+
+
+void gfal2_zenodo_etag_free(ZenodoEtagCache* cache)
+{
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo revalidations: %llu not modified, %llu modified",
+            (unsigned long long)cache->not_modified, (unsigned long long)cache->modified);
+    g_hash_table_destroy(cache->entries);
+    g_mutex_clear(&cache->lock);
+    g_free(cache);
+}
+
+
+struct curl_slist* gfal2_zenodo_etag_conditions(ZenodoEtagCache* cache, const char* url,
+        struct curl_slist* headers)
+{
+    char header[1024];
+
+    g_mutex_lock(&cache->lock);
+    ZenodoEtagEntry* entry = g_hash_table_lookup(cache->entries, url);
+    if (entry && entry->etag) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", entry->etag);
+        headers = curl_slist_append(headers, header);
+    }
+    // Only used by servers that ignore If-None-Match
+    if (entry && entry->last_modified) {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", entry->last_modified);
+        headers = curl_slist_append(headers, header);
+    }
+    g_mutex_unlock(&cache->lock);
+
+    return headers;
+}
+
+
+void gfal2_zenodo_etag_store(ZenodoEtagCache* cache, const char* url,
+        const ZenodoBuffer* response, gpointer value, gsize size)
+{
+    char etag[512], last_modified[128];
+    gboolean has_etag = gfal2_zenodo_buffer_header(response, "ETag", etag, sizeof(etag)) == 0;
+    gboolean has_last_modified = gfal2_zenodo_buffer_header(response, "Last-Modified",
+            last_modified, sizeof(last_modified)) == 0;
+
+    if (cache->max_entries == 0 || (!has_etag && !has_last_modified)) {
+        g_free(value);
+        return;
+    }
+
+    ZenodoEtagEntry* entry = g_malloc0(sizeof(*entry));
+    entry->etag = has_etag ? g_strdup(etag) : NULL;
+    entry->last_modified = has_last_modified ? g_strdup(last_modified) : NULL;
+    entry->value = value;
+    entry->size = size;
+
+    g_mutex_lock(&cache->lock);
+    ++cache->modified;
+    // Nothing expires here, so just start over when full
+    if (g_hash_table_size(cache->entries) >= cache->max_entries)
+        g_hash_table_remove_all(cache->entries);
+    g_hash_table_replace(cache->entries, g_strdup(url), entry);
+    g_mutex_unlock(&cache->lock);
+}
+
+
+gpointer gfal2_zenodo_etag_reuse(ZenodoEtagCache* cache, const char* url, gsize* size)
+{
+    gpointer value = NULL;
+
+    g_mutex_lock(&cache->lock);
+    ZenodoEtagEntry* entry = g_hash_table_lookup(cache->entries, url);
+    if (entry) {
+        ++cache->not_modified;
+        value = g_memdup(entry->value, entry->size);
+        *size = entry->size;
+    }
+    g_mutex_unlock(&cache->lock);
+
+    gfal_log(GFAL_VERBOSE_DEBUG, "Zenodo %s not modified%s", url, value ? "" : ", but forgotten");
+    return value;
+}
+
+
+void gfal2_zenodo_etag_counters(ZenodoEtagCache* cache, guint64* not_modified,
+        guint64* modified)
+{
+    g_mutex_lock(&cache->lock);
+    *not_modified = cache->not_modified;
+    *modified = cache->modified;
+    g_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,60 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_ETAG_H
+#define _GFAL_ZENODO_ETAG_H
+
+#include "gfal_zenodo.h"
+#include "gfal_zenodo_helpers.h"
+
+/*
+ * Validators (ETag and Last-Modified) of metadata responses, keyed by url,
+ * along with what was decoded from them
+ * Conditional requests send the validators back, and a 304 reuses the
+ * decoded value instead of downloading and parsing the response again
+ */
+typedef struct ZenodoEtagCache ZenodoEtagCache;
+
+ZenodoEtagCache* gfal2_zenodo_etag_new(gfal2_context_t context);
+void gfal2_zenodo_etag_free(ZenodoEtagCache* cache);
+
+/*
+ * Append If-None-Match and If-Modified-Since for url to headers, if known
+ */
+struct curl_slist* gfal2_zenodo_etag_conditions(ZenodoEtagCache* cache, const char* url,
+        struct curl_slist* headers);
+
+/*
+ * Remember the validators of response along with value, which must be
+ * allocated with g_malloc, and is owned by the cache from now on
+ * If the response has no validators, value is just freed
+ */
+void gfal2_zenodo_etag_store(ZenodoEtagCache* cache, const char* url,
+        const ZenodoBuffer* response, gpointer value, gsize size);
+
+/*
+ * Get a copy of the value stored for url, after the server answered 304
+ * Returns NULL if it is not there anymore
+ */
+gpointer gfal2_zenodo_etag_reuse(ZenodoEtagCache* cache, const char* url, gsize* size);
+
+/*
+ * Revalidation counters
+ */
+void gfal2_zenodo_etag_counters(ZenodoEtagCache* cache, guint64* not_modified,
+        guint64* modified);
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// On disk cache of file contents
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gfal_zenodo_filecache.h"
+#include "gfal_zenodo_helpers.h"
+
+
+struct ZenodoFileCache {
+    char* directory;
+    gint64 max_size;
+    gboolean verify;
+    // Serializes the evictions of this process
+    GMutex evict_lock;
+};
+
+
+struct ZenodoFileCacheEntry {
+    char* path;
+    off_t size;
+    time_t mtime;
+};
+typedef struct ZenodoFileCacheEntry ZenodoFileCacheEntry;
+
+
+ZenodoFileCache* gfal2_zenodo_filecache_new(gfal2_context_t context)
+{
+    gchar* directory = gfal2_get_opt_string(context, "ZENODO", "FILE_CACHE_DIR", NULL);
+    if (!directory || !directory[0]) {
+        g_free(directory);
+        return NULL;
+    }
+
+    if (g_mkdir_with_parents(directory, 0755) < 0) {
+        gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo can not create the file cache %s: %s",
+                directory, strerror(errno));
+        g_free(directory);
+        return NULL;
+    }
+
+    ZenodoFileCache* cache = g_new0(ZenodoFileCache, 1);
+    cache->directory = directory;
+    cache->max_size = gfal2_get_opt_integer_with_default(context, "ZENODO", "FILE_CACHE_MAX_SIZE_MB",
+            ZENODO_FILE_CACHE_MAX_SIZE_DEFAULT / (1024 * 1024)) * 1024LL * 1024LL;
+    cache->verify = gfal2_get_opt_boolean_with_default(context, "ZENODO", "FILE_CACHE_VERIFY", TRUE);
+    g_mutex_init(&cache->evict_lock);
+
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo file cache in %s, up to %lld MB",
+            directory, (long long)(cache->max_size / (1024 * 1024)));
+    return cache;
+}
+
+
+void gfal2_zenodo_filecache_free(ZenodoFileCache* cache)
+{
+    if (!cache)
+        return;
+    g_mutex_clear(&cache->evict_lock);
+    g_free(cache->directory);
+    g_free(cache);
+}
+
+
+// Only lowercase hex digests are accepted as keys, so they are safe as file names
+static gboolean gfal2_zenodo_filecache_valid_key(const char* md5)
+{
+    size_t i;
+    for (i = 0; md5[i]; ++i) {
+        if (!g_ascii_isxdigit(md5[i]))
+            return FALSE;
+    }
+    return i == 32;
+}
+
+
+static gboolean gfal2_zenodo_filecache_check_md5(const char* data, off_t size, const char* md5)
+{
+    char digest[64];
+    ZenodoChecksum checksum;
+    gfal2_zenodo_checksum_init(&checksum, "MD5", NULL);
+    gfal2_zenodo_checksum_update(&checksum, data, size);
+    gfal2_zenodo_checksum_final(&checksum, digest, sizeof(digest));
+    return g_ascii_strcasecmp(digest, md5) == 0;
+}
+
+
+// Map an entry, if it exists and is sound. Corrupt entries are removed
+static const char* gfal2_zenodo_filecache_open(ZenodoFileCache* cache, const char* path,
+        const char* md5, off_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    const char* data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size == size) {
+        data = mmap(NULL, size > 0 ? size : 1, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+    }
+    close(fd);
+
+    if (data && cache->verify && !gfal2_zenodo_filecache_check_md5(data, size, md5)) {
+        munmap((void*)data, size > 0 ? size : 1);
+        data = NULL;
+    }
+
+    if (!data) {
+        gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo file cache entry %s is corrupt, dropping it", path);
+        unlink(path);
+        return NULL;
+    }
+
+    // The modification time tracks the last use, for the eviction
+    utimensat(AT_FDCWD, path, NULL, 0);
+    return data;
+}
+
+
+static gint gfal2_zenodo_filecache_older(gconstpointer a, gconstpointer b)
+{
+    const ZenodoFileCacheEntry* ea = a;
+    const ZenodoFileCacheEntry* eb = b;
+    return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+
+// Drop the least recently used entries until the cache fits in its size
+static void gfal2_zenodo_filecache_evict(ZenodoFileCache* cache)
+{
+    GSList* entries = NULL;
+    gint64 total = 0;
+    const char* subdir_name;
+    const char* name;
+
+    g_mutex_lock(&cache->evict_lock);
+
+    GDir* dir = g_dir_open(cache->directory, 0, NULL);
+    while (dir && (subdir_name = g_dir_read_name(dir))) {
+        gchar* subdir_path = g_build_filename(cache->directory, subdir_name, NULL);
+        GDir* subdir = g_dir_open(subdir_path, 0, NULL);
+        while (subdir && (name = g_dir_read_name(subdir))) {
+            // Temporary files and locks have an extension
+            if (strchr(name, '.'))
+                continue;
+            gchar* path = g_build_filename(subdir_path, name, NULL);
+            struct stat st;
+            if (stat(path, &st) < 0) {
+                g_free(path);
+                continue;
+            }
+            ZenodoFileCacheEntry* entry = g_new(ZenodoFileCacheEntry, 1);
+            entry->path = path;
+            entry->size = st.st_size;
+            entry->mtime = st.st_mtime;
+            entries = g_slist_prepend(entries, entry);
+            total += st.st_size;
+        }
+        if (subdir)
+            g_dir_close(subdir);
+        g_free(subdir_path);
+    }
+    if (dir)
+        g_dir_close(dir);
+
+    if (total > cache->max_size) {
+        entries = g_slist_sort(entries, gfal2_zenodo_filecache_older);
+        GSList* i;
+        for (i = entries; i && total > cache->max_size; i = i->next) {
+            ZenodoFileCacheEntry* entry = i->data;
+            // Mapped copies stay readable after the unlink
+            if (unlink(entry->path) == 0) {
+                gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo file cache evicted %s", entry->path);
+                total -= entry->size;
+            }
+        }
+    }
+
+    GSList* i;
+    for (i = entries; i; i = i->next) {
+        ZenodoFileCacheEntry* entry = i->data;
+        g_free(entry->path);
+        g_free(entry);
+    }
+    g_slist_free(entries);
+
+    g_mutex_unlock(&cache->evict_lock);
+}
+
+
+// Download into a temporary file, check it, and move it into place
+static int gfal2_zenodo_filecache_fill(ZenodoFileCache* cache, ZenodoHandle* zenodo,
+        const char* path, const char* md5, off_t size, const char* domain, const char* url,
+        GError** error)
+{
+    GError* tmp_err = NULL;
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%u.tmp", path, (int)getpid(), g_random_int());
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        gfal2_set_error(error, zenodo_domain(), errno, __func__,
+                "Could not create %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    ssize_t ret = 0;
+    if (ftruncate(fd, size) < 0)
+        gfal2_set_error(&tmp_err, zenodo_domain(), errno, __func__,
+                "Could not allocate %s: %s", tmp_path, strerror(errno));
+    else if (size > 0)
+        ret = gfal2_zenodo_get_range_to_fd(zenodo, fd, size, 0, NULL, NULL, &tmp_err, domain,
+                url);
+
+    if (!tmp_err && ret != size)
+        gfal2_set_error(&tmp_err, zenodo_domain(), EIO, __func__,
+                "Short download: %zd out of %lld bytes", ret, (long long)size);
+
+    if (!tmp_err && size > 0) {
+        const char* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            gfal2_set_error(&tmp_err, zenodo_domain(), errno, __func__,
+                    "Could not map %s: %s", tmp_path, strerror(errno));
+        else if (!gfal2_zenodo_filecache_check_md5(data, size, md5))
+            gfal2_set_error(&tmp_err, zenodo_domain(), EIO, __func__,
+                    "The downloaded data does not match the checksum %s", md5);
+        if (data != MAP_FAILED)
+            munmap((void*)data, size);
+    }
+    close(fd);
+
+    if (!tmp_err && rename(tmp_path, path) < 0)
+        gfal2_set_error(&tmp_err, zenodo_domain(), errno, __func__,
+                "Could not move %s into place: %s", tmp_path, strerror(errno));
+
+    if (tmp_err) {
+        unlink(tmp_path);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo file cache filled %s", path);
+    return 0;
+}
+
+
+const char* gfal2_zenodo_filecache_map(ZenodoFileCache* cache, ZenodoHandle* zenodo,
+        const char* md5, off_t size, const char* domain, const char* url, GError** error)
+{
+    if (!gfal2_zenodo_filecache_valid_key(md5)) {
+        gfal2_set_error(error, zenodo_domain(), EINVAL, __func__, "Invalid checksum '%s'", md5);
+        return NULL;
+    }
+
+    if (size > cache->max_size) {
+        gfal2_set_error(error, zenodo_domain(), EFBIG, __func__,
+                "The file is bigger than the whole cache");
+        return NULL;
+    }
+
+    char key[33];
+    size_t i;
+    for (i = 0; i < 32; ++i)
+        key[i] = g_ascii_tolower(md5[i]);
+    key[32] = '\0';
+
+    char subdir[PATH_MAX], path[PATH_MAX], lock_path[PATH_MAX];
+    snprintf(subdir, sizeof(subdir), "%s/%.2s", cache->directory, key);
+    snprintf(path, sizeof(path), "%s/%s", subdir, key);
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+
+    const char* data = gfal2_zenodo_filecache_open(cache, path, key, size);
+    if (data) {
+        gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo file cache hit %s", path);
+        return data;
+    }
+
+    g_mkdir_with_parents(subdir, 0755);
+
+    // One filler per entry, other processes wait and then use its result
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) < 0) {
+        gfal2_set_error(error, zenodo_domain(), errno, __func__,
+                "Could not lock %s: %s", lock_path, strerror(errno));
+        if (lock_fd >= 0)
+            close(lock_fd);
+        return NULL;
+    }
+
+    data = gfal2_zenodo_filecache_open(cache, path, key, size);
+    if (!data && gfal2_zenodo_filecache_fill(cache, zenodo, path, key, size, domain, url, error) == 0)
+        data = gfal2_zenodo_filecache_open(cache, path, key, size);
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+
+    if (data)
+        gfal2_zenodo_filecache_evict(cache);
+    else if (error && !*error)
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__, "Could not cache %s", path);
+    return data;
+}
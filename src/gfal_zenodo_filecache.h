@@ -0,0 +1,47 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_FILECACHE_H
+#define _GFAL_ZENODO_FILECACHE_H
+
+#include "gfal_zenodo.h"
+
+/*
+ * On disk cache of file contents, keyed by their MD5
+ * Entries are filled in a temporary file and renamed into place, under an
+ * flock, so several processes can share the same directory. Entries are
+ * checked against their MD5 when filled and when opened, and the least
+ * recently used ones are evicted once the cache goes over its size
+ */
+#define ZENODO_FILE_CACHE_MAX_SIZE_DEFAULT (10LL * 1024 * 1024 * 1024)
+
+typedef struct ZenodoFileCache ZenodoFileCache;
+
+/*
+ * Returns NULL if FILE_CACHE_DIR is not configured
+ */
+ZenodoFileCache* gfal2_zenodo_filecache_new(gfal2_context_t context);
+void gfal2_zenodo_filecache_free(ZenodoFileCache* cache);
+
+/*
+ * Map the cached copy of the file with the given MD5 and size, downloading it
+ * from url first if needed. The mapping must be released with munmap
+ * Returns NULL with error set if the file could not be cached
+ */
+const char* gfal2_zenodo_filecache_map(ZenodoFileCache* cache, ZenodoHandle* zenodo,
+        const char* md5, off_t size, const char* domain, const char* url, GError** error);
+
+#endif
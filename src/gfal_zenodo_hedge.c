@@ -0,0 +1,116 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Hedged metadata requests
+
+#include "gfal_zenodo_hedge.h"
+
+// The budget does not pile up beyond this many duplicates
+#define ZENODO_HEDGE_MAX_TOKENS 10.0
+
+
+struct ZenodoHedge {
+    GMutex lock;
+    double quantile;
+    double budget;
+    gint64 min_delay;
+
+    double tokens;
+    guint64 sent;
+    guint64 won;
+};
+
+
+ZenodoHedge* gfal2_zenodo_hedge_new(gfal2_context_t context)
+{
+    if (!gfal2_get_opt_boolean_with_default(context, "ZENODO", "HEDGE", FALSE))
+        return NULL;
+
+    ZenodoHedge* hedge = g_new0(ZenodoHedge, 1);
+    g_mutex_init(&hedge->lock);
+    hedge->quantile = gfal2_get_opt_integer_with_default(context, "ZENODO", "HEDGE_QUANTILE",
+            ZENODO_HEDGE_QUANTILE_DEFAULT) / 100.0;
+    hedge->budget = gfal2_get_opt_integer_with_default(context, "ZENODO", "HEDGE_BUDGET",
+            ZENODO_HEDGE_BUDGET_DEFAULT) / 100.0;
+    hedge->min_delay = gfal2_get_opt_integer_with_default(context, "ZENODO", "HEDGE_MIN_DELAY",
+            ZENODO_HEDGE_MIN_DELAY_DEFAULT) * 1000;
+    hedge->quantile = CLAMP(hedge->quantile, 0.5, 0.999);
+    // Start with one, so the first stuck request can already be hedged
+    hedge->tokens = 1;
+
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo hedging metadata requests after p%g, budget %g%%",
+            hedge->quantile * 100, hedge->budget * 100);
+    return hedge;
+}
+
+
+void gfal2_zenodo_hedge_free(ZenodoHedge* hedge)
+{
+    if (!hedge)
+        return;
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo hedged requests: %llu sent, %llu won",
+            (unsigned long long)hedge->sent, (unsigned long long)hedge->won);
+    g_mutex_clear(&hedge->lock);
+    g_free(hedge);
+}
+
+
+gint64 gfal2_zenodo_hedge_delay(ZenodoHedge* hedge, ZenodoStats* stats)
+{
+    g_mutex_lock(&hedge->lock);
+    hedge->tokens = MIN(hedge->tokens + hedge->budget, ZENODO_HEDGE_MAX_TOKENS);
+    g_mutex_unlock(&hedge->lock);
+
+    gint64 threshold = gfal2_zenodo_stats_quantile(stats, gfal2_zenodo_stats_operation(),
+            ZenodoPhaseTotal, hedge->quantile);
+    if (threshold <= 0)
+        return -1;
+    return MAX(threshold, hedge->min_delay);
+}
+
+
+gboolean gfal2_zenodo_hedge_take(ZenodoHedge* hedge)
+{
+    gboolean ok = FALSE;
+    g_mutex_lock(&hedge->lock);
+    if (hedge->tokens >= 1) {
+        hedge->tokens -= 1;
+        ++hedge->sent;
+        ok = TRUE;
+    }
+    g_mutex_unlock(&hedge->lock);
+    return ok;
+}
+
+
+void gfal2_zenodo_hedge_won(ZenodoHedge* hedge)
+{
+    g_mutex_lock(&hedge->lock);
+    ++hedge->won;
+    g_mutex_unlock(&hedge->lock);
+}
+
+
+void gfal2_zenodo_hedge_counters(ZenodoHedge* hedge, guint64* sent, guint64* won)
+{
+    *sent = *won = 0;
+    if (!hedge)
+        return;
+    g_mutex_lock(&hedge->lock);
+    *sent = hedge->sent;
+    *won = hedge->won;
+    g_mutex_unlock(&hedge->lock);
+}
@@ -0,0 +1,62 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_HEDGE_H
+#define _GFAL_ZENODO_HEDGE_H
+
+#include "gfal_zenodo.h"
+#include "gfal_zenodo_stats.h"
+
+/*
+ * Hedged metadata requests
+ * A GET or HEAD that has not answered after the HEDGE_QUANTILE of the
+ * latencies recorded for its operation gets a duplicate on another
+ * connection, and the first one to answer wins
+ * Duplicates are paid from a budget that grows by HEDGE_BUDGET percent of
+ * a request with each eligible request
+ */
+#define ZENODO_HEDGE_QUANTILE_DEFAULT 95
+#define ZENODO_HEDGE_BUDGET_DEFAULT 5
+#define ZENODO_HEDGE_MIN_DELAY_DEFAULT 20
+
+typedef struct ZenodoHedge ZenodoHedge;
+
+/*
+ * Returns NULL unless HEDGE is enabled
+ */
+ZenodoHedge* gfal2_zenodo_hedge_new(gfal2_context_t context);
+void gfal2_zenodo_hedge_free(ZenodoHedge* hedge);
+
+/*
+ * How long to wait for a request of the current operation before hedging it,
+ * in microseconds, or -1 if there is not enough history yet
+ * Called once per eligible request, which also adds to the budget
+ */
+gint64 gfal2_zenodo_hedge_delay(ZenodoHedge* hedge, ZenodoStats* stats);
+
+/*
+ * Take a duplicate from the budget. FALSE if it is spent
+ */
+gboolean gfal2_zenodo_hedge_take(ZenodoHedge* hedge);
+
+/*
+ * A duplicate answered first
+ */
+void gfal2_zenodo_hedge_won(ZenodoHedge* hedge);
+
+void gfal2_zenodo_hedge_counters(ZenodoHedge* hedge, guint64* sent, guint64* won);
+
+#endif
@@ -1,10 +1,64 @@
 #include <gfal_api.h>
 #include <json.h>
 #include <string.h>
+#include <unistd.h>
 #include <utils/gfal_uri.h>
+#include "gfal_zenodo_etag.h"
+#include "gfal_zenodo_hedge.h"
 #include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_stats.h"
 
 
+static gboolean gfal2_zenodo_is_deposition_id(const char* str)
+{
+    for (; *str; ++str)
+        if (!g_ascii_isdigit(*str))
+            return FALSE;
+    return TRUE;
+}
+
+
+static gboolean gfal2_zenodo_is_file_id(const char* str)
+{
+    int i;
+    for (i = 0; i < 36; ++i) {
+        gboolean dash = (i == 8 || i == 13 || i == 18 || i == 23);
+        if (dash ? str[i] != '-' : !g_ascii_isxdigit(str[i]))
+            return FALSE;
+    }
+    return str[36] == '\0';
+}
+
+
+// Split id:name, or move a lone name out of the id
+// Names may have colons of their own, so only a valid id, or nothing, before
+// the first one makes it a separator. An empty id leaves a lone name, which
+// is the way to give a name that looks like an id
+static void gfal2_zenodo_split_segment(char* segment, char* name, size_t namesize,
+        gboolean (*is_id)(const char*))
+{
+    char* raw = NULL;
+    char* colon = strchr(segment, ':');
+    if (colon) {
+        *colon = '\0';
+        if (segment[0] && !is_id(segment))
+            *colon = ':';
+        else
+            raw = colon + 1;
+    }
+    if (!raw && segment[0] && !is_id(segment))
+        raw = segment;
+
+    name[0] = '\0';
+    if (raw) {
+        char* unescaped = g_uri_unescape_string(raw, NULL);
+        g_strlcpy(name, unescaped ? unescaped : raw, namesize);
+        g_free(unescaped);
+    }
+    if (raw == segment)
+        segment[0] = '\0';
+}
+
 
 int gfal2_zenodo_resource_from_uri(ZenodoResource* zr, const char* uri, GError** error)
 {
@@ -16,7 +70,11 @@ int gfal2_zenodo_resource_from_uri(ZenodoResource* zr, const char* uri, GError**
 		return -1;
 	}
 
-	g_strlcpy(zr->domain, parsed.domain, sizeof(zr->domain));
+	// Keep an explicit port, i.e. for a local test server
+	if (parsed.port)
+		snprintf(zr->domain, sizeof(zr->domain), "%s:%u", parsed.domain, parsed.port);
+	else
+		g_strlcpy(zr->domain, parsed.domain, sizeof(zr->domain));
 	char *p = parsed.path;
 	while (*p == '/')
 		++p;
@@ -35,27 +93,82 @@ int gfal2_zenodo_resource_from_uri(ZenodoResource* zr, const char* uri, GError**
 	g_strlcpy(zr->deposition, p, sizeof(zr->deposition));
 
 	// Since we use colon to separate the id from the readable title, split on it
-	p = strchr(zr->deposition, ':');
-	if (p)
-	    *p = '\0';
-	p = strchr(zr->file, ':');
-	if (p)
-	    *p = '\0';
-
-	if (zr->file[0])
+	gfal2_zenodo_split_segment(zr->deposition, zr->deposition_name, sizeof(zr->deposition_name),
+	        gfal2_zenodo_is_deposition_id);
+	gfal2_zenodo_split_segment(zr->file, zr->file_name, sizeof(zr->file_name),
+	        gfal2_zenodo_is_file_id);
+
+	if (zr->file[0] || zr->file_name[0])
 		zr->type = ZenodoFile;
-	else if (zr->deposition[0])
+	else if (zr->deposition[0] || zr->deposition_name[0])
 		zr->type = ZenodoDeposition;
 	else
 		zr->type = ZenodoRoot;
 
-	gfal_log(GFAL_VERBOSE_DEBUG, "Zenodo resource %d [host: %s; deposition: %s; file: %s] %d",
-			zr->type, zr->domain, zr->deposition, zr->file);
+	gfal_log(GFAL_VERBOSE_DEBUG, "Zenodo resource %d [host: %s; deposition: %s (%s); file: %s (%s)]",
+			zr->type, zr->domain, zr->deposition, zr->deposition_name, zr->file, zr->file_name);
 
 	return 0;
 }
 
 
+int gfal2_zenodo_checksum_init(ZenodoChecksum* chk, const char* type, GError** error)
+{
+    memset(chk, 0, sizeof(*chk));
+    if (g_ascii_strcasecmp(type, "ADLER32") == 0)
+        chk->adler32 = 1;
+    else if (g_ascii_strcasecmp(type, "MD5") == 0)
+        chk->gchecksum = g_checksum_new(G_CHECKSUM_MD5);
+    else if (g_ascii_strcasecmp(type, "SHA1") == 0)
+        chk->gchecksum = g_checksum_new(G_CHECKSUM_SHA1);
+    else if (g_ascii_strcasecmp(type, "SHA256") == 0)
+        chk->gchecksum = g_checksum_new(G_CHECKSUM_SHA256);
+    else {
+        gfal2_set_error(error, zenodo_domain(), ENOTSUP, __func__,
+                "Checksum type %s not supported", type);
+        return -1;
+    }
+    return 0;
+}
+
+
+void gfal2_zenodo_checksum_update(ZenodoChecksum* chk, const void* data, size_t len)
+{
+    if (chk->gchecksum) {
+        g_checksum_update(chk->gchecksum, data, len);
+        return;
+    }
+
+    // Adler-32, deferring the modulo as much as possible
+    const unsigned char* p = data;
+    guint32 a = chk->adler32 & 0xFFFF, b = chk->adler32 >> 16;
+    while (len > 0) {
+        size_t block = MIN(len, 5552);
+        len -= block;
+        while (block--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    chk->adler32 = (b << 16) | a;
+}
+
+
+void gfal2_zenodo_checksum_final(ZenodoChecksum* chk, char* out, size_t outsize)
+{
+    if (chk->gchecksum) {
+        g_strlcpy(out, g_checksum_get_string(chk->gchecksum), outsize);
+        g_checksum_free(chk->gchecksum);
+        chk->gchecksum = NULL;
+    }
+    else {
+        snprintf(out, outsize, "%08x", chk->adler32);
+    }
+}
+
+
 static int gfal2_zenodo_map_http_status(long response, GError** error, const char* func)
 {
     if (response < 400)
@@ -88,156 +201,596 @@ static void gfal2_zenodo_build_full_url(ZenodoHandle* handle, char* full,
 }
 
 
-static void gfal2_zenodo_append_access_token(ZenodoHandle* handle, const char* uri,
-		char* out, size_t outsize)
+static int gfal2_zenodo_refresh_token(ZenodoHandle* handle, const char* domain,
+        gint64 since, GError** error);
+
+
+// Load the token from the configuration the first time it is needed
+static void gfal2_zenodo_load_token(ZenodoHandle* handle)
 {
-	const gchar* access_token = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "ACCESS_TOKEN", NULL);
-	if (access_token) {
-		if (strchr(uri, '?'))
-			snprintf(out, outsize, "%s&access_token=%s", uri, access_token);
-		else
-			snprintf(out, outsize, "%s?access_token=%s", uri, access_token);
-	}
+    if (handle->token_loaded)
+        return;
+
+    handle->access_token = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "ACCESS_TOKEN", NULL);
+    gchar* refresh_token = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "REFRESH_TOKEN", NULL);
+    handle->token_refreshable = (refresh_token != NULL && refresh_token[0] != '\0');
+    g_free(refresh_token);
+    handle->token_margin = gfal2_get_opt_integer_with_default(handle->gfal2_context, "ZENODO",
+            "TOKEN_REFRESH_MARGIN", ZENODO_TOKEN_REFRESH_MARGIN_DEFAULT) * G_USEC_PER_SEC;
+    handle->token_loaded = TRUE;
 }
 
 
-static ssize_t gfal2_zenodo_nobody_internal(ZenodoHandle* handle, const char* method,
-        char* buffer, size_t bufsize, const char *uri, GError** error)
+// Returns the Authorization header appended to headers. If the token is about to
+// expire, it is refreshed first, so requests do not need to fail with 401
+static struct curl_slist* gfal2_zenodo_auth_header(ZenodoHandle* handle, const char* domain,
+        struct curl_slist* headers)
 {
-	g_assert(handle != NULL && uri != NULL && buffer != NULL && error != NULL);
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&handle->token_lock);
+    gfal2_zenodo_load_token(handle);
+    gboolean expiring = handle->token_refreshable && handle->token_expires > 0 &&
+            now >= handle->token_expires - handle->token_margin;
+    g_mutex_unlock(&handle->token_lock);
+
+    if (expiring && domain) {
+        GError* tmp_err = NULL;
+        if (gfal2_zenodo_refresh_token(handle, domain, now, &tmp_err) < 0) {
+            gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo could not refresh the token: %s", tmp_err->message);
+            g_error_free(tmp_err);
+        }
+    }
 
-	char uri_with_token[1024];
-	gfal2_zenodo_append_access_token(handle, uri, uri_with_token, sizeof(uri_with_token));
+    g_mutex_lock(&handle->token_lock);
+    if (handle->access_token) {
+        char header[1024];
+        snprintf(header, sizeof(header), "Authorization: Bearer %s", handle->access_token);
+        headers = curl_slist_append(headers, header);
+    }
+    g_mutex_unlock(&handle->token_lock);
+    return headers;
+}
 
-	// Perform
-	curl_easy_setopt(handle->curl_handle, CURLOPT_FOLLOWLOCATION, 1);
 
-	char err_buffer[CURL_ERROR_SIZE];
-    curl_easy_setopt(handle->curl_handle, CURLOPT_ERRORBUFFER, err_buffer);
+ZenodoBuffer* gfal2_zenodo_buffer_acquire(ZenodoHandle* handle)
+{
+    ZenodoBuffer* buffer = NULL;
 
-    FILE* fd = fmemopen(buffer, bufsize, "wb");
-    curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEDATA, fd);
-    curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEFUNCTION, fwrite);
+    g_mutex_lock(&handle->buffer_lock);
+    if (handle->buffer_pool) {
+        buffer = handle->buffer_pool->data;
+        handle->buffer_pool = g_slist_delete_link(handle->buffer_pool, handle->buffer_pool);
+    }
+    g_mutex_unlock(&handle->buffer_lock);
+
+    if (!buffer) {
+        buffer = g_malloc0(sizeof(*buffer));
+        buffer->capacity = ZENODO_BUFFER_INITIAL_SIZE;
+        buffer->data = g_malloc(buffer->capacity);
+        buffer->headers_capacity = ZENODO_BUFFER_HEADERS_INITIAL_SIZE;
+        buffer->headers = g_malloc(buffer->headers_capacity);
+    }
+    gfal2_zenodo_buffer_reset(buffer);
+    return buffer;
+}
 
-    curl_easy_setopt(handle->curl_handle, CURLOPT_URL, uri_with_token);
+
+void gfal2_zenodo_buffer_reset(ZenodoBuffer* buffer)
+{
+    buffer->size = 0;
+    buffer->data[0] = '\0';
+    buffer->response = 0;
+    buffer->headers_size = 0;
+    buffer->headers[0] = '\0';
+}
+
+
+void gfal2_zenodo_buffer_release(ZenodoHandle* handle, ZenodoBuffer* buffer)
+{
+    if (!buffer)
+        return;
+
+    // Do not hold on to buffers grown by exceptionally big responses
+    if (buffer->capacity > ZENODO_BUFFER_MAX_POOLED_SIZE) {
+        gfal2_zenodo_buffer_free(buffer);
+        return;
+    }
+
+    g_mutex_lock(&handle->buffer_lock);
+    handle->buffer_pool = g_slist_prepend(handle->buffer_pool, buffer);
+    g_mutex_unlock(&handle->buffer_lock);
+}
+
+
+void gfal2_zenodo_buffer_free(ZenodoBuffer* buffer)
+{
+    g_free(buffer->data);
+    g_free(buffer->headers);
+    g_free(buffer);
+}
+
+
+// Append to a growable memory area, always keeping it NULL terminated
+static void gfal2_zenodo_append(char** data, size_t* size, size_t* capacity,
+        const char* ptr, size_t len)
+{
+    if (*size + len + 1 > *capacity) {
+        size_t new_capacity = *capacity;
+        while (*size + len + 1 > new_capacity)
+            new_capacity *= 2;
+        *data = g_realloc(*data, new_capacity);
+        *capacity = new_capacity;
+    }
+
+    memcpy(*data + *size, ptr, len);
+    *size += len;
+    (*data)[*size] = '\0';
+}
+
+
+// Write callback that appends into a growable buffer
+static size_t gfal2_zenodo_write_buffer(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    ZenodoBuffer* buffer = (ZenodoBuffer*)userdata;
+    size_t len = size * nmemb;
+    gfal2_zenodo_append(&buffer->data, &buffer->size, &buffer->capacity, ptr, len);
+    return len;
+}
+
+
+// Header callback that keeps the headers of the last response
+static size_t gfal2_zenodo_write_header(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    ZenodoBuffer* buffer = (ZenodoBuffer*)userdata;
+    size_t len = size * nmemb;
+    // A status line starts a new response (i.e. after a redirection)
+    if (len > 5 && strncmp(ptr, "HTTP/", 5) == 0)
+        buffer->headers_size = 0;
+    gfal2_zenodo_append(&buffer->headers, &buffer->headers_size, &buffer->headers_capacity, ptr, len);
+    return len;
+}
+
+
+int gfal2_zenodo_buffer_header(const ZenodoBuffer* buffer, const char* name,
+        char* value, size_t valuesize)
+{
+    size_t namelen = strlen(name);
+    const char* line = buffer->headers;
+
+    while (line && *line) {
+        const char* eol = strchr(line, '\n');
+        if (g_ascii_strncasecmp(line, name, namelen) == 0 && line[namelen] == ':') {
+            const char* p = line + namelen + 1;
+            while (*p == ' ' || *p == '\t')
+                ++p;
+            size_t len = eol ? (size_t)(eol - p) : strlen(p);
+            while (len > 0 && (p[len - 1] == '\r' || p[len - 1] == ' '))
+                --len;
+            if (len >= valuesize)
+                len = valuesize - 1;
+            memcpy(value, p, len);
+            value[len] = '\0';
+            return 0;
+        }
+        line = eol ? eol + 1 : NULL;
+    }
+    return -1;
+}
+
+
+// Everything a metadata request needs, so a duplicate can be set up the same way
+static void gfal2_zenodo_nobody_setup(CURL* curl, const char* method, ZenodoBuffer* buffer,
+        const char* uri, struct curl_slist* headers, char* err_buffer)
+{
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, err_buffer);
+
+    gfal2_zenodo_buffer_reset(buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, gfal2_zenodo_write_buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, gfal2_zenodo_write_header);
+
+    curl_easy_setopt(curl, CURLOPT_URL, uri);
+    // Metadata is JSON, which compresses well
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 
     if (strncmp(method, "GET", 3) == 0) {
-        curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET, 1);
-        curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY, 0);
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
     }
     else if (strncmp(method, "HEAD", 4) == 0) {
-        curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET, 1);
-        curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY, 1);
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
     }
     else {
-        curl_easy_setopt(handle->curl_handle, CURLOPT_CUSTOMREQUEST, method);
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
     }
+}
+
+
+// Run the request, and if it is slower than usual for its operation, send
+// a duplicate on another connection. The first to answer wins, the other is
+// cancelled. On return, *curl is the winner, with its response in buffer, and
+// *late how long the request had been waiting when the winner was started
+static CURLcode gfal2_zenodo_hedged_perform(ZenodoHandle* handle, CURL** curl,
+        const char* method, ZenodoBuffer* buffer, const char* uri,
+        struct curl_slist* headers, char* err_buffer, gint64* late)
+{
+    *late = 0;
+    gint64 delay = gfal2_zenodo_hedge_delay(handle->hedge, handle->stats);
+    if (delay < 0)
+        return curl_easy_perform(*curl);
+
+    CURLM* multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, handle->max_connections);
+    // The point is to avoid whatever is slowing down the first one, so the
+    // duplicate must not become another stream of the same connection
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_NOTHING);
+    curl_multi_add_handle(multi, *curl);
+
+    gint64 started = g_get_monotonic_time();
+    gint64 deadline = started + delay;
+    gint64 hedge_started = 0;
+    CURL* hedge = NULL;
+    ZenodoBuffer* hedge_buffer = NULL;
+    char hedge_err_buffer[CURL_ERROR_SIZE] = {0};
+
+    CURL* winner = NULL;
+    CURLcode result = CURLE_OK;
+    int active = 1, running = 0;
+
+    while (winner == NULL) {
+        curl_multi_perform(multi, &running);
+
+        CURLMsg* msg;
+        int pending;
+        while (winner == NULL && (msg = curl_multi_info_read(multi, &pending))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            CURL* easy = msg->easy_handle;
+            CURLcode easy_result = msg->data.result;
+            curl_multi_remove_handle(multi, easy);
+            --active;
+            // A failure only counts if the other one can not do better
+            if (easy_result == CURLE_OK || active == 0) {
+                winner = easy;
+                result = easy_result;
+            }
+        }
+        if (winner != NULL)
+            break;
+
+        gint64 now = g_get_monotonic_time();
+        if (hedge == NULL && now >= deadline) {
+            // Whatever happens, do not look at the clock again
+            deadline = G_MAXINT64;
+            if (gfal2_zenodo_hedge_take(handle->hedge)) {
+                gfal_log(GFAL_VERBOSE_DEBUG, "Hedging %s %s after %lld ms", method, uri,
+                        (long long)(delay / 1000));
+                hedge = gfal2_zenodo_curl_acquire(handle);
+                hedge_buffer = gfal2_zenodo_buffer_acquire(handle);
+                gfal2_zenodo_nobody_setup(hedge, method, hedge_buffer, uri, headers,
+                        hedge_err_buffer);
+                // The duplicate is a request like any other for the server
+                gfal2_zenodo_rate_acquire(handle->rate_limiter);
+                hedge_started = g_get_monotonic_time();
+                curl_multi_add_handle(multi, hedge);
+                ++active;
+                continue;
+            }
+        }
+
+        int timeout = 1000;
+        if (hedge == NULL && deadline != G_MAXINT64)
+            timeout = (int)CLAMP((deadline - now) / 1000, 1, 1000);
+        curl_multi_wait(multi, NULL, 0, timeout, NULL);
+    }
+
+    if (hedge != NULL) {
+        CURL* loser = (winner == hedge) ? *curl : hedge;
+        // Removing a handle still in flight aborts its transfer
+        curl_multi_remove_handle(multi, loser);
+        if (winner == hedge) {
+            gfal2_zenodo_hedge_won(handle->hedge);
+            // Otherwise the hedge delay would be learnt from latencies that
+            // leave it out, and shrink with every win
+            *late = hedge_started - started;
+            ZenodoBuffer tmp = *buffer;
+            *buffer = *hedge_buffer;
+            *hedge_buffer = tmp;
+            memcpy(err_buffer, hedge_err_buffer, CURL_ERROR_SIZE);
+            *curl = hedge;
+        }
+        gfal2_zenodo_curl_release(handle, loser);
+        gfal2_zenodo_buffer_release(handle, hedge_buffer);
+    }
+
+    curl_multi_cleanup(multi);
+    return result;
+}
+
+
+static ssize_t gfal2_zenodo_nobody_internal(ZenodoHandle* handle, const char* method,
+        ZenodoBuffer* buffer, const char* domain, const char *uri, gboolean conditional,
+        ZenodoRetry* retry, GError** error)
+{
+	g_assert(handle != NULL && uri != NULL && buffer != NULL && error != NULL);
+
+	struct curl_slist* headers = gfal2_zenodo_auth_header(handle, domain, NULL);
+	if (conditional)
+		headers = gfal2_zenodo_etag_conditions(handle->etag_cache, uri, headers);
+
+	// Perform
+	CURL* curl = gfal2_zenodo_curl_acquire(handle);
+	char err_buffer[CURL_ERROR_SIZE] = {0};
+	gfal2_zenodo_nobody_setup(curl, method, buffer, uri, headers, err_buffer);
 
     gfal_log(GFAL_VERBOSE_VERBOSE, "%s %s", method, uri);
 
-	int perform_result = curl_easy_perform(handle->curl_handle);
+    gfal2_zenodo_rate_acquire(handle->rate_limiter);
+	int perform_result;
+	gint64 late = 0;
+	// Only reads are safe to send twice
+	if (handle->hedge && (strncmp(method, "GET", 3) == 0 || strncmp(method, "HEAD", 4) == 0))
+		perform_result = gfal2_zenodo_hedged_perform(handle, &curl, method, buffer, uri,
+		        headers, err_buffer, &late);
+	else
+		perform_result = curl_easy_perform(curl);
 
-	fclose(fd);
+    long response = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response);
+    buffer->response = response;
+    gfal2_zenodo_stats_request(handle->stats, curl, perform_result, response,
+            retry->attempts > 0 || retry->token_refreshed, late);
+    gfal2_zenodo_curl_release(handle, curl);
+    curl_slist_free_all(headers);
+    gfal2_zenodo_retry_attempt(handle->rate_limiter, retry, response, perform_result, buffer);
 
 	if (perform_result != 0) {
 		gfal2_set_error(error, zenodo_domain(), EIO, __func__, "%s", err_buffer);
 		return -1;
 	}
 
-    long response;
-    curl_easy_getinfo(handle->curl_handle, CURLINFO_RESPONSE_CODE, &response);
-
     if (gfal2_zenodo_map_http_status(response, error, __func__) < 0)
         return -1;
 
-    double total_size;
-    curl_easy_getinfo(handle->curl_handle, CURLINFO_SIZE_DOWNLOAD, &total_size);
-    return (ssize_t)(total_size);
+    return (ssize_t)(buffer->size);
 }
 
 
-static ssize_t gfal2_zenodo_post_internal(ZenodoHandle* handle, char* buffer, size_t bufsize,
-		const char* body, size_t bodysize, const char *uri, int notoken, GError** error)
+static ssize_t gfal2_zenodo_post_internal(ZenodoHandle* handle, ZenodoBuffer* buffer,
+		const char* body, size_t bodysize, const char* domain, const char *uri, int notoken,
+		ZenodoRetry* retry, GError** error)
 {
 	g_assert(handle != NULL && uri != NULL && buffer != NULL && error != NULL);
 
-	char uri_with_token[1024];
-	if (notoken)
-		g_strlcpy(uri_with_token, uri, sizeof(uri_with_token));
-	else
-		gfal2_zenodo_append_access_token(handle, uri, uri_with_token, sizeof(uri_with_token));
+	struct curl_slist* headers = NULL;
+	if (!notoken)
+		headers = gfal2_zenodo_auth_header(handle, domain, headers);
+	// The API takes JSON documents, /oauth/token a form
+	if (bodysize > 0 && body[0] == '{')
+		headers = curl_slist_append(headers, "Content-Type: application/json");
 
 	// Perform
-	curl_easy_setopt(handle->curl_handle, CURLOPT_FOLLOWLOCATION, 1);
+	CURL* curl = gfal2_zenodo_curl_acquire(handle);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
 	char err_buffer[CURL_ERROR_SIZE];
-    curl_easy_setopt(handle->curl_handle, CURLOPT_ERRORBUFFER, err_buffer);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, err_buffer);
 
-    curl_easy_setopt(handle->curl_handle, CURLOPT_POSTFIELDS, body);
-    curl_easy_setopt(handle->curl_handle, CURLOPT_POSTFIELDSIZE, bodysize);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, bodysize);
 
-    FILE* fd = fmemopen(buffer, bufsize, "wb");
-    curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEDATA, fd);
-    curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEFUNCTION, fwrite);
+    gfal2_zenodo_buffer_reset(buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, gfal2_zenodo_write_buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, gfal2_zenodo_write_header);
 
-    curl_easy_setopt(handle->curl_handle, CURLOPT_URL, uri_with_token);
+    curl_easy_setopt(curl, CURLOPT_URL, uri);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 
-    curl_easy_setopt(handle->curl_handle, CURLOPT_POST, 1);
+    curl_easy_setopt(curl, CURLOPT_POST, 1);
 
     gfal_log(GFAL_VERBOSE_VERBOSE, "POST %s", uri);
-	int perform_result = curl_easy_perform(handle->curl_handle);
-
-	fclose(fd);
+    gfal2_zenodo_rate_acquire(handle->rate_limiter);
+	int perform_result = curl_easy_perform(curl);
+
+    long response = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response);
+    buffer->response = response;
+    gfal2_zenodo_stats_request(handle->stats, curl, perform_result, response,
+            retry->attempts > 0 || retry->token_refreshed, 0);
+    gfal2_zenodo_curl_release(handle, curl);
+    curl_slist_free_all(headers);
+    gfal2_zenodo_retry_attempt(handle->rate_limiter, retry, response, perform_result, buffer);
 
 	if (perform_result != 0) {
 		gfal2_set_error(error, zenodo_domain(), EIO, __func__, "%s", err_buffer);
 		return -1;
 	}
 
-    long response;
-    curl_easy_getinfo(handle->curl_handle, CURLINFO_RESPONSE_CODE, &response);
+    if (gfal2_zenodo_map_http_status(response, error, __func__) < 0)
+        return -1;
+
+    return (ssize_t)(buffer->size);
+}
+
+
+// Write callback that copies into a fixed size memory window
+struct ZenodoMemoryWindow {
+    char* buffer;
+    size_t size;
+    size_t used;
+    // Set while resuming, when only the rest of the range can be taken
+    CURL* resumed;
+};
+
+
+static size_t gfal2_zenodo_write_window(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    struct ZenodoMemoryWindow* window = (struct ZenodoMemoryWindow*)userdata;
+    size_t len = size * nmemb;
+
+    // The object changed, so the new body does not follow what is there
+    if (window->resumed) {
+        long response = 0;
+        curl_easy_getinfo(window->resumed, CURLINFO_RESPONSE_CODE, &response);
+        if (response != 206)
+            return 0;
+    }
+
+    size_t room = window->size - window->used;
+    if (len > room)
+        len = room;
+    memcpy(window->buffer + window->used, ptr, len);
+    window->used += len;
+    // Returning less than requested aborts the transfer once the window is full
+    return len;
+}
+
+
+// Validator of a ranged response, for If-Range. Weak ETags can not be used there
+static void gfal2_zenodo_range_validator(const ZenodoBuffer* response, char* validator,
+        size_t validatorsize)
+{
+    if (gfal2_zenodo_buffer_header(response, "ETag", validator, validatorsize) == 0 &&
+        strncmp(validator, "W/", 2) != 0)
+        return;
+    if (gfal2_zenodo_buffer_header(response, "Last-Modified", validator, validatorsize) == 0)
+        return;
+    validator[0] = '\0';
+}
+
+
+// Get the part of the range that is not in the window yet
+static ssize_t gfal2_zenodo_get_range_internal(ZenodoHandle* handle,
+        struct ZenodoMemoryWindow* window, off_t offset, char* validator, size_t validatorsize,
+        const char* domain, const char* url, ZenodoRetry* retry, GError** error)
+{
+    g_assert(handle != NULL && url != NULL && window != NULL && error != NULL);
+
+    struct curl_slist* headers = gfal2_zenodo_auth_header(handle, domain, NULL);
+
+    CURL* curl = gfal2_zenodo_curl_acquire(handle);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+
+    char err_buffer[CURL_ERROR_SIZE];
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, err_buffer);
+
+    // Continue after what was received, as long as the object is the same
+    window->resumed = NULL;
+    if (window->used > 0) {
+        char if_range[1024];
+        snprintf(if_range, sizeof(if_range), "If-Range: %s", validator);
+        headers = curl_slist_append(headers, if_range);
+        window->resumed = curl;
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, window);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, gfal2_zenodo_write_window);
+
+    // Only the headers are kept, for the rate limiting and the validator
+    ZenodoBuffer* response_headers = gfal2_zenodo_buffer_acquire(handle);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, response_headers);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, gfal2_zenodo_write_header);
+
+    char range[128];
+    snprintf(range, sizeof(range), "%lld-%lld",
+            (long long)(offset + window->used), (long long)(offset + window->size - 1));
+    curl_easy_setopt(curl, CURLOPT_RANGE, range);
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+
+    gfal_log(GFAL_VERBOSE_VERBOSE, "GET %s (range %s)", url, range);
+
+    gfal2_zenodo_rate_acquire(handle->rate_limiter);
+    int perform_result = curl_easy_perform(curl);
+
+    long response = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response);
+    gfal2_zenodo_stats_request(handle->stats, curl, perform_result, response,
+            retry->attempts > 0 || retry->token_refreshed || retry->resumes > 0, 0);
+    gfal2_zenodo_curl_release(handle, curl);
+    curl_slist_free_all(headers);
+    gfal2_zenodo_retry_attempt(handle->rate_limiter, retry, response, perform_result, response_headers);
+    if (response == 206 && !window->resumed)
+        gfal2_zenodo_range_validator(response_headers, validator, validatorsize);
+    gfal2_zenodo_buffer_release(handle, response_headers);
+
+    if (window->resumed && response == 200) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                "%s changed on the server while being downloaded", url);
+        return -1;
+    }
+
+    // A full window aborts the transfer with a write error, which is fine
+    if (perform_result != 0 && !(perform_result == CURLE_WRITE_ERROR && window->used == window->size)) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__, "%s", err_buffer);
+        return -1;
+    }
 
     if (gfal2_zenodo_map_http_status(response, error, __func__) < 0)
         return -1;
 
-    double total_size;
-    curl_easy_getinfo(handle->curl_handle, CURLINFO_SIZE_DOWNLOAD, &total_size);
-    return (ssize_t)(total_size);
+    // If the server ignored the range, the data only matches when starting at 0
+    if (response != 206 && offset != 0) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                "The server does not support ranged reads (HTTP %ld)", response);
+        return -1;
+    }
+
+    return (ssize_t)(window->used);
 }
 
 
-static int gfal2_zenodo_refresh_token(ZenodoHandle* handle, const char* domain,
-		char* buffer, size_t bufsize, GError** error)
+// Ask /oauth/token for a new access token
+static int gfal2_zenodo_request_token(ZenodoHandle* handle, const char* domain,
+		gchar** access_token, gint64* expires_in, GError** error)
 {
-	const gchar* client_id = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "APP_KEY", NULL);
-	const gchar* client_secret = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "APP_SECRET", NULL);
-	const gchar* refresh_token = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "REFRESH_TOKEN", NULL);
+	gchar* client_id = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "APP_KEY", NULL);
+	gchar* client_secret = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "APP_SECRET", NULL);
+	gchar* refresh_token = gfal2_get_opt_string(handle->gfal2_context, "ZENODO", "REFRESH_TOKEN", NULL);
 
 	char body[1024];
 	size_t bodysize = snprintf(body, sizeof(body),
 			"client_id=%s&client_secret=%s&grant_type=refresh_token&refresh_token=%s&scope=deposit%%3Awrite+deposit%%3Aactions",
 			client_id, client_secret, refresh_token
 			);
+	g_free(client_id);
+	g_free(client_secret);
+	g_free(refresh_token);
 
 	char oauth_uri[1024];
 	snprintf(oauth_uri, sizeof(oauth_uri), "https://%s/oauth/token", domain);
 
 	GError* tmp_err = NULL;
-	ssize_t resp_size = gfal2_zenodo_post_internal(handle, buffer, bufsize,
-			body, bodysize, oauth_uri, 1, &tmp_err);
+	ZenodoRetry retry;
+	gfal2_zenodo_retry_init(&retry, FALSE);
+	ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(handle);
+	ZenodoOperation previous = gfal2_zenodo_stats_call(handle->stats, ZenodoOpToken);
+	ssize_t resp_size = gfal2_zenodo_post_internal(handle, buffer,
+			body, bodysize, domain, oauth_uri, 1, &retry, &tmp_err);
+	gfal2_zenodo_stats_attribute(previous);
 
 	if (resp_size < 0) {
+		gfal2_zenodo_buffer_release(handle, buffer);
 		gfal2_propagate_prefixed_error(error, tmp_err, __func__);
 		return -1;
 	}
 
-	json_object* root = json_tokener_parse(buffer);
+	json_object* root = json_tokener_parse(buffer->data);
+	gfal2_zenodo_buffer_release(handle, buffer);
 	if (!root) {
 		gfal2_set_error(error, zenodo_domain(), EIO, __func__, "Could not parse the response of /oauth/token");
 		return -1;
 	}
 
-	json_object* access_token_obj = NULL;
+	json_object *access_token_obj = NULL, *expires_in_obj = NULL;
     json_object_object_get_ex(root, "access_token", &access_token_obj);
 	if (!access_token_obj) {
 		json_object_put(root);
@@ -245,63 +798,151 @@ static int gfal2_zenodo_refresh_token(ZenodoHandle* handle, const char* domain,
 		return -1;
 	}
 
-	const char* access_token = json_object_get_string(access_token_obj);
-	gfal2_set_opt_string(handle->gfal2_context, "ZENODO", "ACCESS_TOKEN", access_token, NULL);
-	gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo got a new access token");
+	*access_token = g_strdup(json_object_get_string(access_token_obj));
+	*expires_in = 0;
+	if (json_object_object_get_ex(root, "expires_in", &expires_in_obj))
+		*expires_in = json_object_get_int64(expires_in_obj);
 
 	json_object_put(root);
 	return 0;
 }
 
 
-static ssize_t gfal2_zenodo_nobody(ZenodoHandle* handle, const char* method, char* buffer,
-        size_t bufsize, GError** error, const char *domain, const char* uri, va_list args)
+// Refresh the access token, unless somebody else did it after since
+// Only one thread goes to /oauth/token, the others wait for its result
+static int gfal2_zenodo_refresh_token(ZenodoHandle* handle, const char* domain,
+		gint64 since, GError** error)
 {
-	ssize_t resp_size;
-	char full_url[1024] = {0};
+	g_mutex_lock(&handle->token_lock);
+	while (handle->token_refreshing)
+		g_cond_wait(&handle->token_cond, &handle->token_lock);
+	if (handle->token_refreshed > since) {
+		g_mutex_unlock(&handle->token_lock);
+		return 0;
+	}
+	handle->token_refreshing = TRUE;
+	g_mutex_unlock(&handle->token_lock);
+
+	gchar* access_token = NULL;
+	gint64 expires_in = 0;
+	int ret = gfal2_zenodo_request_token(handle, domain, &access_token, &expires_in, error);
+
+	g_mutex_lock(&handle->token_lock);
+	if (ret == 0) {
+		gint64 now = g_get_monotonic_time();
+		g_free(handle->access_token);
+		handle->access_token = access_token;
+		handle->token_expires = expires_in > 0 ? now + expires_in * G_USEC_PER_SEC : 0;
+		handle->token_refreshed = now;
+		// Keep the configuration in sync for anyone else reading it
+		gfal2_set_opt_string(handle->gfal2_context, "ZENODO", "ACCESS_TOKEN", access_token, NULL);
+		gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo got a new access token, expires in %lld seconds",
+				(long long)expires_in);
+	}
+	handle->token_refreshing = FALSE;
+	g_cond_broadcast(&handle->token_cond);
+	g_mutex_unlock(&handle->token_lock);
 
-	gfal2_zenodo_build_full_url(handle, full_url, sizeof(full_url), domain, uri, args);
+	return ret;
+}
+
+
+// Decide if a failed attempt is worth another try, and wait before it if needed
+// Unauthorized requests get a token refresh, transient failures a backoff
+static gboolean gfal2_zenodo_should_retry(ZenodoHandle* handle, ZenodoRetry* retry,
+        const char* domain, GError** error)
+{
+    if ((*error)->code == EAGAIN) {
+        if (retry->token_refreshed) {
+            (*error)->code = EACCES;
+            return FALSE;
+        }
+        gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo refresh token and try again");
+        g_clear_error(error);
+        retry->token_refreshed = TRUE;
+        return gfal2_zenodo_refresh_token(handle, domain, retry->started, error) >= 0;
+    }
 
-	resp_size = gfal2_zenodo_nobody_internal(handle, method, buffer, bufsize, full_url, error);
+    gint64 delay = gfal2_zenodo_retry_delay(handle->rate_limiter, retry);
+    if (delay < 0)
+        return FALSE;
 
-	if (resp_size < 0 && (*error)->code == EAGAIN) {
-		gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo refresh token and try again");
-		g_clear_error(error);
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo transient error (%s), attempt %d in %lld ms",
+            (*error)->message, retry->attempts + 1, (long long)(delay / 1000));
+    g_clear_error(error);
+    g_usleep(delay);
+    return TRUE;
+}
 
-		if (gfal2_zenodo_refresh_token(handle, domain, buffer, bufsize, error) >= 0) {
-			resp_size = gfal2_zenodo_nobody_internal(handle, method, buffer, bufsize, full_url, error);
-			if (resp_size < 0 && (*error)->code == EAGAIN)
-				(*error)->code = EACCES;
-		}
-	}
+
+static ssize_t gfal2_zenodo_nobody_url(ZenodoHandle* handle, const char* method, ZenodoBuffer* buffer,
+        GError** error, const char *domain, const char* full_url, gboolean conditional)
+{
+	ssize_t resp_size;
+
+	ZenodoRetry retry;
+	gfal2_zenodo_retry_init(&retry, TRUE);
+	do {
+		retry.started = g_get_monotonic_time();
+		resp_size = gfal2_zenodo_nobody_internal(handle, method, buffer, domain, full_url,
+				conditional, &retry, error);
+	} while (resp_size < 0 && gfal2_zenodo_should_retry(handle, &retry, domain, error));
 
 	return resp_size;
 }
 
 
-ssize_t gfal2_zenodo_get(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
-                    const char *domain, const char* uri, ...)
+static ssize_t gfal2_zenodo_nobody(ZenodoHandle* handle, const char* method, ZenodoBuffer* buffer,
+        GError** error, const char *domain, const char* uri, va_list args)
+{
+	char full_url[1024] = {0};
+
+	gfal2_zenodo_build_full_url(handle, full_url, sizeof(full_url), domain, uri, args);
+	return gfal2_zenodo_nobody_url(handle, method, buffer, error, domain, full_url, FALSE);
+}
+
+
+ssize_t gfal2_zenodo_get(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
+        const char *domain, const char* uri, ...)
 {
     va_list args;
     va_start(args, uri);
-    ssize_t ret = gfal2_zenodo_nobody(handle, "GET", buffer, bufsize, error, domain, uri, args);
+    ssize_t ret = gfal2_zenodo_nobody(handle, "GET", buffer, error, domain, uri, args);
     va_end(args);
     return ret;
 }
 
 
-ssize_t gfal2_zenodo_head(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
+ssize_t gfal2_zenodo_get_conditional(ZenodoHandle* handle, ZenodoBuffer* buffer,
+        gpointer* cached, gsize* cachedsize, GError** error, const char* domain, const char* url)
+{
+    *cached = NULL;
+
+    ssize_t ret = gfal2_zenodo_nobody_url(handle, "GET", buffer, error, domain, url, TRUE);
+    if (ret < 0 || buffer->response != 304)
+        return ret;
+
+    *cached = gfal2_zenodo_etag_reuse(handle->etag_cache, url, cachedsize);
+    if (*cached)
+        return 0;
+
+    // Forgotten since the request was sent, so get the whole thing
+    return gfal2_zenodo_nobody_url(handle, "GET", buffer, error, domain, url, FALSE);
+}
+
+
+ssize_t gfal2_zenodo_head(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
         const char *domain, const char* uri, ...)
 {
     va_list args;
     va_start(args, uri);
-    ssize_t ret = gfal2_zenodo_nobody(handle, "HEAD", buffer, bufsize, error, domain, uri, args);
+    ssize_t ret = gfal2_zenodo_nobody(handle, "HEAD", buffer, error, domain, uri, args);
     va_end(args);
     return ret;
 }
 
 
-ssize_t gfal2_zenodo_post(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
+ssize_t gfal2_zenodo_post(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
 		const char* domain, const char* body, size_t bodysize, const char* uri, ...)
 {
 	ssize_t resp_size;
@@ -312,29 +953,588 @@ ssize_t gfal2_zenodo_post(ZenodoHandle* handle, char* buffer, size_t bufsize, GE
 	gfal2_zenodo_build_full_url(handle, full_url, sizeof(full_url), domain, uri, args);
 	va_end(args);
 
-	resp_size = gfal2_zenodo_post_internal(handle, buffer, bufsize, body, bodysize, full_url, 0, error);
-
-	if (resp_size < 0 && (*error)->code == EAGAIN) {
-		gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo refresh token and try again");
-		g_clear_error(error);
-
-		if (gfal2_zenodo_refresh_token(handle, domain, buffer, bufsize, error) >= 0) {
-			resp_size = gfal2_zenodo_post_internal(handle, buffer, bufsize, body, bodysize, full_url, 0, error);
-			if (resp_size < 0 && (*error)->code == EAGAIN)
-				(*error)->code = EACCES;
-		}
-	}
+	ZenodoRetry retry;
+	gfal2_zenodo_retry_init(&retry, FALSE);
+	do {
+		retry.started = g_get_monotonic_time();
+		resp_size = gfal2_zenodo_post_internal(handle, buffer, body, bodysize, domain, full_url, 0,
+				&retry, error);
+	} while (resp_size < 0 && gfal2_zenodo_should_retry(handle, &retry, domain, error));
 
 	return resp_size;
 }
 
 
-ssize_t gfal2_zenodo_delete(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
+ssize_t gfal2_zenodo_delete(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
         const char *domain, const char* uri, ...)
 {
     va_list args;
     va_start(args, uri);
-    ssize_t ret = gfal2_zenodo_nobody(handle, "DELETE", buffer, bufsize, error, domain, uri, args);
+    ssize_t ret = gfal2_zenodo_nobody(handle, "DELETE", buffer, error, domain, uri, args);
     va_end(args);
     return ret;
 }
+
+
+ssize_t gfal2_zenodo_get_range(ZenodoHandle* handle, char* buffer, size_t bufsize, off_t offset,
+        GError** error, const char* domain, const char* url)
+{
+    struct ZenodoMemoryWindow window = {buffer, bufsize, 0, NULL};
+    char validator[512] = {0};
+
+    ZenodoRetry retry;
+    gfal2_zenodo_retry_init(&retry, TRUE);
+    for (;;) {
+        retry.started = g_get_monotonic_time();
+        size_t from = window.used;
+        ssize_t resp_size = gfal2_zenodo_get_range_internal(handle, &window, offset,
+                validator, sizeof(validator), domain, url, &retry, error);
+        if (resp_size >= 0)
+            return resp_size;
+
+        if (validator[0] && gfal2_zenodo_retry_resume(handle->rate_limiter, &retry, window.used - from)) {
+            gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo download broke (%s), resuming at %lld",
+                    (*error)->message, (long long)(offset + window.used));
+            g_clear_error(error);
+            continue;
+        }
+
+        // Anything else starts over
+        window.used = 0;
+        validator[0] = '\0';
+        if (!gfal2_zenodo_should_retry(handle, &retry, domain, error))
+            return -1;
+    }
+}
+
+
+ssize_t gfal2_zenodo_put_stream(ZenodoHandle* handle, CURL* curl, ZenodoBuffer* buffer,
+        curl_read_callback read_func, void* read_data, GError** error, const char* domain,
+        const char* url)
+{
+    g_assert(handle != NULL && curl != NULL && url != NULL && buffer != NULL && error != NULL);
+
+    struct curl_slist* headers = gfal2_zenodo_auth_header(handle, domain, NULL);
+
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+    char err_buffer[CURL_ERROR_SIZE];
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, err_buffer);
+
+    gfal2_zenodo_buffer_reset(buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, gfal2_zenodo_write_buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, gfal2_zenodo_write_header);
+
+    // Unknown size, so the body goes chunked
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_func);
+    curl_easy_setopt(curl, CURLOPT_READDATA, read_data);
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+
+    gfal_log(GFAL_VERBOSE_VERBOSE, "PUT %s", url);
+
+    // The body is pulled from the caller as it goes, so this one can not be retried
+    gfal2_zenodo_rate_acquire(handle->rate_limiter);
+    int perform_result = curl_easy_perform(curl);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(headers);
+
+    long response = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response);
+    buffer->response = response;
+    gfal2_zenodo_stats_request(handle->stats, curl, perform_result, response, FALSE, 0);
+
+    if (perform_result != 0) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__, "%s", err_buffer);
+        return -1;
+    }
+
+    if (gfal2_zenodo_map_http_status(response, error, __func__) < 0)
+        return -1;
+
+    return (ssize_t)(buffer->size);
+}
+
+
+void gfal2_zenodo_format_url(char* full, size_t fullsize, const char* domain, const char* uri, ...)
+{
+    va_list args;
+    va_start(args, uri);
+    gfal2_zenodo_build_full_url(NULL, full, fullsize, domain, uri, args);
+    va_end(args);
+}
+
+
+// Read n digits
+static int gfal2_zenodo_parse_digits(const char** str, int n, int* value)
+{
+    *value = 0;
+    while (n-- > 0) {
+        if (!g_ascii_isdigit(**str))
+            return -1;
+        *value = *value * 10 + (**str - '0');
+        ++(*str);
+    }
+    return 0;
+}
+
+
+// Days from 1970-01-01 to the given date, in the proleptic Gregorian calendar
+static gint64 gfal2_zenodo_days_from_civil(int year, int month, int day)
+{
+    year -= month <= 2;
+    gint64 era = (year >= 0 ? year : year - 399) / 400;
+    gint64 yoe = year - era * 400;
+    gint64 doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    gint64 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+
+time_t gfal2_zenodo_parse_time(const char* str)
+{
+    int year, month, day, hour, minute, second;
+
+    if (gfal2_zenodo_parse_digits(&str, 4, &year) < 0 || *str++ != '-' ||
+        gfal2_zenodo_parse_digits(&str, 2, &month) < 0 || *str++ != '-' ||
+        gfal2_zenodo_parse_digits(&str, 2, &day) < 0 || (*str != 'T' && *str != ' '))
+        return -1;
+    ++str;
+    if (gfal2_zenodo_parse_digits(&str, 2, &hour) < 0 || *str++ != ':' ||
+        gfal2_zenodo_parse_digits(&str, 2, &minute) < 0 || *str++ != ':' ||
+        gfal2_zenodo_parse_digits(&str, 2, &second) < 0)
+        return -1;
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+        return -1;
+
+    // Fractions of a second are dropped
+    if (*str == '.')
+        while (g_ascii_isdigit(*++str))
+            ;
+
+    gint64 offset = 0;
+    if (*str == '+' || *str == '-') {
+        int sign = (*str++ == '+') ? 1 : -1;
+        int offset_hour, offset_minute = 0;
+        if (gfal2_zenodo_parse_digits(&str, 2, &offset_hour) < 0)
+            return -1;
+        if (*str == ':')
+            ++str;
+        if (g_ascii_isdigit(*str) && gfal2_zenodo_parse_digits(&str, 2, &offset_minute) < 0)
+            return -1;
+        offset = sign * (offset_hour * 3600 + offset_minute * 60);
+    }
+
+    gint64 days = gfal2_zenodo_days_from_civil(year, month, day);
+    return (time_t)(days * 86400 + hour * 3600 + minute * 60 + second - offset);
+}
+
+
+// Prepare the easy handle of a request that goes into the multi engine
+static void gfal2_zenodo_multi_setup(ZenodoHandle* handle, ZenodoRequest* request)
+{
+    request->headers = gfal2_zenodo_auth_header(handle, request->domain, NULL);
+    if (request->conditional)
+        request->headers = gfal2_zenodo_etag_conditions(handle->etag_cache, request->url,
+                request->headers);
+
+    // Resumed ranges continue after what was delivered, others start over
+    char range[sizeof(request->range)];
+    g_strlcpy(range, request->range, sizeof(range));
+    if (request->resuming) {
+        long long first = 0, last = 0;
+        sscanf(request->range, "%lld-%lld", &first, &last);
+        snprintf(range, sizeof(range), "%lld-%lld", first + (long long)request->delivered, last);
+        char if_range[1024];
+        snprintf(if_range, sizeof(if_range), "If-Range: %s", request->validator);
+        request->headers = curl_slist_append(request->headers, if_range);
+    }
+    else {
+        request->delivered = 0;
+        request->validator[0] = '\0';
+    }
+    request->attempt_from = request->delivered;
+
+    if (!request->buffer)
+        request->buffer = gfal2_zenodo_buffer_acquire(handle);
+    gfal2_zenodo_buffer_reset(request->buffer);
+    request->response = 0;
+    request->err_buffer[0] = '\0';
+
+    CURL* curl = request->curl = gfal2_zenodo_curl_acquire(handle);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, request->err_buffer);
+    if (request->write_func) {
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, request->write_data);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, request->write_func);
+    }
+    else {
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, request->buffer);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, gfal2_zenodo_write_buffer);
+    }
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, request->buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, gfal2_zenodo_write_header);
+    if (range[0]) {
+        curl_easy_setopt(curl, CURLOPT_RANGE, range);
+        // Chunks are fetched over connections of their own, as streams of one
+        // HTTP/2 connection they are not faster, and libcurl 7.88 at times stalls them
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    }
+    else if (!request->write_func)
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    if (request->read_func) {
+        // Each attempt sends the body from the start
+        if (request->seek_func)
+            request->seek_func(request->read_data, 0, SEEK_SET);
+        curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, request->read_func);
+        curl_easy_setopt(curl, CURLOPT_READDATA, request->read_data);
+        curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, request->seek_func);
+        curl_easy_setopt(curl, CURLOPT_SEEKDATA, request->read_data);
+        curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, request->read_size);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+    curl_easy_setopt(curl, CURLOPT_URL, request->url);
+
+    if (strncmp(request->method, "GET", 3) == 0)
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+    else if (strncmp(request->method, "HEAD", 4) == 0)
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
+    else
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request->method);
+
+    if (range[0])
+        gfal_log(GFAL_VERBOSE_VERBOSE, "%s %s (range %s)", request->method, request->url, range);
+    else
+        gfal_log(GFAL_VERBOSE_VERBOSE, "%s %s", request->method, request->url);
+    request->retry.started = g_get_monotonic_time();
+    gfal2_zenodo_rate_acquire(handle->rate_limiter);
+}
+
+
+// Collect the result of a finished request and give back its easy handle
+static void gfal2_zenodo_multi_done(ZenodoHandle* handle, ZenodoRequest* request, CURLcode result)
+{
+    curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, &request->response);
+    request->buffer->response = request->response;
+    gfal2_zenodo_stats_request(handle->stats, request->curl, result, request->response,
+            request->retry.attempts > 0 || request->retry.token_refreshed ||
+            request->retry.resumes > 0, 0);
+    gfal2_zenodo_curl_release(handle, request->curl);
+    request->curl = NULL;
+    curl_slist_free_all(request->headers);
+    request->headers = NULL;
+    gfal2_zenodo_retry_attempt(handle->rate_limiter, &request->retry, request->response, result,
+            request->buffer);
+
+    if (request->response == 206 && !request->resuming)
+        gfal2_zenodo_range_validator(request->buffer, request->validator, sizeof(request->validator));
+
+    if (request->resuming && request->response == 200)
+        gfal2_set_error(&request->error, zenodo_domain(), EIO, __func__,
+                "%s changed on the server while being downloaded", request->url);
+    else if (result != CURLE_OK)
+        gfal2_set_error(&request->error, zenodo_domain(), EIO, __func__, "%s",
+                request->err_buffer[0] ? request->err_buffer : curl_easy_strerror(result));
+    else
+        gfal2_zenodo_map_http_status(request->response, &request->error, __func__);
+}
+
+
+// Run the requests, keeping at most concurrency of them in flight
+static void gfal2_zenodo_multi_run(ZenodoHandle* handle, ZenodoRequest** requests,
+        size_t count, int concurrency)
+{
+    CURLM* multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, handle->max_connections);
+    // No CURLMOPT_MAX_HOST_CONNECTIONS, the loop below bounds the requests in flight.
+    // The connection cache is shared between threads, so that limit would count the
+    // connections of other threads, and park transfers this multi never wakes up
+    // Requests become streams of the HTTP/2 connections already open. Only the
+    // first ones, sent before any is known to be HTTP/2, open one each
+    if (handle->http2)
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+
+    size_t next = 0;
+    int active = 0, running = 0;
+
+    while (next < count || active > 0) {
+        while (active < concurrency && next < count) {
+            gfal2_zenodo_multi_setup(handle, requests[next]);
+            curl_multi_add_handle(multi, requests[next]->curl);
+            ++next;
+            ++active;
+        }
+
+        curl_multi_perform(multi, &running);
+
+        CURLMsg* msg;
+        int pending;
+        while ((msg = curl_multi_info_read(multi, &pending))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            ZenodoRequest* request = NULL;
+            CURL* easy = msg->easy_handle;
+            CURLcode result = msg->data.result;
+            curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char**)&request);
+            curl_multi_remove_handle(multi, easy);
+            gfal2_zenodo_multi_done(handle, request, result);
+            if (request->done_func)
+                request->done_func(request, request->done_data);
+            --active;
+        }
+
+        if (active > 0)
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    }
+
+    curl_multi_cleanup(multi);
+}
+
+
+int gfal2_zenodo_multi_perform(ZenodoHandle* handle, ZenodoRequest* requests, size_t count,
+        int concurrency)
+{
+    if (concurrency <= 0)
+        concurrency = gfal2_get_opt_integer_with_default(handle->gfal2_context, "ZENODO",
+                "BULK_CONCURRENCY", ZENODO_BULK_CONCURRENCY_DEFAULT);
+    if (concurrency <= 0)
+        concurrency = 1;
+
+    ZenodoRequest** pending = g_new(ZenodoRequest*, count);
+    ZenodoRequest** unauthorized = g_new(ZenodoRequest*, count);
+    size_t i, npending = 0;
+    for (i = 0; i < count; ++i) {
+        gfal2_zenodo_retry_init(&requests[i].retry, strcmp(requests[i].method, "POST") != 0);
+        pending[npending++] = &requests[i];
+    }
+
+    while (npending > 0) {
+        gint64 started = g_get_monotonic_time();
+        gfal2_zenodo_multi_run(handle, pending, npending, concurrency);
+
+        // Unauthorized requests are retried once after refreshing the token,
+        // transient failures after the longest of their backoffs
+        size_t nretry = 0, nunauthorized = 0;
+        gint64 wait = 0;
+        for (i = 0; i < npending; ++i) {
+            ZenodoRequest* request = pending[i];
+            if (!request->error)
+                continue;
+            if (request->error->code == EAGAIN) {
+                if (request->retry.token_refreshed) {
+                    request->error->code = EACCES;
+                    continue;
+                }
+                request->retry.token_refreshed = TRUE;
+                request->resuming = FALSE;
+                unauthorized[nunauthorized++] = request;
+            }
+            else if (request->validator[0] && gfal2_zenodo_retry_resume(handle->rate_limiter,
+                    &request->retry, request->delivered - request->attempt_from)) {
+                gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo download broke (%s), resuming %s after %zu bytes",
+                        request->error->message, request->range, request->delivered);
+                request->resuming = TRUE;
+                pending[nretry++] = request;
+            }
+            else {
+                request->resuming = FALSE;
+                gint64 delay = gfal2_zenodo_retry_delay(handle->rate_limiter, &request->retry);
+                if (delay < 0)
+                    continue;
+                wait = MAX(wait, delay);
+                pending[nretry++] = request;
+            }
+            g_clear_error(&request->error);
+        }
+
+        if (nunauthorized > 0) {
+            GError* tmp_err = NULL;
+            gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo refresh token and try again");
+            if (gfal2_zenodo_refresh_token(handle, unauthorized[0]->domain, started, &tmp_err) < 0) {
+                for (i = 0; i < nunauthorized; ++i)
+                    unauthorized[i]->error = g_error_copy(tmp_err);
+                g_error_free(tmp_err);
+            }
+            else {
+                for (i = 0; i < nunauthorized; ++i)
+                    pending[nretry++] = unauthorized[i];
+            }
+        }
+
+        if (wait > 0) {
+            gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo transient errors, retrying %zu requests in %lld ms",
+                    nretry, (long long)(wait / 1000));
+            g_usleep(wait);
+        }
+        npending = nretry;
+    }
+    g_free(unauthorized);
+    g_free(pending);
+
+    int failed = 0;
+    for (i = 0; i < count; ++i) {
+        if (requests[i].error)
+            ++failed;
+    }
+    return failed;
+}
+
+
+// One chunk of a parallel download, written either into memory or into a file
+struct ZenodoRangeChunk {
+    ZenodoRequest* request;
+    char* buffer;
+    int fd;
+    off_t offset;
+    size_t size;
+    ZenodoChunkCallback chunk_func;
+    void* chunk_data;
+};
+typedef struct ZenodoRangeChunk ZenodoRangeChunk;
+
+
+// Writes after what the request already delivered, which a new attempt
+// either keeps (when resuming) or resets
+static size_t gfal2_zenodo_write_chunk(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    ZenodoRangeChunk* chunk = (ZenodoRangeChunk*)userdata;
+    ZenodoRequest* request = chunk->request;
+    size_t len = size * nmemb;
+
+    // Error bodies (i.e. an expired token) must not end in the user data
+    long response = 0;
+    curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, &response);
+    if (response != 206)
+        return response < 300 ? 0 : len;
+
+    if (len > chunk->size - request->delivered)
+        len = chunk->size - request->delivered;
+    if (chunk->buffer) {
+        memcpy(chunk->buffer + request->delivered, ptr, len);
+    }
+    else {
+        size_t written = 0;
+        while (written < len) {
+            ssize_t ret = pwrite(chunk->fd, ptr + written, len - written,
+                    chunk->offset + request->delivered + written);
+            if (ret < 0)
+                return 0;
+            written += ret;
+        }
+    }
+    request->delivered += len;
+    return len;
+}
+
+
+static void gfal2_zenodo_chunk_done(ZenodoRequest* request, void* done_data)
+{
+    ZenodoRangeChunk* chunk = (ZenodoRangeChunk*)done_data;
+    if (!request->error)
+        chunk->chunk_func(chunk->offset, request->delivered, chunk->chunk_data);
+}
+
+
+// Split [offset, offset + length) in chunks and fetch them concurrently
+// Returns the number of bytes available from offset onwards
+static ssize_t gfal2_zenodo_get_chunks(ZenodoHandle* handle, char* buffer, int fd, size_t length,
+        off_t offset, ZenodoChunkCallback chunk_func, void* chunk_data, GError** error,
+        const char* domain, const char* url)
+{
+    int streams = gfal2_get_opt_integer_with_default(handle->gfal2_context, "ZENODO",
+            "DOWNLOAD_STREAMS", ZENODO_DOWNLOAD_STREAMS_DEFAULT);
+    size_t chunk_size = gfal2_get_opt_integer_with_default(handle->gfal2_context, "ZENODO",
+            "DOWNLOAD_CHUNK_SIZE", ZENODO_DOWNLOAD_CHUNK_SIZE_DEFAULT);
+    if (streams < 1)
+        streams = 1;
+    if (chunk_size == 0)
+        chunk_size = ZENODO_DOWNLOAD_CHUNK_SIZE_DEFAULT;
+
+    size_t nchunks = (length + chunk_size - 1) / chunk_size;
+    ZenodoRangeChunk* chunks = g_new0(ZenodoRangeChunk, nchunks);
+    ZenodoRequest* requests = g_new0(ZenodoRequest, nchunks);
+    size_t i;
+
+    for (i = 0; i < nchunks; ++i) {
+        ZenodoRangeChunk* chunk = &chunks[i];
+        chunk->offset = offset + i * chunk_size;
+        chunk->size = MIN(chunk_size, length - i * chunk_size);
+        chunk->buffer = buffer ? buffer + i * chunk_size : NULL;
+        chunk->fd = fd;
+
+        ZenodoRequest* request = chunk->request = &requests[i];
+        request->method = "GET";
+        request->domain = domain;
+        g_strlcpy(request->url, url, sizeof(request->url));
+        snprintf(request->range, sizeof(request->range), "%lld-%lld",
+                (long long)chunk->offset, (long long)(chunk->offset + chunk->size - 1));
+        request->write_func = gfal2_zenodo_write_chunk;
+        request->write_data = chunk;
+        if (chunk_func) {
+            chunk->chunk_func = chunk_func;
+            chunk->chunk_data = chunk_data;
+            request->done_func = gfal2_zenodo_chunk_done;
+            request->done_data = chunk;
+        }
+    }
+
+    gfal_log(GFAL_VERBOSE_VERBOSE, "GET %s (%zu bytes from %lld in %zu chunks, %d streams)",
+            url, length, (long long)offset, nchunks, streams);
+
+    gfal2_zenodo_multi_perform(handle, requests, nchunks, streams);
+
+    ssize_t total = 0;
+    gboolean contiguous = TRUE;
+    for (i = 0; i < nchunks; ++i) {
+        ZenodoRequest* request = &requests[i];
+        if (request->error) {
+            if (!*error)
+                gfal2_propagate_prefixed_error(error, request->error, __func__);
+            else
+                g_error_free(request->error);
+        }
+        else if (request->response != 206 && !*error) {
+            gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                    "The server does not support ranged reads (HTTP %ld)", request->response);
+        }
+        if (contiguous)
+            total += request->delivered;
+        // A short chunk means the end of the file
+        contiguous = contiguous && request->delivered == chunks[i].size;
+        gfal2_zenodo_buffer_release(handle, request->buffer);
+    }
+
+    g_free(requests);
+    g_free(chunks);
+    return *error ? -1 : total;
+}
+
+
+ssize_t gfal2_zenodo_get_range_parallel(ZenodoHandle* handle, char* buffer, size_t bufsize,
+        off_t offset, GError** error, const char* domain, const char* url)
+{
+    int streams = gfal2_get_opt_integer_with_default(handle->gfal2_context, "ZENODO",
+            "DOWNLOAD_STREAMS", ZENODO_DOWNLOAD_STREAMS_DEFAULT);
+    size_t chunk_size = gfal2_get_opt_integer_with_default(handle->gfal2_context, "ZENODO",
+            "DOWNLOAD_CHUNK_SIZE", ZENODO_DOWNLOAD_CHUNK_SIZE_DEFAULT);
+
+    if (streams <= 1 || bufsize < 2 * chunk_size)
+        return gfal2_zenodo_get_range(handle, buffer, bufsize, offset, error, domain, url);
+    return gfal2_zenodo_get_chunks(handle, buffer, -1, bufsize, offset, NULL, NULL, error,
+            domain, url);
+}
+
+
+ssize_t gfal2_zenodo_get_range_to_fd(ZenodoHandle* handle, int fd, size_t length,
+        off_t offset, ZenodoChunkCallback chunk_func, void* chunk_data, GError** error,
+        const char* domain, const char* url)
+{
+    return gfal2_zenodo_get_chunks(handle, NULL, fd, length, offset, chunk_func, chunk_data,
+            error, domain, url);
+}
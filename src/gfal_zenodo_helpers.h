@@ -18,7 +18,9 @@
 #define _GFAL_ZENODO_HELPERS_H
 
 #include <limits.h>
+#include <time.h>
 #include "gfal_zenodo.h"
+#include "gfal_zenodo_retry.h"
 
 /*
  * Resource representation
@@ -30,38 +32,231 @@ struct ZenodoResource {
 	char domain[HOST_NAME_MAX];
 	char deposition[PATH_MAX];
 	char file[PATH_MAX];
+	// Title and filename, unescaped, if the url has them
+	// When the url only gives a name, the id is empty until resolved
+	char deposition_name[NAME_MAX + 1];
+	char file_name[NAME_MAX + 1];
 
 	ZenodoResourceType type;
 };
 typedef struct ZenodoResource ZenodoResource;
 
+/*
+ * Streamed checksum
+ * Supports ADLER32 and whatever GChecksum supports (MD5, SHA1, SHA256...)
+ */
+struct ZenodoChecksum {
+    GChecksum* gchecksum;
+    guint32 adler32;
+};
+typedef struct ZenodoChecksum ZenodoChecksum;
+
+int gfal2_zenodo_checksum_init(ZenodoChecksum* chk, const char* type, GError** error);
+void gfal2_zenodo_checksum_update(ZenodoChecksum* chk, const void* data, size_t len);
+void gfal2_zenodo_checksum_final(ZenodoChecksum* chk, char* out, size_t outsize);
+
+/*
+ * Growable response buffer
+ * Buffers are taken from a per handle pool, and keep their capacity when
+ * released, so steady state requests do not allocate for the response body
+ */
+#define ZENODO_BUFFER_INITIAL_SIZE (16 * 1024)
+#define ZENODO_BUFFER_MAX_POOLED_SIZE (16 * 1024 * 1024)
+#define ZENODO_BUFFER_HEADERS_INITIAL_SIZE 1024
+
+struct ZenodoBuffer {
+    char* data;
+    size_t size;
+    size_t capacity;
+
+    // Status of the last response
+    long response;
+    // Headers of the last response, as received
+    char* headers;
+    size_t headers_size;
+    size_t headers_capacity;
+};
+typedef struct ZenodoBuffer ZenodoBuffer;
+
+ZenodoBuffer* gfal2_zenodo_buffer_acquire(ZenodoHandle* handle);
+void gfal2_zenodo_buffer_release(ZenodoHandle* handle, ZenodoBuffer* buffer);
+void gfal2_zenodo_buffer_reset(ZenodoBuffer* buffer);
+void gfal2_zenodo_buffer_free(ZenodoBuffer* buffer);
+
+/*
+ * Get the value of a response header, case insensitive
+ * Returns 0 if found, -1 otherwise
+ */
+int gfal2_zenodo_buffer_header(const ZenodoBuffer* buffer, const char* name,
+        char* value, size_t valuesize);
+
 /*
  * Initialize a Zenodo resource from a URI
+ * Segments are either id, id:name or name. A lone name is told apart by not
+ * looking like an id (numeric for depositions, an UUID for files), and is
+ * left for gfal2_zenodo_resource_resolve. A colon only separates the id if
+ * what comes before it is one, so names can have colons, and :name gives a
+ * lone name that would otherwise be taken for an id
  */
 int gfal2_zenodo_resource_from_uri(ZenodoResource*, const char*, GError**);
 
+/*
+ * Requests authenticate with an Authorization header. Tokens with a known
+ * lifetime are refreshed this many seconds before they expire
+ */
+#define ZENODO_TOKEN_REFRESH_MARGIN_DEFAULT 60
+
 /*
  * Perform a GET
  */
-ssize_t gfal2_zenodo_get(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
+ssize_t gfal2_zenodo_get(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
 		const char *domain, const char* uri, ...);
 
+/*
+ * Perform a GET over an absolute url, conditional on the validators kept for it
+ * On 304, *cached gets a copy of what was stored with gfal2_zenodo_etag_store
+ * and 0 is returned. Otherwise *cached is NULL, and the response is in buffer
+ */
+ssize_t gfal2_zenodo_get_conditional(ZenodoHandle* handle, ZenodoBuffer* buffer,
+        gpointer* cached, gsize* cachedsize, GError** error, const char* domain, const char* url);
+
 /*
  * Perform a HEAD
  */
-ssize_t gfal2_zenodo_head(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
+ssize_t gfal2_zenodo_head(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
         const char *domain, const char* uri, ...);
 
 /*
  * Perform a POST
  */
-ssize_t gfal2_zenodo_post(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
+ssize_t gfal2_zenodo_post(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
 		const char* domain, const char* body, size_t bodysize, const char* uri, ...);
 
 /*
  * Perform a DELETE
  */
-ssize_t gfal2_zenodo_delete(ZenodoHandle* handle, char* buffer, size_t bufsize, GError** error,
+ssize_t gfal2_zenodo_delete(ZenodoHandle* handle, ZenodoBuffer* buffer, GError** error,
         const char *domain, const char* uri, ...);
 
+/*
+ * Perform a ranged GET over an absolute url (i.e. a download link)
+ * Up to bufsize bytes starting at offset are written into buffer
+ */
+ssize_t gfal2_zenodo_get_range(ZenodoHandle* handle, char* buffer, size_t bufsize, off_t offset,
+        GError** error, const char* domain, const char* url);
+
+/*
+ * Perform a streamed PUT over an absolute url on the given curl handle
+ * The body is pulled from read_func, the response is written into buffer
+ */
+ssize_t gfal2_zenodo_put_stream(ZenodoHandle* handle, CURL* curl, ZenodoBuffer* buffer,
+        curl_read_callback read_func, void* read_data, GError** error, const char* domain,
+        const char* url);
+
+/*
+ * Resolve the download link, size and, if checksum is not NULL, the MD5 of a file
+ * checksum is left empty if the server does not report it
+ */
+int gfal2_zenodo_resolve_download(ZenodoHandle* zenodo, const ZenodoResource* zr,
+        char* url, size_t urlsize, off_t* size, char* checksum, size_t checksumsize,
+        GError** error);
+
+/*
+ * Format https://domain/uri into full
+ */
+void gfal2_zenodo_format_url(char* full, size_t fullsize, const char* domain, const char* uri, ...);
+
+/*
+ * Parse an ISO 8601 timestamp, as in 2016-06-15T16:10:03.319363+00:00
+ * Without an offset, the time is taken as UTC
+ * Returns the seconds since the epoch, or -1 if str is malformed
+ */
+time_t gfal2_zenodo_parse_time(const char* str);
+
+/*
+ * Request run by the multi engine
+ * method, url and domain are set by the caller. If write_func is set, the body
+ * goes there; otherwise, if buffer is NULL, one is acquired by the engine, and
+ * the caller must release it. range is optional, and ranged requests with
+ * a write_func have to keep delivered up to date to be resumed
+ * If read_func is set, read_size bytes are uploaded from it. seek_func, if
+ * set, rewinds the source so failed uploads can be retried
+ */
+#define ZENODO_BULK_CONCURRENCY_DEFAULT 16
+
+typedef struct ZenodoRequest ZenodoRequest;
+
+struct ZenodoRequest {
+    const char* method;
+    char url[GFAL_URL_MAX_LEN];
+    const char* domain;
+    char range[64];
+    curl_write_callback write_func;
+    void* write_data;
+    curl_read_callback read_func;
+    curl_seek_callback seek_func;
+    void* read_data;
+    curl_off_t read_size;
+    // Send the validators kept for url, see gfal2_zenodo_get_conditional
+    gboolean conditional;
+    // Bytes of the range already given to write_func. A broken transfer
+    // continues after them, if the object did not change (see If-Range)
+    size_t delivered;
+    // If set, called after each attempt, with error set if it failed (it may
+    // still be retried), from the thread running the requests
+    void (*done_func)(ZenodoRequest* request, void* done_data);
+    void* done_data;
+
+    ZenodoBuffer* buffer;
+    long response;
+    GError* error;
+
+    // Internal
+    CURL* curl;
+    struct curl_slist* headers;
+    ZenodoRetry retry;
+    char err_buffer[CURL_ERROR_SIZE];
+    char validator[512];
+    size_t attempt_from;
+    gboolean resuming;
+};
+
+/*
+ * Run the requests concurrently on a curl multi handle, with at most
+ * concurrency of them in flight (<= 0 uses BULK_CONCURRENCY from the configuration)
+ * Returns the number of failed requests, each one with its own error set
+ */
+int gfal2_zenodo_multi_perform(ZenodoHandle* handle, ZenodoRequest* requests, size_t count,
+        int concurrency);
+
+/*
+ * Parallel ranged downloads
+ * The range is split in DOWNLOAD_CHUNK_SIZE chunks, fetched by up to
+ * DOWNLOAD_STREAMS concurrent connections
+ */
+#define ZENODO_DOWNLOAD_STREAMS_DEFAULT 1
+#define ZENODO_DOWNLOAD_CHUNK_SIZE_DEFAULT (8 * 1024 * 1024)
+
+/*
+ * Like gfal2_zenodo_get_range, but the chunks are reassembled in order into buffer
+ * Falls back to a single stream when the range is smaller than two chunks
+ */
+ssize_t gfal2_zenodo_get_range_parallel(ZenodoHandle* handle, char* buffer, size_t bufsize,
+        off_t offset, GError** error, const char* domain, const char* url);
+
+/*
+ * Called each time a chunk has been written, in completion order, with its
+ * offset and length
+ */
+typedef void (*ZenodoChunkCallback)(off_t offset, size_t length, void* data);
+
+/*
+ * Download [offset, offset + length) of url into fd, each chunk written at its own offset
+ * If chunk_func is set, it is told about each chunk as soon as it is complete
+ * Returns the number of bytes written, or -1 on error
+ */
+ssize_t gfal2_zenodo_get_range_to_fd(ZenodoHandle* handle, int fd, size_t length,
+        off_t offset, ZenodoChunkCallback chunk_func, void* chunk_data, GError** error,
+        const char* domain, const char* url);
+
 #endif
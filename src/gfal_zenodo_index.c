@@ -0,0 +1,346 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Name to id index
+
+#include <string.h>
+#include "gfal_zenodo_index.h"
+#include "gfal_zenodo_stats.h"
+
+
+struct ZenodoIndexScope {
+    // name => id, or NULL if several entries have that name
+    GHashTable* names;
+    // Filled by the listing of gfal2_zenodo_index_list, replaces names once it is done
+    GHashTable* next_names;
+    // Last complete listing (monotonic), 0 if never or stale
+    gint64 listed;
+    gboolean refreshing;
+};
+typedef struct ZenodoIndexScope ZenodoIndexScope;
+
+
+struct ZenodoNameIndex {
+    GMutex lock;
+    GCond cond;
+    // "domain" or "domain/deposition" => scope
+    GHashTable* scopes;
+    gint64 refresh_interval;
+};
+
+
+static void gfal2_zenodo_scope_free(ZenodoIndexScope* scope)
+{
+    g_hash_table_destroy(scope->names);
+    if (scope->next_names)
+        g_hash_table_destroy(scope->next_names);
+    g_free(scope);
+}
+
+
+ZenodoNameIndex* gfal2_zenodo_index_new(gfal2_context_t context)
+{
+    ZenodoNameIndex* index = g_new0(ZenodoNameIndex, 1);
+    g_mutex_init(&index->lock);
+    g_cond_init(&index->cond);
+    index->scopes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+            (GDestroyNotify)gfal2_zenodo_scope_free);
+    index->refresh_interval = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "NAME_INDEX_REFRESH_INTERVAL", ZENODO_NAME_INDEX_REFRESH_INTERVAL_DEFAULT);
+    index->refresh_interval *= G_USEC_PER_SEC;
+    return index;
+}
+
+
+void gfal2_zenodo_index_free(ZenodoNameIndex* index)
+{
+    if (!index)
+        return;
+    g_hash_table_destroy(index->scopes);
+    g_mutex_clear(&index->lock);
+    g_cond_clear(&index->cond);
+    g_free(index);
+}
+
+
+static GHashTable* gfal2_zenodo_names_new(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+
+static void gfal2_zenodo_names_put(GHashTable* names, const char* name, const char* id)
+{
+    gpointer current;
+    if (!g_hash_table_lookup_extended(names, name, NULL, &current))
+        g_hash_table_insert(names, g_strdup(name), g_strdup(id));
+    else if (current && strcmp(current, id) != 0)
+        g_hash_table_insert(names, g_strdup(name), NULL);
+}
+
+
+static void gfal2_zenodo_scope_key(char* key, size_t keysize, const char* domain,
+        const char* deposition)
+{
+    if (deposition)
+        snprintf(key, keysize, "%s/%s", domain, deposition);
+    else
+        g_strlcpy(key, domain, keysize);
+}
+
+
+// Must be called with the lock held
+static ZenodoIndexScope* gfal2_zenodo_scope_get(ZenodoNameIndex* index, const char* domain,
+        const char* deposition, gboolean create)
+{
+    char key[HOST_NAME_MAX + PATH_MAX];
+    gfal2_zenodo_scope_key(key, sizeof(key), domain, deposition);
+
+    ZenodoIndexScope* scope = g_hash_table_lookup(index->scopes, key);
+    if (!scope && create) {
+        scope = g_new0(ZenodoIndexScope, 1);
+        scope->names = gfal2_zenodo_names_new();
+        g_hash_table_insert(index->scopes, g_strdup(key), scope);
+    }
+    return scope;
+}
+
+
+void gfal2_zenodo_index_put(ZenodoNameIndex* index, const char* domain,
+        const char* deposition, const char* name, const char* id)
+{
+    if (!name[0] || !id[0])
+        return;
+
+    g_mutex_lock(&index->lock);
+    ZenodoIndexScope* scope = gfal2_zenodo_scope_get(index, domain, deposition, TRUE);
+    gfal2_zenodo_names_put(scope->names, name, id);
+    if (scope->next_names)
+        gfal2_zenodo_names_put(scope->next_names, name, id);
+    g_mutex_unlock(&index->lock);
+}
+
+
+static gboolean gfal2_zenodo_index_points_to(gpointer key, gpointer value, gpointer id)
+{
+    return value && strcmp(value, id) == 0;
+}
+
+
+void gfal2_zenodo_index_forget(ZenodoNameIndex* index, const char* domain,
+        const char* deposition, const char* id)
+{
+    g_mutex_lock(&index->lock);
+    ZenodoIndexScope* scope = gfal2_zenodo_scope_get(index, domain, deposition, FALSE);
+    if (scope)
+        g_hash_table_foreach_remove(scope->names, gfal2_zenodo_index_points_to, (gpointer)id);
+    if (scope && scope->next_names)
+        g_hash_table_foreach_remove(scope->next_names, gfal2_zenodo_index_points_to, (gpointer)id);
+    if (!deposition) {
+        char key[HOST_NAME_MAX + PATH_MAX];
+        gfal2_zenodo_scope_key(key, sizeof(key), domain, id);
+        scope = g_hash_table_lookup(index->scopes, key);
+        if (scope && !scope->refreshing)
+            g_hash_table_remove(index->scopes, key);
+    }
+    g_mutex_unlock(&index->lock);
+}
+
+
+void gfal2_zenodo_index_invalidate(ZenodoNameIndex* index, const char* domain,
+        const char* deposition)
+{
+    g_mutex_lock(&index->lock);
+    ZenodoIndexScope* scope = gfal2_zenodo_scope_get(index, domain, deposition, FALSE);
+    if (scope)
+        scope->listed = 0;
+    g_mutex_unlock(&index->lock);
+}
+
+
+void gfal2_zenodo_index_complete(ZenodoNameIndex* index, const char* domain,
+        const char* deposition)
+{
+    g_mutex_lock(&index->lock);
+    ZenodoIndexScope* scope = gfal2_zenodo_scope_get(index, domain, deposition, TRUE);
+    scope->listed = g_get_monotonic_time();
+    g_mutex_unlock(&index->lock);
+}
+
+
+// Returns 1 and fills id if found, 0 if unknown, -1 if ambiguous
+static int gfal2_zenodo_index_get(ZenodoNameIndex* index, const char* domain,
+        const char* deposition, const char* name, char* id, size_t idsize)
+{
+    int ret = 0;
+    g_mutex_lock(&index->lock);
+    ZenodoIndexScope* scope = gfal2_zenodo_scope_get(index, domain, deposition, FALSE);
+    gpointer value;
+    if (scope && g_hash_table_lookup_extended(scope->names, name, NULL, &value)) {
+        if (value) {
+            g_strlcpy(id, value, idsize);
+            ret = 1;
+        }
+        else {
+            ret = -1;
+        }
+    }
+    g_mutex_unlock(&index->lock);
+    return ret;
+}
+
+
+// Returns TRUE if the caller has to list the scope, FALSE if it was listed
+// recently, maybe by another thread this one waited for
+static gboolean gfal2_zenodo_index_begin_refresh(ZenodoNameIndex* index, const char* domain,
+        const char* deposition)
+{
+    gboolean refresh = FALSE, waited = FALSE;
+    ZenodoIndexScope* scope;
+    g_mutex_lock(&index->lock);
+    // The scope may be dropped while waiting, so it is looked up each time
+    while ((scope = gfal2_zenodo_scope_get(index, domain, deposition, TRUE))->refreshing) {
+        g_cond_wait(&index->cond, &index->lock);
+        waited = TRUE;
+    }
+    if (!waited &&
+        (scope->listed == 0 || g_get_monotonic_time() - scope->listed >= index->refresh_interval)) {
+        scope->refreshing = TRUE;
+        scope->next_names = gfal2_zenodo_names_new();
+        refresh = TRUE;
+    }
+    g_mutex_unlock(&index->lock);
+    return refresh;
+}
+
+
+// If the listing went through, its names replace the ones of the scope, so
+// the entries gone since, and names no longer ambiguous, are not kept
+static void gfal2_zenodo_index_end_refresh(ZenodoNameIndex* index, const char* domain,
+        const char* deposition, gboolean listed)
+{
+    g_mutex_lock(&index->lock);
+    ZenodoIndexScope* scope = gfal2_zenodo_scope_get(index, domain, deposition, TRUE);
+    if (listed && scope->next_names) {
+        g_hash_table_destroy(scope->names);
+        scope->names = scope->next_names;
+    }
+    else if (scope->next_names) {
+        g_hash_table_destroy(scope->next_names);
+    }
+    scope->next_names = NULL;
+    scope->refreshing = FALSE;
+    g_cond_broadcast(&index->cond);
+    g_mutex_unlock(&index->lock);
+}
+
+
+// A full listing feeds the index through readdirpp
+static int gfal2_zenodo_index_list(ZenodoHandle* zenodo, const char* domain,
+        const char* deposition, GError** error)
+{
+    GError* tmp_err = NULL;
+    char url[GFAL_URL_MAX_LEN];
+    snprintf(url, sizeof(url), "zenodo://%s/%s", domain, deposition ? deposition : "");
+
+    ZenodoOperation previous = gfal2_zenodo_stats_attribute(ZenodoOpList);
+    gfal_file_handle dir = gfal2_zenodo_opendir(zenodo, url, &tmp_err);
+    if (dir) {
+        struct stat st;
+        while (gfal2_zenodo_readdirpp(zenodo, dir, &st, &tmp_err))
+            ;
+        gfal2_zenodo_closedir(zenodo, dir, NULL);
+    }
+    gfal2_zenodo_stats_attribute(previous);
+
+    if (tmp_err) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int gfal2_zenodo_resolve_name(ZenodoHandle* zenodo, const char* domain,
+        const char* deposition, const char* name, char* id, size_t idsize, GError** error)
+{
+    GError* tmp_err = NULL;
+    int found = gfal2_zenodo_index_get(zenodo->name_index, domain, deposition, name, id, idsize);
+
+    // An ambiguous name is listed again too, one of the entries may be gone
+    if (found <= 0 && gfal2_zenodo_index_begin_refresh(zenodo->name_index, domain, deposition)) {
+        gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo listing %s%s%s to find %s", domain,
+                deposition ? "/" : "", deposition ? deposition : "", name);
+        int ret = gfal2_zenodo_index_list(zenodo, domain, deposition, &tmp_err);
+        gfal2_zenodo_index_end_refresh(zenodo->name_index, domain, deposition, ret == 0);
+        if (ret < 0) {
+            gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+            return -1;
+        }
+    }
+    if (found <= 0)
+        found = gfal2_zenodo_index_get(zenodo->name_index, domain, deposition, name, id, idsize);
+
+    switch (found) {
+        case 1:
+            return 0;
+        case -1:
+            gfal2_set_error(error, zenodo_domain(), EINVAL, __func__,
+                    "Several %s are named %s, use id:name instead",
+                    deposition ? "files" : "depositions", name);
+            return -1;
+        default:
+            gfal2_set_error(error, zenodo_domain(), ENOENT, __func__,
+                    "No %s named %s", deposition ? "file" : "deposition", name);
+            return -1;
+    }
+}
+
+
+int gfal2_zenodo_resource_resolve(ZenodoHandle* zenodo, ZenodoResource* zr,
+        gboolean files, GError** error)
+{
+    GError* tmp_err = NULL;
+
+    if (zr->type != ZenodoRoot && !zr->deposition[0]) {
+        if (gfal2_zenodo_resolve_name(zenodo, zr->domain, NULL, zr->deposition_name,
+                zr->deposition, sizeof(zr->deposition), &tmp_err) < 0) {
+            gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+            return -1;
+        }
+    }
+    if (files && zr->type == ZenodoFile && !zr->file[0]) {
+        if (gfal2_zenodo_resolve_name(zenodo, zr->domain, zr->deposition, zr->file_name,
+                zr->file, sizeof(zr->file), &tmp_err) < 0) {
+            gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+int gfal2_zenodo_resource_lookup(ZenodoHandle* zenodo, ZenodoResource* zr,
+        const char* uri, GError** error)
+{
+    GError* tmp_err = NULL;
+    if (gfal2_zenodo_resource_from_uri(zr, uri, &tmp_err) < 0 ||
+        gfal2_zenodo_resource_resolve(zenodo, zr, TRUE, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_INDEX_H
+#define _GFAL_ZENODO_INDEX_H
+
+#include "gfal_zenodo.h"
+#include "gfal_zenodo_helpers.h"
+
+/*
+ * Name to id index, so depositions and files can be addressed by title and filename
+ * There is one scope per domain for the depositions, and one per deposition
+ * for its files. Scopes are filled by listings, and listed again on a miss or
+ * an ambiguous name, at most once every NAME_INDEX_REFRESH_INTERVAL seconds.
+ * The names of such a listing replace the ones the scope had
+ */
+#define ZENODO_NAME_INDEX_REFRESH_INTERVAL_DEFAULT 10
+
+typedef struct ZenodoNameIndex ZenodoNameIndex;
+
+ZenodoNameIndex* gfal2_zenodo_index_new(gfal2_context_t context);
+void gfal2_zenodo_index_free(ZenodoNameIndex* index);
+
+/*
+ * deposition is NULL for the scope of the depositions of the domain
+ */
+void gfal2_zenodo_index_put(ZenodoNameIndex* index, const char* domain,
+        const char* deposition, const char* name, const char* id);
+
+/*
+ * Drop the names pointing to id. For a deposition, its files are dropped as well
+ */
+void gfal2_zenodo_index_forget(ZenodoNameIndex* index, const char* domain,
+        const char* deposition, const char* id);
+
+/*
+ * The scope changed, so the next miss lists it again right away
+ */
+void gfal2_zenodo_index_invalidate(ZenodoNameIndex* index, const char* domain,
+        const char* deposition);
+
+/*
+ * A listing of the scope went through to the end
+ */
+void gfal2_zenodo_index_complete(ZenodoNameIndex* index, const char* domain,
+        const char* deposition);
+
+/*
+ * Fill the ids of the deposition, and of the file if files is TRUE, when the url
+ * gave names. Fails with ENOENT if a name is unknown, even after listing again
+ */
+int gfal2_zenodo_resource_resolve(ZenodoHandle* zenodo, ZenodoResource* zr,
+        gboolean files, GError** error);
+
+/*
+ * gfal2_zenodo_resource_from_uri followed by gfal2_zenodo_resource_resolve
+ */
+int gfal2_zenodo_resource_lookup(ZenodoHandle* zenodo, ZenodoResource* zr,
+        const char* uri, GError** error);
+
+#endif
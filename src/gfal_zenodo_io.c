@@ -18,44 +18,826 @@
 
 #include "gfal_zenodo.h"
 #include <common/gfal_common_err_helpers.h>
+#include <fcntl.h>
 #include <json.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "gfal_zenodo_cache.h"
+#include "gfal_zenodo_filecache.h"
+#include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_index.h"
+#include "gfal_zenodo_stats.h"
+
+// Readahead window defaults, in bytes
+#define ZENODO_READAHEAD_MIN_DEFAULT (1024 * 1024)
+#define ZENODO_READAHEAD_MAX_DEFAULT (64 * 1024 * 1024)
+// Files uploaded at the same time by gfal2_zenodo_upload_files
+#define ZENODO_UPLOAD_CONCURRENCY_DEFAULT 4
+// Write behind buffering of fwrite
+#define ZENODO_UPLOAD_CHUNK_SIZE_DEFAULT (4 * 1024 * 1024)
+#define ZENODO_UPLOAD_CHUNKS_DEFAULT 4
+
+
+// Part of the write behind arena
+struct ZenodoUploadChunk {
+    char* data;
+    size_t len;
+    size_t sent;
+};
+typedef struct ZenodoUploadChunk ZenodoUploadChunk;
+
+
+// Upload in progress. fwrite copies into chunks of a fixed arena and returns,
+// while the curl read callback drains the filled ones on a separate thread
+// fwrite only waits when every chunk is full or being sent
+struct ZenodoUpload {
+    CURL* curl;
+    GThread* thread;
+    char url[2048];
+
+    char* arena;
+    size_t chunk_size;
+    ZenodoUploadChunk* chunks;
+    // Owned by fwrite and by the read callback respectively
+    ZenodoUploadChunk* filling;
+    ZenodoUploadChunk* sending;
+
+    GMutex lock;
+    GCond cond;
+    GQueue free_chunks;
+    GQueue full_chunks;
+    gboolean eof;
+    gboolean done;
+
+    ZenodoBuffer* response;
+    GError* error;
+
+    // MD5 of what was written, checked against the one the server computed
+    ZenodoChecksum checksum;
+};
+typedef struct ZenodoUpload ZenodoUpload;
+
+
+struct ZenodoFileDesc {
+    ZenodoHandle* zenodo;
+    ZenodoResource zr;
+    ZenodoUpload* upload;
+    char download_url[2048];
+    char checksum[64];
+    off_t size;
+    off_t offset;
+
+    // Local copy from the file cache, if any
+    const char* mapped;
+
+    // Readahead window: holds [window_start, window_start + window_used)
+    char* window;
+    off_t window_start;
+    size_t window_used;
+    size_t window_capacity;
+
+    // Current readahead size, grows on sequential access and shrinks on random access
+    size_t readahead;
+    size_t readahead_min;
+    size_t readahead_max;
+};
+typedef struct ZenodoFileDesc ZenodoFileDesc;
+
+
+int gfal2_zenodo_resolve_download(ZenodoHandle* zenodo, const ZenodoResource* zr,
+        char* url, size_t urlsize, off_t* size, char* checksum, size_t checksumsize,
+        GError** error)
+{
+    GError* tmp_err = NULL;
+    ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(zenodo);
+
+    if (gfal2_zenodo_get(zenodo, buffer, &tmp_err, zr->domain,
+            "/api/deposit/depositions/%s/files/%s", zr->deposition, zr->file) < 0) {
+        gfal2_zenodo_buffer_release(zenodo, buffer);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    json_object* root = json_tokener_parse(buffer->data);
+    gfal2_zenodo_buffer_release(zenodo, buffer);
+    if (!root) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__, "Could not parse the response");
+        return -1;
+    }
+
+    json_object *links = NULL, *download = NULL, *filesize = NULL;
+    json_object_object_get_ex(root, "links", &links);
+    if (links)
+        json_object_object_get_ex(links, "download", &download);
+    if (!download) {
+        json_object_put(root);
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__, "Could not find the download link");
+        return -1;
+    }
+    g_strlcpy(url, json_object_get_string(download), urlsize);
+
+    *size = 0;
+    json_object_object_get_ex(root, "filesize", &filesize);
+    if (filesize)
+        *size = json_object_get_int64(filesize);
+
+    if (checksum) {
+        json_object* checksum_obj = NULL;
+        checksum[0] = '\0';
+        if (json_object_object_get_ex(root, "checksum", &checksum_obj)) {
+            const char* value = json_object_get_string(checksum_obj);
+            if (g_ascii_strncasecmp(value, "md5:", 4) == 0)
+                value += 4;
+            g_strlcpy(checksum, value, checksumsize);
+        }
+    }
+
+    json_object_put(root);
+    return 0;
+}
+
+
+// Resolve the bucket where the deposition files are uploaded
+static int gfal2_zenodo_resolve_bucket(ZenodoHandle* zenodo, const ZenodoResource* zr,
+        char* bucket, size_t bucketsize, GError** error)
+{
+    GError* tmp_err = NULL;
+    ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(zenodo);
+
+    if (gfal2_zenodo_get(zenodo, buffer, &tmp_err, zr->domain,
+            "/api/deposit/depositions/%s", zr->deposition) < 0) {
+        gfal2_zenodo_buffer_release(zenodo, buffer);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    json_object* root = json_tokener_parse(buffer->data);
+    gfal2_zenodo_buffer_release(zenodo, buffer);
+    if (!root) {
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__, "Could not parse the response");
+        return -1;
+    }
+
+    json_object *links = NULL, *bucket_obj = NULL;
+    json_object_object_get_ex(root, "links", &links);
+    if (links)
+        json_object_object_get_ex(links, "bucket", &bucket_obj);
+    if (!bucket_obj) {
+        json_object_put(root);
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                "Could not find the bucket of the deposition");
+        return -1;
+    }
+    g_strlcpy(bucket, json_object_get_string(bucket_obj), bucketsize);
+
+    json_object_put(root);
+    return 0;
+}
+
+
+// Feeds curl with the chunks filled by fwrite, giving them back once sent
+static size_t gfal2_zenodo_upload_read(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    ZenodoUpload* upload = (ZenodoUpload*)userdata;
+
+    if (!upload->sending) {
+        g_mutex_lock(&upload->lock);
+        while (!(upload->sending = g_queue_pop_head(&upload->full_chunks)) && !upload->eof)
+            g_cond_wait(&upload->cond, &upload->lock);
+        g_mutex_unlock(&upload->lock);
+        if (!upload->sending)
+            return 0;
+    }
+
+    ZenodoUploadChunk* chunk = upload->sending;
+    size_t n = MIN(size * nmemb, chunk->len - chunk->sent);
+    memcpy(ptr, chunk->data + chunk->sent, n);
+    chunk->sent += n;
+
+    if (chunk->sent == chunk->len) {
+        chunk->len = chunk->sent = 0;
+        upload->sending = NULL;
+        g_mutex_lock(&upload->lock);
+        g_queue_push_tail(&upload->free_chunks, chunk);
+        g_cond_broadcast(&upload->cond);
+        g_mutex_unlock(&upload->lock);
+    }
+
+    return n;
+}
+
+
+// Queue the chunk being filled for sending
+static void gfal2_zenodo_upload_push(ZenodoUpload* upload)
+{
+    g_mutex_lock(&upload->lock);
+    g_queue_push_tail(&upload->full_chunks, upload->filling);
+    g_cond_broadcast(&upload->cond);
+    g_mutex_unlock(&upload->lock);
+    upload->filling = NULL;
+}
+
+
+static gpointer gfal2_zenodo_upload_thread(gpointer userdata)
+{
+    ZenodoFileDesc* desc = (ZenodoFileDesc*)userdata;
+    ZenodoUpload* upload = desc->upload;
+    ZenodoHandle* zenodo = desc->zenodo;
+    GError* tmp_err = NULL;
+
+    gfal2_zenodo_stats_attribute(ZenodoOpWrite);
+
+    gfal2_zenodo_put_stream(zenodo, upload->curl, upload->response,
+            gfal2_zenodo_upload_read, upload, &tmp_err, desc->zr.domain, upload->url);
+
+    g_mutex_lock(&upload->lock);
+    upload->error = tmp_err;
+    upload->done = TRUE;
+    g_cond_broadcast(&upload->cond);
+    g_mutex_unlock(&upload->lock);
+
+    return NULL;
+}
+
+
+// Start the PUT, the body is fed by fwrite
+static int gfal2_zenodo_upload_start(ZenodoHandle* zenodo, ZenodoFileDesc* desc, GError** error)
+{
+    GError* tmp_err = NULL;
+    char bucket[1024];
+
+    if (gfal2_zenodo_resolve_bucket(zenodo, &desc->zr, bucket, sizeof(bucket), &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    ZenodoUpload* upload = g_malloc0(sizeof(*upload));
+    upload->curl = gfal2_zenodo_curl_acquire(zenodo);
+    upload->response = gfal2_zenodo_buffer_acquire(zenodo);
+    g_mutex_init(&upload->lock);
+    g_cond_init(&upload->cond);
+
+    // At least two chunks, so one can be filled while the other is sent
+    upload->chunk_size = gfal2_get_opt_integer_with_default(zenodo->gfal2_context, "ZENODO",
+            "UPLOAD_CHUNK_SIZE", ZENODO_UPLOAD_CHUNK_SIZE_DEFAULT);
+    int nchunks = gfal2_get_opt_integer_with_default(zenodo->gfal2_context, "ZENODO",
+            "UPLOAD_CHUNKS", ZENODO_UPLOAD_CHUNKS_DEFAULT);
+    if (upload->chunk_size < 64 * 1024)
+        upload->chunk_size = 64 * 1024;
+    if (nchunks < 2)
+        nchunks = 2;
+    upload->arena = g_malloc(upload->chunk_size * nchunks);
+    upload->chunks = g_new0(ZenodoUploadChunk, nchunks);
+    g_queue_init(&upload->free_chunks);
+    g_queue_init(&upload->full_chunks);
+    int i;
+    for (i = 0; i < nchunks; ++i) {
+        upload->chunks[i].data = upload->arena + i * upload->chunk_size;
+        g_queue_push_tail(&upload->free_chunks, &upload->chunks[i]);
+    }
+    gfal2_zenodo_checksum_init(&upload->checksum, "MD5", NULL);
+
+    // Uploads go to the bucket by name, so the file does not need to exist
+    const char* name = desc->zr.file_name[0] ? desc->zr.file_name : desc->zr.file;
+    char* escaped = curl_easy_escape(upload->curl, name, 0);
+    snprintf(upload->url, sizeof(upload->url), "%s/%s", bucket, escaped);
+    curl_free(escaped);
+
+    desc->upload = upload;
+    upload->thread = g_thread_new("zenodo-upload", gfal2_zenodo_upload_thread, desc);
+    return 0;
+}
+
+
+// Compare the MD5 computed while writing with the one the server reports
+static int gfal2_zenodo_upload_verify(const ZenodoBuffer* response, const char* written,
+        GError** error)
+{
+    json_object* root = json_tokener_parse(response->data);
+    json_object* checksum = NULL;
+    int ret = 0;
+
+    if (root && json_object_object_get_ex(root, "checksum", &checksum)) {
+        const char* stored = json_object_get_string(checksum);
+        if (g_ascii_strncasecmp(stored, "md5:", 4) == 0)
+            stored += 4;
+        if (g_ascii_strcasecmp(stored, written) != 0) {
+            gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                    "Checksum mismatch after upload: sent %s, stored %s", written, stored);
+            ret = -1;
+        }
+        else {
+            gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo upload checksum verified: %s", written);
+        }
+    }
+
+    json_object_put(root);
+    return ret;
+}
+
+
+// Wait for the PUT to finish and release the upload
+static int gfal2_zenodo_upload_finish(ZenodoHandle* zenodo, ZenodoFileDesc* desc, GError** error)
+{
+    ZenodoUpload* upload = desc->upload;
+    int ret = 0;
+
+    // Flush what is left
+    if (upload->filling && upload->filling->len > 0)
+        gfal2_zenodo_upload_push(upload);
+
+    g_mutex_lock(&upload->lock);
+    upload->eof = TRUE;
+    g_cond_broadcast(&upload->cond);
+    g_mutex_unlock(&upload->lock);
+
+    g_thread_join(upload->thread);
+
+    if (upload->error) {
+        gfal2_propagate_prefixed_error(error, upload->error, __func__);
+        ret = -1;
+    }
+    else {
+        gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo upload finished: %s", upload->response->data);
+    }
+
+    char written[64] = {0};
+    gfal2_zenodo_checksum_final(&upload->checksum, written, sizeof(written));
+    if (ret == 0 && gfal2_zenodo_upload_verify(upload->response, written, error) < 0)
+        ret = -1;
+
+    // The new file is addressed by its name, not its id, so drop the whole deposition
+    gfal2_zenodo_cache_invalidate(zenodo->stat_cache, desc->zr.domain, desc->zr.deposition, NULL);
+    gfal2_zenodo_index_invalidate(zenodo->name_index, desc->zr.domain, desc->zr.deposition);
+
+    gfal2_zenodo_buffer_release(zenodo, upload->response);
+    gfal2_zenodo_curl_release(zenodo, upload->curl);
+    g_mutex_clear(&upload->lock);
+    g_cond_clear(&upload->cond);
+    g_queue_clear(&upload->free_chunks);
+    g_queue_clear(&upload->full_chunks);
+    g_free(upload->chunks);
+    g_free(upload->arena);
+    g_free(upload);
+    desc->upload = NULL;
+    return ret;
+}
 
 
 gfal_file_handle gfal2_zenodo_fopen(plugin_handle plugin_data, const char* url,
         int flag, mode_t mode, GError** error)
 {
-	gfal2_set_error(error, zenodo_domain(), ENOSYS, __func__, "Not implemented");
-	return NULL;
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    GError* tmp_err = NULL;
+    ZenodoResource zr;
+
+    if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return NULL;
+    }
+
+    if (zr.type != ZenodoFile) {
+        gfal2_set_error(error, zenodo_domain(), EISDIR, __func__, "Only files can be opened");
+        return NULL;
+    }
+
+    if ((flag & O_ACCMODE) == O_RDWR) {
+        gfal2_set_error(error, zenodo_domain(), EINVAL, __func__,
+                "Files can be opened either for reading or writing");
+        return NULL;
+    }
+    gfal2_zenodo_stats_attribute((flag & O_ACCMODE) == O_WRONLY ? ZenodoOpWrite : ZenodoOpRead);
+
+    // A file being written may not exist yet, so only its deposition has to
+    if (gfal2_zenodo_resource_resolve(zenodo, &zr, (flag & O_ACCMODE) != O_WRONLY, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return NULL;
+    }
+
+    ZenodoFileDesc* desc = g_malloc0(sizeof(*desc));
+    desc->zr = zr;
+    desc->zenodo = zenodo;
+
+    if ((flag & O_ACCMODE) == O_WRONLY) {
+        if (gfal2_zenodo_upload_start(zenodo, desc, &tmp_err) < 0) {
+            g_free(desc);
+            gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+            return NULL;
+        }
+        return gfal_file_handle_new2(gfal2_zenodo_getName(), desc, NULL, url);
+    }
+
+    if (gfal2_zenodo_resolve_download(zenodo, &desc->zr, desc->download_url,
+            sizeof(desc->download_url), &desc->size, desc->checksum, sizeof(desc->checksum),
+            &tmp_err) < 0) {
+        g_free(desc);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return NULL;
+    }
+
+    // Served from the local copy, or read remotely if it can not be cached
+    if (zenodo->file_cache && desc->checksum[0]) {
+        desc->mapped = gfal2_zenodo_filecache_map(zenodo->file_cache, zenodo, desc->checksum,
+                desc->size, desc->zr.domain, desc->download_url, &tmp_err);
+        if (!desc->mapped) {
+            gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo reading %s remotely: %s", url, tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    desc->readahead_min = gfal2_get_opt_integer_with_default(zenodo->gfal2_context,
+            "ZENODO", "READAHEAD_MIN", ZENODO_READAHEAD_MIN_DEFAULT);
+    desc->readahead_max = gfal2_get_opt_integer_with_default(zenodo->gfal2_context,
+            "ZENODO", "READAHEAD_MAX", ZENODO_READAHEAD_MAX_DEFAULT);
+    if (desc->readahead_max < desc->readahead_min)
+        desc->readahead_max = desc->readahead_min;
+    desc->readahead = desc->readahead_min;
+
+    return gfal_file_handle_new2(gfal2_zenodo_getName(), desc, NULL, url);
+}
+
+
+// Fill the readahead window starting at offset
+static int gfal2_zenodo_fill_window(ZenodoHandle* zenodo, ZenodoFileDesc* desc,
+        off_t offset, GError** error)
+{
+    // Sequential access doubles the window, anything else resets it
+    if (desc->window_used > 0 && offset == desc->window_start + (off_t)desc->window_used)
+        desc->readahead = MIN(desc->readahead * 2, desc->readahead_max);
+    else
+        desc->readahead = desc->readahead_min;
+
+    size_t len = desc->readahead;
+    if (offset + (off_t)len > desc->size)
+        len = desc->size - offset;
+
+    if (len > desc->window_capacity) {
+        desc->window = g_realloc(desc->window, len);
+        desc->window_capacity = len;
+    }
+
+    ssize_t ret = gfal2_zenodo_get_range_parallel(zenodo, desc->window, len, offset, error,
+            desc->zr.domain, desc->download_url);
+    if (ret < 0) {
+        desc->window_used = 0;
+        return -1;
+    }
+
+    desc->window_start = offset;
+    desc->window_used = ret;
+    return 0;
 }
 
 
 ssize_t gfal2_zenodo_fread(plugin_handle plugin_data, gfal_file_handle fd, void* buff,
         size_t count, GError** error)
 {
-	gfal2_set_error(error, zenodo_domain(), ENOSYS, __func__, "Not implemented");
-    return -1;
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    gfal2_zenodo_stats_call(zenodo->stats, ZenodoOpRead);
+    ZenodoFileDesc* desc = gfal_file_handle_get_fdesc(fd);
+    GError* tmp_err = NULL;
+    char* out = (char*)buff;
+    size_t done = 0;
+
+    if (desc->upload) {
+        gfal2_set_error(error, zenodo_domain(), EBADF, __func__, "File opened for writing");
+        return -1;
+    }
+
+    if (desc->mapped) {
+        if (desc->offset < desc->size) {
+            done = MIN(count, (size_t)(desc->size - desc->offset));
+            memcpy(out, desc->mapped + desc->offset, done);
+            desc->offset += done;
+        }
+        return done;
+    }
+
+    while (done < count && desc->offset < desc->size) {
+        off_t window_end = desc->window_start + desc->window_used;
+
+        if (desc->offset >= desc->window_start && desc->offset < window_end) {
+            size_t n = MIN(count - done, (size_t)(window_end - desc->offset));
+            memcpy(out + done, desc->window + (desc->offset - desc->window_start), n);
+            desc->offset += n;
+            done += n;
+        }
+        // Big reads bypass the window and go straight into the caller buffer
+        else if (count - done >= desc->readahead_max) {
+            size_t len = MIN(count - done, (size_t)(desc->size - desc->offset));
+            ssize_t ret = gfal2_zenodo_get_range_parallel(zenodo, out + done, len, desc->offset,
+                    &tmp_err, desc->zr.domain, desc->download_url);
+            if (ret <= 0)
+                break;
+            desc->offset += ret;
+            done += ret;
+        }
+        else if (gfal2_zenodo_fill_window(zenodo, desc, desc->offset, &tmp_err) < 0 ||
+                 desc->window_used == 0) {
+            break;
+        }
+    }
+
+    if (tmp_err) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+    return done;
 }
 
 
 ssize_t gfal2_zenodo_fwrite(plugin_handle plugin_data, gfal_file_handle fd,
         const void* buff, size_t count, GError** error)
 {
-	gfal2_set_error(error, zenodo_domain(), ENOSYS, __func__, "Not implemented");
-    return -1;
+    ZenodoFileDesc* desc = gfal_file_handle_get_fdesc(fd);
+    gfal2_zenodo_stats_call(desc->zenodo->stats, ZenodoOpWrite);
+    ZenodoUpload* upload = desc->upload;
+
+    if (!upload) {
+        gfal2_set_error(error, zenodo_domain(), EBADF, __func__, "File opened for reading");
+        return -1;
+    }
+
+    // Copy into the arena, waiting only if all the chunks are taken
+    const char* data = (const char*)buff;
+    size_t left = count;
+    while (left > 0) {
+        if (!upload->filling) {
+            g_mutex_lock(&upload->lock);
+            while (!upload->done && !(upload->filling = g_queue_pop_head(&upload->free_chunks)))
+                g_cond_wait(&upload->cond, &upload->lock);
+            g_mutex_unlock(&upload->lock);
+            // The request is over before having all the data
+            if (!upload->filling) {
+                gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                        "The upload was interrupted, the error is reported on close");
+                return -1;
+            }
+        }
+
+        ZenodoUploadChunk* chunk = upload->filling;
+        size_t n = MIN(left, upload->chunk_size - chunk->len);
+        memcpy(chunk->data + chunk->len, data, n);
+        gfal2_zenodo_checksum_update(&upload->checksum, data, n);
+        chunk->len += n;
+        data += n;
+        left -= n;
+        desc->offset += n;
+
+        if (chunk->len == upload->chunk_size)
+            gfal2_zenodo_upload_push(upload);
+    }
+
+    return count;
 }
 
 
 int gfal2_zenodo_fclose(plugin_handle plugin_data, gfal_file_handle fd, GError **error)
 {
-	gfal2_set_error(error, zenodo_domain(), ENOSYS, __func__, "Not implemented");
-    return -1;
+    ZenodoFileDesc* desc = gfal_file_handle_get_fdesc(fd);
+    gfal2_zenodo_stats_attribute(desc->upload ? ZenodoOpWrite : ZenodoOpRead);
+    GError* tmp_err = NULL;
+    int ret = 0;
+
+    if (desc->upload && gfal2_zenodo_upload_finish(plugin_data, desc, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        ret = -1;
+    }
+
+    if (desc->mapped)
+        munmap((void*)desc->mapped, desc->size > 0 ? desc->size : 1);
+    g_free(desc->window);
+    g_free(desc);
+    gfal_file_handle_delete(fd);
+    return ret;
 }
 
 
 off_t gfal2_zenodo_fseek(plugin_handle plugin_data, gfal_file_handle fd, off_t offset,
         int whence, GError** error)
 {
-	gfal2_set_error(error, zenodo_domain(), ENOSYS, __func__, "Not implemented");
-    return -1;
+    ZenodoFileDesc* desc = gfal_file_handle_get_fdesc(fd);
+    off_t new_offset;
+
+    if (desc->upload) {
+        gfal2_set_error(error, zenodo_domain(), ESPIPE, __func__, "Uploads can not seek");
+        return -1;
+    }
+
+    switch (whence) {
+        case SEEK_SET:
+            new_offset = offset;
+            break;
+        case SEEK_CUR:
+            new_offset = desc->offset + offset;
+            break;
+        case SEEK_END:
+            new_offset = desc->size + offset;
+            break;
+        default:
+            gfal2_set_error(error, zenodo_domain(), EINVAL, __func__, "Invalid whence");
+            return -1;
+    }
+
+    if (new_offset < 0) {
+        gfal2_set_error(error, zenodo_domain(), EINVAL, __func__, "Negative offset");
+        return -1;
+    }
+
+    // The window is kept, so seeking back inside it does not trigger a new request
+    desc->offset = new_offset;
+    return desc->offset;
+}
+
+
+// Local file pushed by gfal2_zenodo_upload_batch, hashed as it is read
+// It is only opened once its upload starts, and closed as soon as it is
+// over, so large batches do not hold one descriptor per file
+struct ZenodoUploadSource {
+    const char* path;
+    FILE* fp;
+    // errno if it could not be opened
+    int open_errno;
+    ZenodoChecksum checksum;
+    char written[64];
+};
+typedef struct ZenodoUploadSource ZenodoUploadSource;
+
+
+static int gfal2_zenodo_upload_source_open(ZenodoUploadSource* source)
+{
+    source->fp = fopen(source->path, "rb");
+    if (!source->fp) {
+        source->open_errno = errno;
+        return -1;
+    }
+    gfal2_zenodo_checksum_init(&source->checksum, "MD5", NULL);
+    return 0;
+}
+
+
+static size_t gfal2_zenodo_upload_source_read(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    ZenodoUploadSource* source = (ZenodoUploadSource*)userdata;
+    if (!source->fp && gfal2_zenodo_upload_source_open(source) < 0)
+        return CURL_READFUNC_ABORT;
+    size_t n = fread(ptr, size, nmemb, source->fp);
+    if (n == 0 && ferror(source->fp))
+        return CURL_READFUNC_ABORT;
+    gfal2_zenodo_checksum_update(&source->checksum, ptr, n * size);
+    return n;
+}
+
+
+// Only rewinds to the start are possible, since the hash restarts with them
+static int gfal2_zenodo_upload_source_seek(void* userdata, curl_off_t offset, int origin)
+{
+    ZenodoUploadSource* source = (ZenodoUploadSource*)userdata;
+    if (offset != 0 || origin != SEEK_SET)
+        return CURL_SEEKFUNC_CANTSEEK;
+    // Nothing read yet
+    if (!source->fp)
+        return CURL_SEEKFUNC_OK;
+    if (fseek(source->fp, 0, SEEK_SET) < 0)
+        return CURL_SEEKFUNC_FAIL;
+    char discard[64];
+    gfal2_zenodo_checksum_final(&source->checksum, discard, sizeof(discard));
+    gfal2_zenodo_checksum_init(&source->checksum, "MD5", NULL);
+    return CURL_SEEKFUNC_OK;
+}
+
+
+// End of an attempt: keep the hash of what was sent, and give the descriptor
+// back. A retry opens the file again
+static void gfal2_zenodo_upload_source_done(ZenodoRequest* request, void* done_data)
+{
+    ZenodoUploadSource* source = (ZenodoUploadSource*)done_data;
+    // Empty files may never be read
+    if (!source->fp && (request->error || source->open_errno))
+        return;
+    if (!source->fp)
+        gfal2_zenodo_checksum_init(&source->checksum, "MD5", NULL);
+    gfal2_zenodo_checksum_final(&source->checksum, source->written, sizeof(source->written));
+    if (source->fp) {
+        fclose(source->fp);
+        source->fp = NULL;
+    }
+}
+
+
+int gfal2_zenodo_upload_batch(plugin_handle plugin_data, const char* deposition_url,
+        int nbfiles, const char* const* sources, const char* const* names,
+        const char* const* md5s, GError** errors)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    gfal2_zenodo_stats_call(zenodo->stats, ZenodoOpWrite);
+    GError* tmp_err = NULL;
+    ZenodoResource zr;
+    char bucket[1024];
+    int i;
+
+    if (gfal2_zenodo_resource_lookup(zenodo, &zr, deposition_url, &tmp_err) == 0 &&
+        zr.type != ZenodoDeposition)
+        gfal2_set_error(&tmp_err, zenodo_domain(), ENOTDIR, __func__,
+                "Files can only be uploaded into a deposition");
+    if (!tmp_err)
+        gfal2_zenodo_resolve_bucket(zenodo, &zr, bucket, sizeof(bucket), &tmp_err);
+    if (tmp_err) {
+        for (i = 0; i < nbfiles; ++i)
+            errors[i] = g_error_copy(tmp_err);
+        g_error_free(tmp_err);
+        return -1;
+    }
+
+    ZenodoUploadSource* files = g_new0(ZenodoUploadSource, nbfiles);
+    ZenodoRequest* requests = g_new0(ZenodoRequest, nbfiles);
+    int* owner = g_new(int, nbfiles);
+    int nrequests = 0, failed = 0;
+
+    for (i = 0; i < nbfiles; ++i) {
+        const char* path = sources[i];
+        if (strncmp(path, "file://", 7) == 0)
+            path += 7;
+        files[i].path = path;
+
+        // Fail early on what can not be read, without opening anything yet
+        struct stat st;
+        if (stat(path, &st) < 0 || access(path, R_OK) < 0) {
+            gfal2_set_error(&errors[i], zenodo_domain(), errno, __func__,
+                    "Could not open %s: %s", path, strerror(errno));
+            ++failed;
+            continue;
+        }
+
+        gchar* name = names ? g_strdup(names[i]) : g_path_get_basename(path);
+        gchar* escaped = g_uri_escape_string(name, NULL, FALSE);
+        ZenodoRequest* request = &requests[nrequests];
+        request->method = "PUT";
+        request->domain = zr.domain;
+        snprintf(request->url, sizeof(request->url), "%s/%s", bucket, escaped);
+        request->read_func = gfal2_zenodo_upload_source_read;
+        request->seek_func = gfal2_zenodo_upload_source_seek;
+        request->read_data = &files[i];
+        request->read_size = st.st_size;
+        request->done_func = gfal2_zenodo_upload_source_done;
+        request->done_data = &files[i];
+        owner[nrequests++] = i;
+        g_free(escaped);
+        g_free(name);
+    }
+
+    int concurrency = gfal2_get_opt_integer_with_default(zenodo->gfal2_context, "ZENODO",
+            "UPLOAD_CONCURRENCY", ZENODO_UPLOAD_CONCURRENCY_DEFAULT);
+    gfal2_zenodo_multi_perform(zenodo, requests, nrequests, concurrency);
+
+    for (i = 0; i < nrequests; ++i) {
+        ZenodoRequest* request = &requests[i];
+        ZenodoUploadSource* file = &files[owner[i]];
+        GError** error = &errors[owner[i]];
+
+        if (request->error && file->open_errno) {
+            g_error_free(request->error);
+            gfal2_set_error(error, zenodo_domain(), file->open_errno, __func__,
+                    "Could not open %s: %s", file->path, strerror(file->open_errno));
+        }
+        else if (request->error) {
+            gfal2_propagate_prefixed_error(error, request->error, __func__);
+        }
+        else if (gfal2_zenodo_upload_verify(request->buffer, file->written, error) == 0 &&
+                md5s && md5s[owner[i]] && md5s[owner[i]][0] &&
+                g_ascii_strcasecmp(md5s[owner[i]], file->written) != 0) {
+            gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                    "Checksum mismatch for %s: expected %s, sent %s", file->path,
+                    md5s[owner[i]], file->written);
+        }
+
+        if (*error)
+            ++failed;
+        else
+            gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo uploaded %s", sources[owner[i]]);
+        gfal2_zenodo_buffer_release(zenodo, request->buffer);
+    }
+
+    for (i = 0; i < nbfiles; ++i) {
+        if (files[i].fp)
+            fclose(files[i].fp);
+    }
+    gfal2_zenodo_cache_invalidate(zenodo->stat_cache, zr.domain, zr.deposition, NULL);
+    gfal2_zenodo_index_invalidate(zenodo->name_index, zr.domain, zr.deposition);
+
+    g_free(owner);
+    g_free(requests);
+    g_free(files);
+    return failed ? -1 : 0;
+}
+
+
+int gfal2_zenodo_upload_files(plugin_handle plugin_data, const char* deposition_url,
+        int nbfiles, const char* const* sources, GError** errors)
+{
+    return gfal2_zenodo_upload_batch(plugin_data, deposition_url, nbfiles, sources, NULL, NULL,
+            errors);
 }
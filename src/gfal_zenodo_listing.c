@@ -0,0 +1,528 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Single pass decoder for the listings, which only keeps the fields used by readdirpp
+
+#include <string.h>
+#include "gfal_zenodo_listing.h"
+
+
+struct ZenodoScanner {
+    const char* p;
+    const char* end;
+};
+typedef struct ZenodoScanner ZenodoScanner;
+
+// A string or number value, pointing into the document
+struct ZenodoToken {
+    const char* start;
+    size_t len;
+    gboolean escaped;
+};
+typedef struct ZenodoToken ZenodoToken;
+
+
+static void gfal2_zenodo_scan_blank(ZenodoScanner* s)
+{
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r'))
+        ++s->p;
+}
+
+
+static gboolean gfal2_zenodo_scan_char(ZenodoScanner* s, char c)
+{
+    gfal2_zenodo_scan_blank(s);
+    if (s->p < s->end && *s->p == c) {
+        ++s->p;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+
+// s->p is on the opening quote, token gets the raw contents
+static int gfal2_zenodo_scan_string(ZenodoScanner* s, ZenodoToken* token)
+{
+    const char* start = ++s->p;
+    gboolean escaped = FALSE;
+    while (s->p < s->end && *s->p != '"') {
+        if (*s->p == '\\') {
+            escaped = TRUE;
+            ++s->p;
+        }
+        ++s->p;
+    }
+    if (s->p >= s->end)
+        return -1;
+    if (token) {
+        token->start = start;
+        token->len = s->p - start;
+        token->escaped = escaped;
+    }
+    ++s->p;
+    return 0;
+}
+
+
+// Numbers and literals run until the next delimiter
+static int gfal2_zenodo_scan_scalar(ZenodoScanner* s, ZenodoToken* token)
+{
+    const char* start = s->p;
+    while (s->p < s->end && *s->p != ',' && *s->p != '}' && *s->p != ']' &&
+           *s->p != ' ' && *s->p != '\t' && *s->p != '\n' && *s->p != '\r')
+        ++s->p;
+    if (s->p == start)
+        return -1;
+    if (token) {
+        token->start = start;
+        token->len = s->p - start;
+        token->escaped = FALSE;
+    }
+    return 0;
+}
+
+
+static int gfal2_zenodo_skip_value(ZenodoScanner* s)
+{
+    gfal2_zenodo_scan_blank(s);
+    if (s->p >= s->end)
+        return -1;
+    if (*s->p == '"')
+        return gfal2_zenodo_scan_string(s, NULL);
+    if (*s->p != '{' && *s->p != '[')
+        return gfal2_zenodo_scan_scalar(s, NULL);
+
+    int depth = 0;
+    while (s->p < s->end) {
+        switch (*s->p) {
+            case '"':
+                if (gfal2_zenodo_scan_string(s, NULL) < 0)
+                    return -1;
+                continue;
+            case '{':
+            case '[':
+                ++depth;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0) {
+                    ++s->p;
+                    return 0;
+                }
+                break;
+        }
+        ++s->p;
+    }
+    return -1;
+}
+
+
+// Number of elements of the array s->p is on
+static int gfal2_zenodo_count_array(ZenodoScanner* s, guint32* count)
+{
+    *count = 0;
+    ++s->p;
+    if (gfal2_zenodo_scan_char(s, ']'))
+        return 0;
+    do {
+        if (gfal2_zenodo_skip_value(s) < 0)
+            return -1;
+        ++(*count);
+    } while (gfal2_zenodo_scan_char(s, ','));
+    return gfal2_zenodo_scan_char(s, ']') ? 0 : -1;
+}
+
+
+static int gfal2_zenodo_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+
+static gunichar gfal2_zenodo_read_u16(const char* p, const char* end)
+{
+    if (end - p < 4)
+        return 0xFFFD;
+    gunichar value = 0;
+    int i;
+    for (i = 0; i < 4; ++i) {
+        int digit = gfal2_zenodo_hex(p[i]);
+        if (digit < 0)
+            return 0xFFFD;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+
+// Append the decoded string to the arena
+static void gfal2_zenodo_append_token(GString* out, const ZenodoToken* token)
+{
+    if (!token->escaped) {
+        g_string_append_len(out, token->start, token->len);
+        return;
+    }
+
+    const char* p = token->start;
+    const char* end = token->start + token->len;
+    while (p < end) {
+        const char* run = p;
+        while (p < end && *p != '\\')
+            ++p;
+        g_string_append_len(out, run, p - run);
+        if (p + 1 >= end)
+            break;
+
+        ++p;
+        switch (*p++) {
+            case 'b': g_string_append_c(out, '\b'); break;
+            case 'f': g_string_append_c(out, '\f'); break;
+            case 'n': g_string_append_c(out, '\n'); break;
+            case 'r': g_string_append_c(out, '\r'); break;
+            case 't': g_string_append_c(out, '\t'); break;
+            case 'u': {
+                gunichar c = gfal2_zenodo_read_u16(p, end);
+                p = MIN(p + 4, end);
+                // Surrogate pair
+                if (c >= 0xD800 && c < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    gunichar low = gfal2_zenodo_read_u16(p + 2, end);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                char utf8[8];
+                g_string_append_len(out, utf8, g_unichar_to_utf8(c, utf8));
+                break;
+            }
+            default:
+                g_string_append_c(out, p[-1]);
+        }
+    }
+}
+
+
+static gint64 gfal2_zenodo_token_int(const ZenodoToken* token)
+{
+    // Not g_strlcpy, which would go through the rest of the document for its length
+    char number[32];
+    size_t len = MIN(token->len, sizeof(number) - 1);
+    memcpy(number, token->start, len);
+    number[len] = '\0';
+    return g_ascii_strtoll(number, NULL, 10);
+}
+
+
+static gboolean gfal2_zenodo_key_is(const ZenodoToken* key, const char* name)
+{
+    size_t len = strlen(name);
+    return key->len == len && memcmp(key->start, name, len) == 0;
+}
+
+
+// Called for each member of an object, with s->p on the value, which it must consume
+typedef int (*ZenodoMemberFunc)(ZenodoScanner* s, const ZenodoToken* key, void* data);
+
+
+static int gfal2_zenodo_scan_object(ZenodoScanner* s, ZenodoMemberFunc member, void* data)
+{
+    ZenodoToken key;
+
+    if (!gfal2_zenodo_scan_char(s, '{'))
+        return -1;
+    if (gfal2_zenodo_scan_char(s, '}'))
+        return 0;
+    do {
+        gfal2_zenodo_scan_blank(s);
+        if (s->p >= s->end || *s->p != '"' || gfal2_zenodo_scan_string(s, &key) < 0)
+            return -1;
+        if (!gfal2_zenodo_scan_char(s, ':'))
+            return -1;
+        gfal2_zenodo_scan_blank(s);
+        if (s->p >= s->end || member(s, &key, data) < 0)
+            return -1;
+    } while (gfal2_zenodo_scan_char(s, ','));
+    return gfal2_zenodo_scan_char(s, '}') ? 0 : -1;
+}
+
+
+// Entry being decoded
+struct ZenodoEntryState {
+    ZenodoListing* listing;
+    ZenodoListEntry entry;
+    ZenodoToken id;
+    ZenodoToken title;
+};
+typedef struct ZenodoEntryState ZenodoEntryState;
+
+
+// Records keep their title in the metadata
+static int gfal2_zenodo_metadata_member(ZenodoScanner* s, const ZenodoToken* key, void* data)
+{
+    ZenodoEntryState* state = (ZenodoEntryState*)data;
+    if (*s->p == '"' && !state->title.start && gfal2_zenodo_key_is(key, "title"))
+        return gfal2_zenodo_scan_string(s, &state->title);
+    return gfal2_zenodo_skip_value(s);
+}
+
+
+static int gfal2_zenodo_entry_member(ZenodoScanner* s, const ZenodoToken* key, void* data)
+{
+    ZenodoEntryState* state = (ZenodoEntryState*)data;
+    ZenodoListSchema schema = state->listing->schema;
+    ZenodoToken value;
+    int ret;
+
+    gboolean is_string = (*s->p == '"');
+    gboolean is_array = (*s->p == '[');
+    gboolean is_object = (*s->p == '{');
+
+    if (gfal2_zenodo_key_is(key, "id")) {
+        return is_string ? gfal2_zenodo_scan_string(s, &state->id) : gfal2_zenodo_scan_scalar(s, &state->id);
+    }
+    if (is_string && !state->title.start &&
+        gfal2_zenodo_key_is(key, schema == ZenodoListFiles ? "filename" : "title")) {
+        return gfal2_zenodo_scan_string(s, &state->title);
+    }
+    if (is_object && schema == ZenodoListRecords && gfal2_zenodo_key_is(key, "metadata")) {
+        return gfal2_zenodo_scan_object(s, gfal2_zenodo_metadata_member, state);
+    }
+    if (is_string && gfal2_zenodo_key_is(key, "created")) {
+        ret = gfal2_zenodo_scan_string(s, &value);
+        time_t when = (ret == 0) ? gfal2_zenodo_parse_time(value.start) : -1;
+        if (when > 0)
+            state->entry.ctime = when;
+        return ret;
+    }
+    if (is_string && (gfal2_zenodo_key_is(key, "modified") || gfal2_zenodo_key_is(key, "updated"))) {
+        ret = gfal2_zenodo_scan_string(s, &value);
+        time_t when = (ret == 0) ? gfal2_zenodo_parse_time(value.start) : -1;
+        if (when > 0)
+            state->entry.mtime = when;
+        return ret;
+    }
+    if (is_array && schema != ZenodoListFiles && gfal2_zenodo_key_is(key, "files")) {
+        return gfal2_zenodo_count_array(s, &state->entry.nlink);
+    }
+    if (!is_string && !is_array && !is_object && gfal2_zenodo_key_is(key, "owner")) {
+        ret = gfal2_zenodo_scan_scalar(s, &value);
+        if (ret == 0)
+            state->entry.uid = (guint32)gfal2_zenodo_token_int(&value);
+        return ret;
+    }
+    if (!is_string && !is_array && !is_object && gfal2_zenodo_key_is(key, "filesize")) {
+        ret = gfal2_zenodo_scan_scalar(s, &value);
+        if (ret == 0)
+            state->entry.size = gfal2_zenodo_token_int(&value);
+        return ret;
+    }
+    return gfal2_zenodo_skip_value(s);
+}
+
+
+// Decode one object of the array
+static int gfal2_zenodo_decode_entry(ZenodoScanner* s, ZenodoListing* listing)
+{
+    ZenodoEntryState state;
+    memset(&state, 0, sizeof(state));
+    state.listing = listing;
+
+    if (gfal2_zenodo_scan_object(s, gfal2_zenodo_entry_member, &state) < 0)
+        return -1;
+
+    ZenodoListEntry* entry = &state.entry;
+    if (listing->schema == ZenodoListFiles)
+        entry->nlink = 1;
+
+    // Name, as id:title
+    entry->name = (guint32)listing->names->len;
+    if (state.id.start)
+        gfal2_zenodo_append_token(listing->names, &state.id);
+    if (state.title.start) {
+        g_string_append_c(listing->names, ':');
+        gfal2_zenodo_append_token(listing->names, &state.title);
+    }
+    g_string_append_c(listing->names, '\0');
+
+    if (listing->length == listing->capacity) {
+        listing->capacity = MAX(16, listing->capacity * 2);
+        listing->entries = g_renew(ZenodoListEntry, listing->entries, listing->capacity);
+    }
+    listing->entries[listing->length++] = *entry;
+    return 0;
+}
+
+
+static int gfal2_zenodo_decode_array(ZenodoScanner* s, ZenodoListing* listing)
+{
+    if (!gfal2_zenodo_scan_char(s, '['))
+        return -1;
+    if (gfal2_zenodo_scan_char(s, ']'))
+        return 0;
+    do {
+        if (gfal2_zenodo_decode_entry(s, listing) < 0)
+            return -1;
+    } while (gfal2_zenodo_scan_char(s, ','));
+    return gfal2_zenodo_scan_char(s, ']') ? 0 : -1;
+}
+
+
+// Records come as {"hits": {"hits": [...], ...}, "links": {"next": ...}}
+static int gfal2_zenodo_hits_member(ZenodoScanner* s, const ZenodoToken* key, void* data)
+{
+    if (*s->p == '[' && gfal2_zenodo_key_is(key, "hits"))
+        return gfal2_zenodo_decode_array(s, (ZenodoListing*)data);
+    return gfal2_zenodo_skip_value(s);
+}
+
+
+static int gfal2_zenodo_links_member(ZenodoScanner* s, const ZenodoToken* key, void* data)
+{
+    if (gfal2_zenodo_key_is(key, "next"))
+        ((ZenodoListing*)data)->has_next = 1;
+    return gfal2_zenodo_skip_value(s);
+}
+
+
+static int gfal2_zenodo_envelope_member(ZenodoScanner* s, const ZenodoToken* key, void* data)
+{
+    ZenodoListing* listing = (ZenodoListing*)data;
+    if (*s->p == '{' && gfal2_zenodo_key_is(key, "hits"))
+        return gfal2_zenodo_scan_object(s, gfal2_zenodo_hits_member, listing);
+    if (*s->p == '{' && gfal2_zenodo_key_is(key, "links")) {
+        listing->has_next = 0;
+        return gfal2_zenodo_scan_object(s, gfal2_zenodo_links_member, listing);
+    }
+    return gfal2_zenodo_skip_value(s);
+}
+
+
+int gfal2_zenodo_listing_decode(ZenodoListing* listing, ZenodoListSchema schema,
+        const char* data, size_t size, GError** error)
+{
+    ZenodoScanner s = {data, data + size};
+    int ret;
+
+    memset(listing, 0, sizeof(*listing));
+    listing->schema = schema;
+    listing->has_next = -1;
+    // Names are a few tens of bytes, whatever the size of the entries they come from
+    listing->names = g_string_sized_new(256);
+
+    if (schema == ZenodoListRecords)
+        ret = gfal2_zenodo_scan_object(&s, gfal2_zenodo_envelope_member, listing);
+    else
+        ret = gfal2_zenodo_decode_array(&s, listing);
+
+    if (ret < 0) {
+        gfal2_zenodo_listing_clear(listing);
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                "Could not parse the response at offset %ld", (long)(s.p - data));
+        return -1;
+    }
+    // Pages are kept until closedir, without the room left for more entries
+    listing->entries = g_renew(ZenodoListEntry, listing->entries, listing->length);
+    listing->capacity = listing->length;
+    return 0;
+}
+
+
+void gfal2_zenodo_listing_clear(ZenodoListing* listing)
+{
+    g_free(listing->entries);
+    if (listing->names)
+        g_string_free(listing->names, TRUE);
+    memset(listing, 0, sizeof(*listing));
+}
+
+
+// Header of a packed listing, followed by the entries and the names
+struct ZenodoPackedListing {
+    gint32 schema;
+    gint32 length;
+    gint32 has_next;
+    guint32 names_size;
+};
+
+
+void gfal2_zenodo_listing_pack(const ZenodoListing* listing, GString* out)
+{
+    struct ZenodoPackedListing header;
+    header.schema = listing->schema;
+    header.length = listing->length;
+    header.has_next = listing->has_next;
+    header.names_size = listing->names->len;
+
+    g_string_append_len(out, (const gchar*)&header, sizeof(header));
+    g_string_append_len(out, (const gchar*)listing->entries,
+            sizeof(ZenodoListEntry) * listing->length);
+    g_string_append_len(out, listing->names->str, listing->names->len);
+}
+
+
+int gfal2_zenodo_listing_unpack(ZenodoListing* listing, const char* data, gsize size)
+{
+    struct ZenodoPackedListing header;
+
+    memset(listing, 0, sizeof(*listing));
+    if (size < sizeof(header))
+        return -1;
+    memcpy(&header, data, sizeof(header));
+    gsize entries_size = sizeof(ZenodoListEntry) * (gsize)header.length;
+    if (header.length < 0 || size - sizeof(header) < entries_size + header.names_size)
+        return -1;
+    data += sizeof(header);
+
+    listing->schema = header.schema;
+    listing->length = listing->capacity = header.length;
+    listing->has_next = header.has_next;
+    listing->entries = g_malloc(entries_size);
+    memcpy(listing->entries, data, entries_size);
+    listing->names = g_string_sized_new(header.names_size + 1);
+    g_string_append_len(listing->names, data + entries_size, header.names_size);
+    return 0;
+}
+
+
+struct dirent* gfal2_zenodo_listing_entry(const ZenodoListing* listing, int i,
+        struct dirent* dent, struct stat* st)
+{
+    const ZenodoListEntry* entry = &listing->entries[i];
+
+    memset(st, 0, sizeof(*st));
+    memset(dent, 0, sizeof(*dent));
+
+    if (listing->schema == ZenodoListFiles)
+        st->st_mode = 0640 | S_IFREG;
+    else
+        st->st_mode = 0750 | S_IFDIR;
+    st->st_nlink = entry->nlink;
+    st->st_size = entry->size;
+    st->st_ctime = entry->ctime;
+    st->st_mtime = entry->mtime;
+    st->st_atime = entry->mtime;
+    st->st_uid = entry->uid;
+
+    dent->d_reclen = g_strlcpy(dent->d_name, listing->names->str + entry->name,
+            sizeof(dent->d_name));
+    return dent;
+}
@@ -0,0 +1,79 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_LISTING_H
+#define _GFAL_ZENODO_LISTING_H
+
+#include "gfal_zenodo.h"
+#include "gfal_zenodo_helpers.h"
+
+/*
+ * Decoded page of a listing
+ * Only what readdirpp returns is kept: one fixed size record per entry,
+ * with the names packed one after the other in a single arena
+ */
+struct ZenodoListEntry {
+    gint64 size;
+    gint64 ctime;
+    gint64 mtime;
+    // Offset of the name ("id" or "id:title") in the arena
+    guint32 name;
+    guint32 nlink;
+    guint32 uid;
+};
+typedef struct ZenodoListEntry ZenodoListEntry;
+
+/*
+ * What is being listed: the depositions of the account, the files of a
+ * deposition, or the results of a search of the public records
+ */
+typedef enum {ZenodoListDepositions, ZenodoListFiles, ZenodoListRecords} ZenodoListSchema;
+
+struct ZenodoListing {
+    ZenodoListSchema schema;
+    ZenodoListEntry* entries;
+    int length;
+    int capacity;
+    GString* names;
+    // 1 if the response links to a next page, 0 if it does not, -1 if it did not say
+    int has_next;
+};
+typedef struct ZenodoListing ZenodoListing;
+
+/*
+ * Decode a listing in a single pass, without building a tree
+ * Depositions and files come as a JSON array, records inside a search envelope
+ */
+int gfal2_zenodo_listing_decode(ZenodoListing* listing, ZenodoListSchema schema,
+        const char* data, size_t size, GError** error);
+
+void gfal2_zenodo_listing_clear(ZenodoListing* listing);
+
+/*
+ * Flatten the listing at the end of out, and rebuild it from there, so it can
+ * be kept as a single block and reused without decoding the response again
+ * unpack returns -1 if data is truncated
+ */
+void gfal2_zenodo_listing_pack(const ZenodoListing* listing, GString* out);
+int gfal2_zenodo_listing_unpack(ZenodoListing* listing, const char* data, gsize size);
+
+/*
+ * Fill dent and st from the entry i
+ */
+struct dirent* gfal2_zenodo_listing_entry(const ZenodoListing* listing, int i,
+        struct dirent* dent, struct stat* st);
+
+#endif
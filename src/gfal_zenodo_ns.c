@@ -18,75 +18,302 @@
 
 #include <json.h>
 #include <string.h>
+#include <utils/gfal_uri.h>
 #include "gfal_zenodo.h"
+#include "gfal_zenodo_cache.h"
+#include "gfal_zenodo_etag.h"
 #include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_index.h"
+#include "gfal_zenodo_stats.h"
 
 
 int gfal2_zenodo_stat(plugin_handle plugin_data, const char* url,
         struct stat *buf, GError** error)
 {
+	gfal2_zenodo_stats_call(((ZenodoHandle*)plugin_data)->stats, ZenodoOpStat);
 	GError* tmp_err = NULL;
 	ZenodoResource zr;
 
-	if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+	if (gfal2_zenodo_resource_lookup(plugin_data, &zr, url, &tmp_err) < 0) {
 		gfal2_propagate_prefixed_error(error, tmp_err, __func__);
 		return -1;
 	}
 
-    char buffer[102400];
-    json_object* root;
-    struct dirent dent;
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
 
 	memset(buf, 0, sizeof(*buf));
-	switch(zr.type) {
-		case ZenodoRoot:
-			buf->st_mode = S_IFDIR;
-			break;
-		case ZenodoDeposition:
-            if (gfal2_zenodo_get(plugin_data, buffer, sizeof(buffer), &tmp_err, zr.domain,
-                    "/api/deposit/depositions/%s", zr.deposition) < 0) {
-                gfal2_propagate_prefixed_error(error, tmp_err, __func__);
-                return -1;
-            }
 
-            root = json_tokener_parse(buffer);
-            gfal2_zenodo_deposition_to_stat(root, &dent, buf);
-            json_object_put(root);
+	if (zr.type == ZenodoRoot) {
+		buf->st_mode = S_IFDIR;
+		return 0;
+	}
 
-			break;
-		case ZenodoFile:
-            if (gfal2_zenodo_get(plugin_data, buffer, sizeof(buffer), &tmp_err, zr.domain,
-                    "/api/deposit/depositions/%s/files/%s", zr.deposition, zr.file) < 0) {
-                gfal2_propagate_prefixed_error(error, tmp_err, __func__);
-                return -1;
-            }
+	switch (gfal2_zenodo_cache_get(zenodo->stat_cache, zr.domain, zr.deposition, zr.file, buf)) {
+	    case 1:
+	        return 0;
+	    case -1:
+	        gfal2_set_error(error, zenodo_domain(), ENOENT, __func__, "HTTP Response 404 (cached)");
+	        return -1;
+	}
 
-		    root = json_tokener_parse(buffer);
-            gfal2_zenodo_file_to_stat(root, &dent, buf);
-            json_object_put(root);
+	char full_url[GFAL_URL_MAX_LEN];
+	if (zr.type == ZenodoDeposition)
+	    gfal2_zenodo_format_url(full_url, sizeof(full_url), zr.domain,
+	            "/api/deposit/depositions/%s", zr.deposition);
+	else
+	    gfal2_zenodo_format_url(full_url, sizeof(full_url), zr.domain,
+	            "/api/deposit/depositions/%s/files/%s", zr.deposition, zr.file);
+
+	gpointer cached;
+	gsize cachedsize;
+	ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(zenodo);
+	if (gfal2_zenodo_get_conditional(zenodo, buffer, &cached, &cachedsize, &tmp_err,
+	        zr.domain, full_url) < 0) {
+	    gfal2_zenodo_buffer_release(zenodo, buffer);
+	    if (tmp_err->code == ENOENT)
+	        gfal2_zenodo_cache_put_negative(zenodo->stat_cache, zr.domain, zr.deposition, zr.file);
+	    gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+	    return -1;
+	}
 
-            break;
+	if (cached) {
+	    // Not modified since the last time
+	    memcpy(buf, cached, MIN(cachedsize, sizeof(*buf)));
+	    g_free(cached);
+	}
+	else {
+	    struct dirent dent;
+	    json_object* root = json_tokener_parse(buffer->data);
+	    if (zr.type == ZenodoDeposition)
+	        gfal2_zenodo_deposition_to_stat(root, &dent, buf);
+	    else
+	        gfal2_zenodo_file_to_stat(root, &dent, buf);
+	    json_object_put(root);
+	    gfal2_zenodo_etag_store(zenodo->etag_cache, full_url, buffer, g_memdup(buf, sizeof(*buf)),
+	            sizeof(*buf));
 	}
 
-	return *error ? -1 : 0;
+	gfal2_zenodo_buffer_release(zenodo, buffer);
+	gfal2_zenodo_cache_put(zenodo->stat_cache, zr.domain, zr.deposition, zr.file, buf);
+	return 0;
+}
+
+
+int gfal2_zenodo_bulk_stat(plugin_handle plugin_data, int nbfiles, const char* const* urls,
+        struct stat* stats, GError** errors)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    gfal2_zenodo_stats_call(zenodo->stats, ZenodoOpStat);
+    ZenodoResource* resources = g_new0(ZenodoResource, nbfiles);
+    ZenodoRequest* requests = g_new0(ZenodoRequest, nbfiles);
+    int* owner = g_new(int, nbfiles);
+    int i, nrequests = 0, failed = 0;
+
+    // Resolve what can be answered without going to the server
+    for (i = 0; i < nbfiles; ++i) {
+        ZenodoResource* zr = &resources[i];
+        memset(&stats[i], 0, sizeof(struct stat));
+
+        if (gfal2_zenodo_resource_lookup(zenodo, zr, urls[i], &errors[i]) < 0) {
+            ++failed;
+            continue;
+        }
+        if (zr->type == ZenodoRoot) {
+            stats[i].st_mode = S_IFDIR;
+            continue;
+        }
+        switch (gfal2_zenodo_cache_get(zenodo->stat_cache, zr->domain, zr->deposition, zr->file, &stats[i])) {
+            case 1:
+                continue;
+            case -1:
+                gfal2_set_error(&errors[i], zenodo_domain(), ENOENT, __func__, "HTTP Response 404 (cached)");
+                ++failed;
+                continue;
+        }
+
+        ZenodoRequest* request = &requests[nrequests];
+        request->method = "GET";
+        request->domain = zr->domain;
+        request->conditional = TRUE;
+        if (zr->type == ZenodoDeposition)
+            gfal2_zenodo_format_url(request->url, sizeof(request->url), zr->domain,
+                    "/api/deposit/depositions/%s", zr->deposition);
+        else
+            gfal2_zenodo_format_url(request->url, sizeof(request->url), zr->domain,
+                    "/api/deposit/depositions/%s/files/%s", zr->deposition, zr->file);
+        owner[nrequests++] = i;
+    }
+
+    // And fetch the rest concurrently
+    gfal2_zenodo_multi_perform(zenodo, requests, nrequests, 0);
+
+    for (i = 0; i < nrequests; ++i) {
+        ZenodoRequest* request = &requests[i];
+        ZenodoResource* zr = &resources[owner[i]];
+        struct stat* st = &stats[owner[i]];
+
+        if (request->error) {
+            if (request->error->code == ENOENT)
+                gfal2_zenodo_cache_put_negative(zenodo->stat_cache, zr->domain, zr->deposition, zr->file);
+            gfal2_propagate_prefixed_error(&errors[owner[i]], request->error, __func__);
+            ++failed;
+        }
+        else if (request->response == 304) {
+            gsize cachedsize;
+            gpointer cached = gfal2_zenodo_etag_reuse(zenodo->etag_cache, request->url, &cachedsize);
+            if (cached) {
+                memcpy(st, cached, MIN(cachedsize, sizeof(*st)));
+                g_free(cached);
+                gfal2_zenodo_cache_put(zenodo->stat_cache, zr->domain, zr->deposition, zr->file, st);
+            }
+            // Forgotten meanwhile, which a single stat handles
+            else if (gfal2_zenodo_stat(zenodo, urls[owner[i]], st, &errors[owner[i]]) < 0) {
+                ++failed;
+            }
+        }
+        else {
+            struct dirent dent;
+            json_object* root = json_tokener_parse(request->buffer->data);
+            if (zr->type == ZenodoDeposition)
+                gfal2_zenodo_deposition_to_stat(root, &dent, st);
+            else
+                gfal2_zenodo_file_to_stat(root, &dent, st);
+            json_object_put(root);
+            gfal2_zenodo_etag_store(zenodo->etag_cache, request->url, request->buffer,
+                    g_memdup(st, sizeof(*st)), sizeof(*st));
+            gfal2_zenodo_cache_put(zenodo->stat_cache, zr->domain, zr->deposition, zr->file, st);
+        }
+        gfal2_zenodo_buffer_release(zenodo, request->buffer);
+    }
+
+    g_free(owner);
+    g_free(requests);
+    g_free(resources);
+    return failed ? -1 : 0;
+}
+
+
+int gfal2_zenodo_create_deposition(plugin_handle plugin_data, const char* domain,
+        const char* title, char* name, size_t namesize, GError** error)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    gfal2_zenodo_stats_call(zenodo->stats, ZenodoOpOther);
+    GError* tmp_err = NULL;
+
+    json_object* request = json_object_new_object();
+    json_object* metadata = json_object_new_object();
+    json_object_object_add(metadata, "title", json_object_new_string(title));
+    json_object_object_add(request, "metadata", metadata);
+    const char* body = json_object_to_json_string(request);
+
+    ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(zenodo);
+    ssize_t ret = gfal2_zenodo_post(zenodo, buffer, &tmp_err, domain, body, strlen(body),
+            "/api/deposit/depositions");
+    json_object_put(request);
+
+    if (ret < 0) {
+        gfal2_zenodo_buffer_release(zenodo, buffer);
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+
+    json_object* root = json_tokener_parse(buffer->data);
+    gfal2_zenodo_buffer_release(zenodo, buffer);
+    json_object* id = NULL;
+    if (!root || !json_object_object_get_ex(root, "id", &id)) {
+        json_object_put(root);
+        gfal2_set_error(error, zenodo_domain(), EIO, __func__,
+                "Could not find the id of the new deposition");
+        return -1;
+    }
+
+    struct dirent dent;
+    struct stat st;
+    char deposition[64];
+    gfal2_zenodo_deposition_to_stat(root, &dent, &st);
+    snprintf(deposition, sizeof(deposition), "%d", json_object_get_int(id));
+    gfal2_zenodo_cache_put(zenodo->stat_cache, domain, deposition, "", &st);
+    gfal2_zenodo_index_put(zenodo->name_index, domain, NULL, title, deposition);
+    if (name)
+        g_strlcpy(name, dent.d_name, namesize);
+    json_object_put(root);
+
+    gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo created the deposition %s", dent.d_name);
+    return 0;
 }
 
 
 int gfal2_zenodo_mkdir(plugin_handle plugin_data, const char* url, mode_t mode,
         gboolean rec_flag, GError** error)
 {
-	gfal2_set_error(error, zenodo_domain(), ENOSYS, __func__, "Not implemented");
-    return -1;
+	GError* tmp_err = NULL;
+	ZenodoResource zr;
+
+	if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+		gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+		return -1;
+	}
+
+	switch (zr.type) {
+	    case ZenodoRoot:
+	        gfal2_set_error(error, zenodo_domain(), EEXIST, __func__, "The root always exists");
+	        return -1;
+	    case ZenodoFile:
+	        gfal2_set_error(error, zenodo_domain(), EPERM, __func__,
+	                "Directories can only be created at the root, as depositions");
+	        return -1;
+	    default:
+	        break;
+	}
+
+	// Ids are given by the server, so one in the url can only be an existing deposition
+	if (zr.deposition[0]) {
+	    struct stat st;
+	    if (gfal2_zenodo_stat(plugin_data, url, &st, &tmp_err) == 0) {
+	        gfal2_set_error(error, zenodo_domain(), EEXIST, __func__,
+	                "The deposition %s already exists", zr.deposition);
+	        return -1;
+	    }
+	    if (tmp_err->code == ENOENT) {
+	        g_clear_error(&tmp_err);
+	        gfal2_set_error(error, zenodo_domain(), ENOENT, __func__,
+	                "The deposition %s does not exist, and ids can not be chosen. "
+	                "Create it by title instead", zr.deposition);
+	        return -1;
+	    }
+	    gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+	    return -1;
+	}
+
+	// A title that resolves is an existing deposition
+	if (gfal2_zenodo_resource_resolve(plugin_data, &zr, FALSE, &tmp_err) == 0) {
+	    gfal2_set_error(error, zenodo_domain(), EEXIST, __func__,
+	            "There is already a deposition titled %s", zr.deposition_name);
+	    return -1;
+	}
+	if (tmp_err->code != ENOENT) {
+	    gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+	    return -1;
+	}
+	g_clear_error(&tmp_err);
+
+	if (gfal2_zenodo_create_deposition(plugin_data, zr.domain, zr.deposition_name, NULL, 0,
+	        &tmp_err) < 0) {
+	    gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+	    return -1;
+	}
+    return 0;
 }
 
 
 int gfal2_zenodo_rmdir(plugin_handle plugin_data, const char* url,
         GError** error)
 {
+    gfal2_zenodo_stats_call(((ZenodoHandle*)plugin_data)->stats, ZenodoOpDelete);
     GError* tmp_err = NULL;
     ZenodoResource zr;
 
-    if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+    if (gfal2_zenodo_resource_lookup(plugin_data, &zr, url, &tmp_err) < 0) {
         gfal2_propagate_prefixed_error(error, tmp_err, __func__);
         return -1;
     }
@@ -96,9 +323,16 @@ int gfal2_zenodo_rmdir(plugin_handle plugin_data, const char* url,
         return -1;
     }
 
-    char buffer[512];
-    if (gfal2_zenodo_delete(plugin_data, buffer, sizeof(buffer), &tmp_err, zr.domain,
-            "/api/deposit/depositions/%s", zr.deposition) < 0) {
+    ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(plugin_data);
+    ssize_t ret = gfal2_zenodo_delete(plugin_data, buffer, &tmp_err, zr.domain,
+            "/api/deposit/depositions/%s", zr.deposition);
+    gfal2_zenodo_buffer_release(plugin_data, buffer);
+    gfal2_zenodo_cache_invalidate(((ZenodoHandle*)plugin_data)->stat_cache,
+            zr.domain, zr.deposition, NULL);
+    gfal2_zenodo_index_forget(((ZenodoHandle*)plugin_data)->name_index,
+            zr.domain, NULL, zr.deposition);
+
+    if (ret < 0) {
         gfal2_propagate_prefixed_error(error, tmp_err, __func__);
         return -1;
     }
@@ -110,10 +344,11 @@ int gfal2_zenodo_rmdir(plugin_handle plugin_data, const char* url,
 int gfal2_zenodo_unlink(plugin_handle plugin_data, const char* url,
         GError** error)
 {
+    gfal2_zenodo_stats_call(((ZenodoHandle*)plugin_data)->stats, ZenodoOpDelete);
     GError* tmp_err = NULL;
     ZenodoResource zr;
 
-    if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+    if (gfal2_zenodo_resource_lookup(plugin_data, &zr, url, &tmp_err) < 0) {
         gfal2_propagate_prefixed_error(error, tmp_err, __func__);
         return -1;
     }
@@ -123,9 +358,16 @@ int gfal2_zenodo_unlink(plugin_handle plugin_data, const char* url,
         return -1;
     }
 
-    char buffer[512];
-    if (gfal2_zenodo_delete(plugin_data, buffer, sizeof(buffer), &tmp_err, zr.domain,
-            "/api/deposit/depositions/%s/files/%s", zr.deposition, zr.file) < 0) {
+    ZenodoBuffer* buffer = gfal2_zenodo_buffer_acquire(plugin_data);
+    ssize_t ret = gfal2_zenodo_delete(plugin_data, buffer, &tmp_err, zr.domain,
+            "/api/deposit/depositions/%s/files/%s", zr.deposition, zr.file);
+    gfal2_zenodo_buffer_release(plugin_data, buffer);
+    gfal2_zenodo_cache_invalidate(((ZenodoHandle*)plugin_data)->stat_cache,
+            zr.domain, zr.deposition, zr.file);
+    gfal2_zenodo_index_forget(((ZenodoHandle*)plugin_data)->name_index,
+            zr.domain, zr.deposition, zr.file);
+
+    if (ret < 0) {
         gfal2_propagate_prefixed_error(error, tmp_err, __func__);
         return -1;
     }
@@ -134,9 +376,116 @@ int gfal2_zenodo_unlink(plugin_handle plugin_data, const char* url,
 }
 
 
+int gfal2_zenodo_unlink_list(plugin_handle plugin_data, int nbfiles, const char* const* uris,
+        GError** errors)
+{
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    gfal2_zenodo_stats_call(zenodo->stats, ZenodoOpDelete);
+    ZenodoResource* resources = g_new0(ZenodoResource, nbfiles);
+    ZenodoRequest* requests = g_new0(ZenodoRequest, nbfiles);
+    int* owner = g_new(int, nbfiles);
+    int i, nrequests = 0, failed = 0;
+
+    for (i = 0; i < nbfiles; ++i) {
+        ZenodoResource* zr = &resources[i];
+
+        if (gfal2_zenodo_resource_lookup(zenodo, zr, uris[i], &errors[i]) < 0) {
+            ++failed;
+            continue;
+        }
+        if (zr->type != ZenodoFile) {
+            gfal2_set_error(&errors[i], zenodo_domain(), EISDIR, __func__, "unlink can only be called on a file");
+            ++failed;
+            continue;
+        }
+
+        ZenodoRequest* request = &requests[nrequests];
+        request->method = "DELETE";
+        request->domain = zr->domain;
+        gfal2_zenodo_format_url(request->url, sizeof(request->url), zr->domain,
+                "/api/deposit/depositions/%s/files/%s", zr->deposition, zr->file);
+        owner[nrequests++] = i;
+    }
+
+    gfal2_zenodo_multi_perform(zenodo, requests, nrequests, 0);
+
+    for (i = 0; i < nrequests; ++i) {
+        ZenodoRequest* request = &requests[i];
+        ZenodoResource* zr = &resources[owner[i]];
+
+        gfal2_zenodo_cache_invalidate(zenodo->stat_cache, zr->domain, zr->deposition, zr->file);
+        gfal2_zenodo_index_forget(zenodo->name_index, zr->domain, zr->deposition, zr->file);
+        if (request->error) {
+            gfal2_propagate_prefixed_error(&errors[owner[i]], request->error, __func__);
+            ++failed;
+        }
+        gfal2_zenodo_buffer_release(zenodo, request->buffer);
+    }
+
+    g_free(owner);
+    g_free(requests);
+    g_free(resources);
+    return failed ? -1 : 0;
+}
+
+
 int gfal2_zenodo_rename(plugin_handle plugin_data, const char * oldurl,
         const char * urlnew, GError** error)
 {
 	gfal2_set_error(error, zenodo_domain(), EPERM, __func__, "Rename operation not supported");
     return -1;
 }
+
+
+ssize_t gfal2_zenodo_getxattr(plugin_handle plugin_data, const char* url, const char* key,
+        void* buff, size_t s_buff, GError** error)
+{
+    GError* tmp_err = NULL;
+    ZenodoResource zr;
+
+    if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+    if (zr.type != ZenodoRoot || strcmp(key, ZENODO_STATS_XATTR) != 0) {
+        gfal2_set_error(error, zenodo_domain(), ENODATA, __func__, "Attribute %s not found", key);
+        return -1;
+    }
+
+    ZenodoHandle* zenodo = (ZenodoHandle*)plugin_data;
+    gchar* value = gfal2_zenodo_stats_json(zenodo->stats);
+    size_t len = strlen(value);
+
+    // A 0 sized buffer asks for the size
+    if (s_buff > 0) {
+        if (s_buff <= len) {
+            g_free(value);
+            gfal2_set_error(error, zenodo_domain(), ERANGE, __func__,
+                    "The buffer is too small for %s", key);
+            return -1;
+        }
+        memcpy(buff, value, len + 1);
+    }
+    g_free(value);
+    return (ssize_t)len;
+}
+
+
+ssize_t gfal2_zenodo_listxattr(plugin_handle plugin_data, const char* url,
+        char* list, size_t s_list, GError** error)
+{
+    GError* tmp_err = NULL;
+    ZenodoResource zr;
+
+    if (gfal2_zenodo_resource_from_uri(&zr, url, &tmp_err) < 0) {
+        gfal2_propagate_prefixed_error(error, tmp_err, __func__);
+        return -1;
+    }
+    if (zr.type != ZenodoRoot)
+        return 0;
+
+    size_t len = sizeof(ZENODO_STATS_XATTR);
+    if (s_list >= len)
+        memcpy(list, ZENODO_STATS_XATTR, len);
+    return (ssize_t)len;
+}
@@ -0,0 +1,250 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Retries with backoff, and client side rate limiting
+
+#include <stdlib.h>
+#include <string.h>
+#include "gfal_zenodo_helpers.h"
+#include "gfal_zenodo_retry.h"
+
+
+struct ZenodoRateLimiter {
+    GMutex lock;
+
+    // Token bucket, disabled if rate is 0
+    double rate;
+    double burst;
+    double tokens;
+    gint64 last_refill;
+
+    // Nothing goes out before this (real time, microseconds)
+    gint64 blocked_until;
+
+    // Retry policy
+    int retry_max;
+    gint64 base_delay;
+    gint64 max_delay;
+    int resume_max;
+};
+
+
+ZenodoRateLimiter* gfal2_zenodo_rate_new(gfal2_context_t context)
+{
+    ZenodoRateLimiter* limiter = g_new0(ZenodoRateLimiter, 1);
+    g_mutex_init(&limiter->lock);
+
+    limiter->rate = gfal2_get_opt_integer_with_default(context, "ZENODO", "RATE_LIMIT",
+            ZENODO_RATE_LIMIT_DEFAULT);
+    limiter->burst = gfal2_get_opt_integer_with_default(context, "ZENODO", "RATE_BURST",
+            (int)limiter->rate);
+    if (limiter->burst < 1)
+        limiter->burst = 1;
+    limiter->tokens = limiter->burst;
+    limiter->last_refill = g_get_monotonic_time();
+
+    limiter->retry_max = gfal2_get_opt_integer_with_default(context, "ZENODO", "RETRY_MAX",
+            ZENODO_RETRY_MAX_DEFAULT);
+    limiter->base_delay = gfal2_get_opt_integer_with_default(context, "ZENODO", "RETRY_BASE_DELAY",
+            ZENODO_RETRY_BASE_DELAY_DEFAULT) * 1000;
+    limiter->max_delay = gfal2_get_opt_integer_with_default(context, "ZENODO", "RETRY_MAX_DELAY",
+            ZENODO_RETRY_MAX_DELAY_DEFAULT) * 1000;
+    if (limiter->base_delay <= 0)
+        limiter->base_delay = 1000;
+    if (limiter->max_delay < limiter->base_delay)
+        limiter->max_delay = limiter->base_delay;
+    limiter->resume_max = gfal2_get_opt_integer_with_default(context, "ZENODO",
+            "DOWNLOAD_RESUME_MAX", ZENODO_DOWNLOAD_RESUME_MAX_DEFAULT);
+
+    return limiter;
+}
+
+
+void gfal2_zenodo_rate_free(ZenodoRateLimiter* limiter)
+{
+    if (!limiter)
+        return;
+    g_mutex_clear(&limiter->lock);
+    g_free(limiter);
+}
+
+
+void gfal2_zenodo_rate_acquire(ZenodoRateLimiter* limiter)
+{
+    gint64 wait;
+
+    g_mutex_lock(&limiter->lock);
+    for (;;) {
+        gint64 now = g_get_monotonic_time();
+        gint64 real_now = g_get_real_time();
+
+        if (limiter->blocked_until > real_now) {
+            wait = limiter->blocked_until - real_now;
+        }
+        else if (limiter->rate <= 0) {
+            break;
+        }
+        else {
+            limiter->tokens += (now - limiter->last_refill) * limiter->rate / G_USEC_PER_SEC;
+            if (limiter->tokens > limiter->burst)
+                limiter->tokens = limiter->burst;
+            limiter->last_refill = now;
+
+            if (limiter->tokens >= 1) {
+                limiter->tokens -= 1;
+                break;
+            }
+            wait = (1 - limiter->tokens) * G_USEC_PER_SEC / limiter->rate;
+        }
+
+        g_mutex_unlock(&limiter->lock);
+        g_usleep(wait);
+        g_mutex_lock(&limiter->lock);
+    }
+    g_mutex_unlock(&limiter->lock);
+}
+
+
+// Hold back every request until the given real time
+static void gfal2_zenodo_rate_block(ZenodoRateLimiter* limiter, gint64 until)
+{
+    g_mutex_lock(&limiter->lock);
+    if (until > limiter->blocked_until)
+        limiter->blocked_until = until;
+    g_mutex_unlock(&limiter->lock);
+}
+
+
+// Retry-After is either a number of seconds or an HTTP date
+static gint64 gfal2_zenodo_parse_retry_after(const char* value)
+{
+    char* end;
+    long seconds = strtol(value, &end, 10);
+    if (end != value && *end == '\0')
+        return seconds > 0 ? seconds * G_USEC_PER_SEC : 0;
+
+    time_t date = curl_getdate(value, NULL);
+    if (date < 0)
+        return 0;
+    gint64 delay = (gint64)date * G_USEC_PER_SEC - g_get_real_time();
+    return delay > 0 ? delay : 0;
+}
+
+
+void gfal2_zenodo_retry_init(ZenodoRetry* retry, gboolean idempotent)
+{
+    memset(retry, 0, sizeof(*retry));
+    retry->idempotent = idempotent;
+}
+
+
+void gfal2_zenodo_retry_attempt(ZenodoRateLimiter* limiter, ZenodoRetry* retry,
+        long response, CURLcode result, const struct ZenodoBuffer* buffer)
+{
+    char value[128];
+
+    retry->response = response;
+    retry->result = result;
+    retry->retry_after = 0;
+    if (!buffer)
+        return;
+
+    if (gfal2_zenodo_buffer_header(buffer, "Retry-After", value, sizeof(value)) == 0) {
+        retry->retry_after = gfal2_zenodo_parse_retry_after(value);
+        // A throttled request means everybody else should slow down too
+        if (response == 429 || response == 503)
+            gfal2_zenodo_rate_block(limiter, g_get_real_time() + retry->retry_after);
+    }
+
+    // The quota is spent, wait until the window resets
+    if (gfal2_zenodo_buffer_header(buffer, "X-RateLimit-Remaining", value, sizeof(value)) == 0 &&
+        atol(value) <= 0 &&
+        gfal2_zenodo_buffer_header(buffer, "X-RateLimit-Reset", value, sizeof(value)) == 0) {
+        gint64 reset = atoll(value) * G_USEC_PER_SEC;
+        gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo rate limit reached, holding requests for %lld ms",
+                (long long)((reset - g_get_real_time()) / 1000));
+        gfal2_zenodo_rate_block(limiter, reset);
+    }
+}
+
+
+gint64 gfal2_zenodo_retry_delay(ZenodoRateLimiter* limiter, ZenodoRetry* retry)
+{
+    gboolean transient;
+
+    switch (retry->result) {
+        // The request never reached the server
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+            transient = TRUE;
+            break;
+        // The connection broke, the server may have processed it
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+            transient = retry->idempotent;
+            break;
+        case CURLE_OK:
+            if (retry->response == 429 || retry->response == 503)
+                transient = TRUE;
+            else if (retry->response == 502 || retry->response == 504)
+                transient = retry->idempotent;
+            else
+                transient = FALSE;
+            break;
+        default:
+            transient = FALSE;
+    }
+
+    if (!transient || retry->attempts >= limiter->retry_max)
+        return -1;
+
+    // Exponential backoff with jitter, unless the server asked for longer
+    gint64 cap = limiter->base_delay << MIN(retry->attempts, 20);
+    if (cap > limiter->max_delay)
+        cap = limiter->max_delay;
+    gint64 delay = cap / 2 + (gint64)(g_random_double() * (cap / 2));
+    if (retry->retry_after > delay)
+        delay = retry->retry_after;
+
+    ++retry->attempts;
+    return delay;
+}
+
+
+gboolean gfal2_zenodo_retry_resume(ZenodoRateLimiter* limiter, ZenodoRetry* retry,
+        size_t received)
+{
+    switch (retry->result) {
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_RECV_ERROR:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            break;
+        default:
+            return FALSE;
+    }
+
+    if (received == 0 || retry->resumes >= limiter->resume_max)
+        return FALSE;
+    ++retry->resumes;
+    return TRUE;
+}
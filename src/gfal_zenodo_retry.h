@@ -0,0 +1,87 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_RETRY_H
+#define _GFAL_ZENODO_RETRY_H
+
+#include "gfal_zenodo.h"
+
+struct ZenodoBuffer;
+
+/*
+ * Retry policy and client side rate limiting, shared by all the threads using a handle
+ * Requests are paced by a token bucket of RATE_LIMIT requests per second, and
+ * held back altogether while the server says the quota is exhausted
+ */
+#define ZENODO_RETRY_MAX_DEFAULT 5
+#define ZENODO_RETRY_BASE_DELAY_DEFAULT 500
+#define ZENODO_RETRY_MAX_DELAY_DEFAULT 30000
+#define ZENODO_RATE_LIMIT_DEFAULT 0
+#define ZENODO_DOWNLOAD_RESUME_MAX_DEFAULT 10
+
+typedef struct ZenodoRateLimiter ZenodoRateLimiter;
+
+ZenodoRateLimiter* gfal2_zenodo_rate_new(gfal2_context_t context);
+void gfal2_zenodo_rate_free(ZenodoRateLimiter* limiter);
+
+/*
+ * Block until a request can be sent
+ */
+void gfal2_zenodo_rate_acquire(ZenodoRateLimiter* limiter);
+
+/*
+ * State of a request across its attempts
+ */
+struct ZenodoRetry {
+    // Non idempotent requests are only retried if the server did not process them
+    gboolean idempotent;
+    int attempts;
+    // Downloads continued from where they broke, not counted in attempts
+    int resumes;
+    gboolean token_refreshed;
+    gint64 started;
+
+    // Outcome of the last attempt
+    long response;
+    CURLcode result;
+    // In microseconds, 0 if the server did not say
+    gint64 retry_after;
+};
+typedef struct ZenodoRetry ZenodoRetry;
+
+void gfal2_zenodo_retry_init(ZenodoRetry* retry, gboolean idempotent);
+
+/*
+ * Record the outcome of an attempt, and feed the rate limiting headers to the limiter
+ */
+void gfal2_zenodo_retry_attempt(ZenodoRateLimiter* limiter, ZenodoRetry* retry,
+        long response, CURLcode result, const struct ZenodoBuffer* buffer);
+
+/*
+ * Returns how long to wait before the next attempt, in microseconds,
+ * or -1 if the failure is not transient or there are no attempts left
+ */
+gint64 gfal2_zenodo_retry_delay(ZenodoRateLimiter* limiter, ZenodoRetry* retry);
+
+/*
+ * After a download broke, tell if it can continue from the last byte
+ * received, without waiting. Only transfers that made progress (received
+ * bytes in the last attempt) are resumed, up to DOWNLOAD_RESUME_MAX times
+ */
+gboolean gfal2_zenodo_retry_resume(ZenodoRateLimiter* limiter, ZenodoRetry* retry,
+        size_t received);
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Persistent metadata cache
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gfal_zenodo_statmap.h"
+
+#define ZENODO_STAT_MAP_MAGIC "ZSTATMAP"
+#define ZENODO_STAT_MAP_VERSION 1
+// Deposition and file ids are short, longer keys are not persisted
+#define ZENODO_STAT_MAP_KEY_SIZE 96
+// An entry lives in one of this many slots after the one its hash points to
+#define ZENODO_STAT_MAP_PROBES 8
+
+
+struct ZenodoStatMapHeader {
+    char magic[8];
+    guint32 version;
+    guint32 slots;
+    guint32 record_size;
+    guint32 reserved;
+};
+typedef struct ZenodoStatMapHeader ZenodoStatMapHeader;
+
+
+struct ZenodoStatRecord {
+    // Hash of the key, 0 if the slot is free. Written last
+    guint32 hash;
+    guint32 negative;
+    // Wall clock, in microseconds
+    gint64 expires;
+    gint64 size;
+    gint64 atime;
+    gint64 mtime;
+    gint64 ctime;
+    guint32 mode;
+    guint32 nlink;
+    guint32 uid;
+    guint32 gid;
+    char key[ZENODO_STAT_MAP_KEY_SIZE];
+};
+typedef struct ZenodoStatRecord ZenodoStatRecord;
+
+
+// Mapped file of a domain
+struct ZenodoStatMapFile {
+    int fd;
+    void* base;
+    size_t length;
+    guint32 slots;
+    ZenodoStatRecord* records;
+};
+typedef struct ZenodoStatMapFile ZenodoStatMapFile;
+
+
+struct ZenodoStatMap {
+    char* directory;
+    guint32 slots;
+    // Domain to ZenodoStatMapFile, NULL if it could not be opened
+    GHashTable* files;
+};
+
+
+static void gfal2_zenodo_statmap_close(gpointer data)
+{
+    ZenodoStatMapFile* mf = (ZenodoStatMapFile*)data;
+    if (!mf)
+        return;
+    munmap(mf->base, mf->length);
+    close(mf->fd);
+    g_free(mf);
+}
+
+
+ZenodoStatMap* gfal2_zenodo_statmap_new(gfal2_context_t context)
+{
+    gchar* directory = gfal2_get_opt_string(context, "ZENODO", "STAT_CACHE_DIR", NULL);
+    if (!directory || !directory[0]) {
+        g_free(directory);
+        return NULL;
+    }
+
+    // Entries belong to an account, so keep them private
+    if (g_mkdir_with_parents(directory, 0700) < 0) {
+        gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo can not create the stat cache %s: %s",
+                directory, strerror(errno));
+        g_free(directory);
+        return NULL;
+    }
+
+    ZenodoStatMap* map = g_new0(ZenodoStatMap, 1);
+    map->directory = directory;
+    map->slots = gfal2_get_opt_integer_with_default(context, "ZENODO", "STAT_CACHE_SLOTS",
+            ZENODO_STAT_MAP_SLOTS_DEFAULT);
+    if (map->slots < ZENODO_STAT_MAP_PROBES)
+        map->slots = ZENODO_STAT_MAP_PROBES;
+    map->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, gfal2_zenodo_statmap_close);
+
+    gfal_log(GFAL_VERBOSE_VERBOSE, "Zenodo persistent stat cache in %s", directory);
+    return map;
+}
+
+
+void gfal2_zenodo_statmap_free(ZenodoStatMap* map)
+{
+    if (!map)
+        return;
+    g_hash_table_destroy(map->files);
+    g_free(map->directory);
+    g_free(map);
+}
+
+
+// Open and map the file of a domain, laying it out if it is new
+// Files created with another number of slots are used as they are
+static ZenodoStatMapFile* gfal2_zenodo_statmap_open(ZenodoStatMap* map, const char* domain)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.stat", map->directory, domain);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo can not open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    ZenodoStatMapHeader header;
+    struct stat st;
+    const char* problem = NULL;
+
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) < 0) {
+        problem = strerror(errno);
+    }
+    else if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ZENODO_STAT_MAP_MAGIC, sizeof(header.magic));
+        header.version = ZENODO_STAT_MAP_VERSION;
+        header.slots = map->slots;
+        header.record_size = sizeof(ZenodoStatRecord);
+        // The file is sparse, slots only take space once used
+        if (ftruncate(fd, sizeof(header) + (off_t)header.slots * sizeof(ZenodoStatRecord)) < 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+            problem = strerror(errno);
+    }
+    else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+             memcmp(header.magic, ZENODO_STAT_MAP_MAGIC, sizeof(header.magic)) != 0 ||
+             header.version != ZENODO_STAT_MAP_VERSION ||
+             header.record_size != sizeof(ZenodoStatRecord) ||
+             header.slots < ZENODO_STAT_MAP_PROBES ||
+             st.st_size != sizeof(header) + (off_t)header.slots * sizeof(ZenodoStatRecord)) {
+        problem = "unexpected layout";
+    }
+    flock(fd, LOCK_UN);
+
+    if (problem) {
+        gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo can not use %s: %s", path, problem);
+        close(fd);
+        return NULL;
+    }
+
+    ZenodoStatMapFile* mf = g_new0(ZenodoStatMapFile, 1);
+    mf->fd = fd;
+    mf->slots = header.slots;
+    mf->length = sizeof(header) + (size_t)header.slots * sizeof(ZenodoStatRecord);
+    mf->base = mmap(NULL, mf->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mf->base == MAP_FAILED) {
+        gfal_log(GFAL_VERBOSE_NORMAL, "Zenodo can not map %s: %s", path, strerror(errno));
+        close(fd);
+        g_free(mf);
+        return NULL;
+    }
+    mf->records = (ZenodoStatRecord*)((char*)mf->base + sizeof(header));
+    return mf;
+}
+
+
+// Mapped file of the domain, opened on first use
+static ZenodoStatMapFile* gfal2_zenodo_statmap_file(ZenodoStatMap* map, const char* domain)
+{
+    gpointer mf;
+    if (g_hash_table_lookup_extended(map->files, domain, NULL, &mf))
+        return mf;
+
+    mf = NULL;
+    if (domain[0] && domain[0] != '.' && !strchr(domain, '/'))
+        mf = gfal2_zenodo_statmap_open(map, domain);
+    // Failures are remembered too, not to try again on each call
+    g_hash_table_insert(map->files, g_strdup(domain), mf);
+    return mf;
+}
+
+
+// Returns the hash of the key, 0 if it can not be persisted
+static guint32 gfal2_zenodo_statmap_key(char* key, const char* deposition, const char* file)
+{
+    int len = snprintf(key, ZENODO_STAT_MAP_KEY_SIZE, "%s/%s", deposition, file ? file : "");
+    if (len >= ZENODO_STAT_MAP_KEY_SIZE)
+        return 0;
+    guint32 hash = g_str_hash(key);
+    return hash ? hash : 1;
+}
+
+
+static ZenodoStatRecord* gfal2_zenodo_statmap_find(ZenodoStatMapFile* mf, guint32 hash,
+        const char* key)
+{
+    int i;
+    for (i = 0; i < ZENODO_STAT_MAP_PROBES; ++i) {
+        ZenodoStatRecord* record = &mf->records[(hash + i) % mf->slots];
+        if (record->hash == hash && strncmp(record->key, key, ZENODO_STAT_MAP_KEY_SIZE) == 0)
+            return record;
+    }
+    return NULL;
+}
+
+
+int gfal2_zenodo_statmap_get(ZenodoStatMap* map, const char* domain,
+        const char* deposition, const char* file, struct stat* st, gint64* ttl)
+{
+    char key[ZENODO_STAT_MAP_KEY_SIZE];
+    guint32 hash = gfal2_zenodo_statmap_key(key, deposition, file);
+    ZenodoStatMapFile* mf = gfal2_zenodo_statmap_file(map, domain);
+    if (!hash || !mf)
+        return 0;
+
+    int ret = 0;
+    gint64 now = g_get_real_time();
+
+    flock(mf->fd, LOCK_SH);
+    ZenodoStatRecord* record = gfal2_zenodo_statmap_find(mf, hash, key);
+    if (record && record->expires > now) {
+        *ttl = record->expires - now;
+        if (record->negative) {
+            ret = -1;
+        }
+        else {
+            memset(st, 0, sizeof(*st));
+            st->st_mode = record->mode;
+            st->st_nlink = record->nlink;
+            st->st_uid = record->uid;
+            st->st_gid = record->gid;
+            st->st_size = record->size;
+            st->st_atime = record->atime;
+            st->st_mtime = record->mtime;
+            st->st_ctime = record->ctime;
+            ret = 1;
+        }
+    }
+    flock(mf->fd, LOCK_UN);
+
+    return ret;
+}
+
+
+void gfal2_zenodo_statmap_put(ZenodoStatMap* map, const char* domain,
+        const char* deposition, const char* file, const struct stat* st, gint64 ttl)
+{
+    char key[ZENODO_STAT_MAP_KEY_SIZE];
+    guint32 hash = gfal2_zenodo_statmap_key(key, deposition, file);
+    ZenodoStatMapFile* mf = gfal2_zenodo_statmap_file(map, domain);
+    if (!hash || !mf)
+        return;
+
+    gint64 now = g_get_real_time();
+
+    flock(mf->fd, LOCK_EX);
+    // Same key, else a free or expired slot, else the one closest to expire
+    ZenodoStatRecord* record = gfal2_zenodo_statmap_find(mf, hash, key);
+    int i;
+    for (i = 0; !record && i < ZENODO_STAT_MAP_PROBES; ++i) {
+        ZenodoStatRecord* candidate = &mf->records[(hash + i) % mf->slots];
+        if (candidate->hash == 0 || candidate->expires <= now)
+            record = candidate;
+    }
+    for (i = 0; !record && i < ZENODO_STAT_MAP_PROBES; ++i) {
+        ZenodoStatRecord* candidate = &mf->records[(hash + i) % mf->slots];
+        if (!record || candidate->expires < record->expires)
+            record = candidate;
+    }
+
+    // A writer that dies half way leaves a free slot
+    record->hash = 0;
+    memset((char*)record + sizeof(record->hash), 0, sizeof(*record) - sizeof(record->hash));
+    record->expires = now + ttl;
+    if (st) {
+        record->mode = st->st_mode;
+        record->nlink = st->st_nlink;
+        record->uid = st->st_uid;
+        record->gid = st->st_gid;
+        record->size = st->st_size;
+        record->atime = st->st_atime;
+        record->mtime = st->st_mtime;
+        record->ctime = st->st_ctime;
+    }
+    else {
+        record->negative = 1;
+    }
+    g_strlcpy(record->key, key, sizeof(record->key));
+    __sync_synchronize();
+    record->hash = hash;
+    flock(mf->fd, LOCK_UN);
+}
+
+
+void gfal2_zenodo_statmap_invalidate(ZenodoStatMap* map, const char* domain,
+        const char* deposition, const char* file)
+{
+    char key[ZENODO_STAT_MAP_KEY_SIZE];
+    ZenodoStatMapFile* mf = gfal2_zenodo_statmap_file(map, domain);
+    if (!mf)
+        return;
+
+    flock(mf->fd, LOCK_EX);
+
+    guint32 hash = gfal2_zenodo_statmap_key(key, deposition, NULL);
+    ZenodoStatRecord* record = hash ? gfal2_zenodo_statmap_find(mf, hash, key) : NULL;
+    if (record)
+        record->hash = 0;
+
+    if (file && file[0]) {
+        hash = gfal2_zenodo_statmap_key(key, deposition, file);
+        record = hash ? gfal2_zenodo_statmap_find(mf, hash, key) : NULL;
+        if (record)
+            record->hash = 0;
+    }
+    else {
+        // key is still "deposition/", which prefixes all of its files
+        size_t keylen = strlen(key);
+        guint32 i;
+        for (i = 0; hash && i < mf->slots; ++i) {
+            if (mf->records[i].hash && strncmp(mf->records[i].key, key, keylen) == 0)
+                mf->records[i].hash = 0;
+        }
+    }
+
+    flock(mf->fd, LOCK_UN);
+}
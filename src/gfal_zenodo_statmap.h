@@ -0,0 +1,59 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_STATMAP_H
+#define _GFAL_ZENODO_STATMAP_H
+
+#include "gfal_zenodo.h"
+
+/*
+ * Persistent backing of the metadata cache, shared by all the processes
+ * using the same STAT_CACHE_DIR
+ * Each domain gets a memory mapped file with a fixed number of slots, laid
+ * out as a hash table. Readers take a shared flock, writers an exclusive one,
+ * and expiration times are wall clock, so they mean the same to everybody
+ * Calls must be serialized within a process, which the stat cache does
+ */
+#define ZENODO_STAT_MAP_SLOTS_DEFAULT 65536
+
+typedef struct ZenodoStatMap ZenodoStatMap;
+
+/*
+ * Returns NULL if STAT_CACHE_DIR is not configured
+ */
+ZenodoStatMap* gfal2_zenodo_statmap_new(gfal2_context_t context);
+void gfal2_zenodo_statmap_free(ZenodoStatMap* map);
+
+/*
+ * Returns 1 on hit, -1 on a negative hit, 0 on miss
+ * On a hit, ttl gets the time left, in microseconds
+ */
+int gfal2_zenodo_statmap_get(ZenodoStatMap* map, const char* domain,
+        const char* deposition, const char* file, struct stat* st, gint64* ttl);
+
+/*
+ * Store st for ttl microseconds, or a negative entry if st is NULL
+ */
+void gfal2_zenodo_statmap_put(ZenodoStatMap* map, const char* domain,
+        const char* deposition, const char* file, const struct stat* st, gint64 ttl);
+
+/*
+ * Same semantics as gfal2_zenodo_cache_invalidate
+ */
+void gfal2_zenodo_statmap_invalidate(ZenodoStatMap* map, const char* domain,
+        const char* deposition, const char* file);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Performance counters and latency histograms
+
+#include <json.h>
+#include <string.h>
+#include "gfal_zenodo_cache.h"
+#include "gfal_zenodo_etag.h"
+#include "gfal_zenodo_hedge.h"
+#include "gfal_zenodo_stats.h"
+
+// Bucket i holds latencies in [2^(i-1), 2^i) microseconds, bucket 0 is 0
+#define ZENODO_STATS_BUCKETS 32
+
+
+struct ZenodoOpStats {
+    GMutex lock;
+    guint64 calls;
+    guint64 requests;
+    guint64 retries;
+    guint64 errors;
+    guint64 connections;
+    guint64 bytes_in;
+    guint64 bytes_out;
+    guint64 total_us;
+    guint64 histogram[ZenodoPhaseCount][ZENODO_STATS_BUCKETS];
+};
+
+
+struct ZenodoStats {
+    ZenodoHandle* zenodo;
+    struct ZenodoOpStats ops[ZenodoOpCount];
+
+    // Periodic dump
+    gchar* path;
+    gint64 interval;
+    GThread* dumper;
+    GMutex dumper_lock;
+    GCond dumper_cond;
+    gboolean stopping;
+};
+
+
+static const char* zenodo_op_names[ZenodoOpCount] = {
+    "stat", "list", "delete", "token_refresh", "read", "write", "other"
+};
+
+static const char* zenodo_phase_names[ZenodoPhaseCount] = {
+    "namelookup", "connect", "appconnect", "starttransfer", "total"
+};
+
+static const CURLINFO zenodo_phase_info[ZenodoPhaseCount] = {
+    CURLINFO_NAMELOOKUP_TIME, CURLINFO_CONNECT_TIME, CURLINFO_APPCONNECT_TIME,
+    CURLINFO_STARTTRANSFER_TIME, CURLINFO_TOTAL_TIME
+};
+
+// Operation of the current thread, stored as op + 1 so unset means other
+static GPrivate zenodo_current_op = G_PRIVATE_INIT(NULL);
+
+
+ZenodoOperation gfal2_zenodo_stats_operation(void)
+{
+    gint op = GPOINTER_TO_INT(g_private_get(&zenodo_current_op));
+    return op ? (ZenodoOperation)(op - 1) : ZenodoOpOther;
+}
+
+
+ZenodoOperation gfal2_zenodo_stats_attribute(ZenodoOperation op)
+{
+    ZenodoOperation previous = gfal2_zenodo_stats_operation();
+    g_private_set(&zenodo_current_op, GINT_TO_POINTER(op + 1));
+    return previous;
+}
+
+
+ZenodoOperation gfal2_zenodo_stats_call(ZenodoStats* stats, ZenodoOperation op)
+{
+    g_mutex_lock(&stats->ops[op].lock);
+    ++stats->ops[op].calls;
+    g_mutex_unlock(&stats->ops[op].lock);
+    return gfal2_zenodo_stats_attribute(op);
+}
+
+
+void gfal2_zenodo_stats_request(ZenodoStats* stats, CURL* curl, CURLcode result,
+        long response, gboolean retried, gint64 late)
+{
+    // Everything is read before taking the lock, to keep it short
+    guint64 phases[ZenodoPhaseCount];
+    int i;
+    for (i = 0; i < ZenodoPhaseCount; ++i) {
+        double seconds = 0;
+        curl_easy_getinfo(curl, zenodo_phase_info[i], &seconds);
+        phases[i] = seconds > 0 ? (guint64)(seconds * G_USEC_PER_SEC) : 0;
+        phases[i] += MAX(late, 0);
+    }
+    double downloaded = 0, uploaded = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &downloaded);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &uploaded);
+    // New connections opened for this request, 0 if one was reused
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+    struct ZenodoOpStats* op = &stats->ops[gfal2_zenodo_stats_operation()];
+    g_mutex_lock(&op->lock);
+    ++op->requests;
+    if (retried)
+        ++op->retries;
+    if (result != CURLE_OK || response >= 400)
+        ++op->errors;
+    op->connections += connects;
+    op->bytes_in += (guint64)downloaded;
+    op->bytes_out += (guint64)uploaded;
+    op->total_us += phases[ZenodoPhaseTotal];
+    for (i = 0; i < ZenodoPhaseCount; ++i)
+        ++op->histogram[i][MIN(g_bit_storage(phases[i]), ZENODO_STATS_BUCKETS - 1)];
+    g_mutex_unlock(&op->lock);
+}
+
+
+// Interpolates linearly inside the bucket where the quantile falls
+static gint64 gfal2_zenodo_stats_histogram_quantile(const guint64* histogram, double q)
+{
+    guint64 count = 0;
+    int i;
+    for (i = 0; i < ZENODO_STATS_BUCKETS; ++i)
+        count += histogram[i];
+    if (count == 0)
+        return 0;
+
+    double rank = q * count;
+    guint64 seen = 0;
+    for (i = 0; i < ZENODO_STATS_BUCKETS; ++i) {
+        if (histogram[i] > 0 && seen + histogram[i] >= rank) {
+            if (i == 0)
+                return 0;
+            double lower = (double)(1ull << (i - 1));
+            double fraction = (rank - seen) / histogram[i];
+            return (gint64)(lower + lower * fraction);
+        }
+        seen += histogram[i];
+    }
+    return (gint64)(1ull << (ZENODO_STATS_BUCKETS - 1));
+}
+
+
+gint64 gfal2_zenodo_stats_quantile(ZenodoStats* stats, ZenodoOperation op,
+        ZenodoPhase phase, double q)
+{
+    guint64 histogram[ZENODO_STATS_BUCKETS];
+    g_mutex_lock(&stats->ops[op].lock);
+    memcpy(histogram, stats->ops[op].histogram[phase], sizeof(histogram));
+    g_mutex_unlock(&stats->ops[op].lock);
+    return gfal2_zenodo_stats_histogram_quantile(histogram, q);
+}
+
+
+static json_object* gfal2_zenodo_stats_op_json(struct ZenodoOpStats* op)
+{
+    struct ZenodoOpStats copy;
+    g_mutex_lock(&op->lock);
+    memcpy(&copy, op, sizeof(copy));
+    g_mutex_unlock(&op->lock);
+
+    json_object* entry = json_object_new_object();
+    json_object_object_add(entry, "calls", json_object_new_int64(copy.calls));
+    json_object_object_add(entry, "requests", json_object_new_int64(copy.requests));
+    json_object_object_add(entry, "retries", json_object_new_int64(copy.retries));
+    json_object_object_add(entry, "errors", json_object_new_int64(copy.errors));
+    json_object_object_add(entry, "connections", json_object_new_int64(copy.connections));
+    json_object_object_add(entry, "bytes_in", json_object_new_int64(copy.bytes_in));
+    json_object_object_add(entry, "bytes_out", json_object_new_int64(copy.bytes_out));
+    json_object_object_add(entry, "mean_us", json_object_new_int64(
+            copy.requests ? copy.total_us / copy.requests : 0));
+
+    int i;
+    for (i = 0; i < ZenodoPhaseCount; ++i) {
+        json_object* phase = json_object_new_object();
+        json_object_object_add(phase, "p50_us", json_object_new_int64(
+                gfal2_zenodo_stats_histogram_quantile(copy.histogram[i], 0.50)));
+        json_object_object_add(phase, "p90_us", json_object_new_int64(
+                gfal2_zenodo_stats_histogram_quantile(copy.histogram[i], 0.90)));
+        json_object_object_add(phase, "p99_us", json_object_new_int64(
+                gfal2_zenodo_stats_histogram_quantile(copy.histogram[i], 0.99)));
+        json_object_object_add(entry, zenodo_phase_names[i], phase);
+    }
+    return entry;
+}
+
+
+gchar* gfal2_zenodo_stats_json(ZenodoStats* stats)
+{
+    json_object* root = json_object_new_object();
+    json_object_object_add(root, "timestamp", json_object_new_int64(g_get_real_time() / G_USEC_PER_SEC));
+
+    json_object* ops = json_object_new_object();
+    int i;
+    for (i = 0; i < ZenodoOpCount; ++i)
+        json_object_object_add(ops, zenodo_op_names[i], gfal2_zenodo_stats_op_json(&stats->ops[i]));
+    json_object_object_add(root, "operations", ops);
+
+    guint64 hits, negative_hits, misses;
+    gfal2_zenodo_cache_counters(stats->zenodo->stat_cache, &hits, &negative_hits, &misses);
+    json_object* cache = json_object_new_object();
+    json_object_object_add(cache, "hits", json_object_new_int64(hits));
+    json_object_object_add(cache, "negative_hits", json_object_new_int64(negative_hits));
+    json_object_object_add(cache, "misses", json_object_new_int64(misses));
+    json_object_object_add(root, "stat_cache", cache);
+
+    guint64 not_modified, modified;
+    gfal2_zenodo_etag_counters(stats->zenodo->etag_cache, &not_modified, &modified);
+    json_object* revalidation = json_object_new_object();
+    json_object_object_add(revalidation, "not_modified", json_object_new_int64(not_modified));
+    json_object_object_add(revalidation, "modified", json_object_new_int64(modified));
+    json_object_object_add(root, "revalidation", revalidation);
+
+    guint64 sent, won;
+    gfal2_zenodo_hedge_counters(stats->zenodo->hedge, &sent, &won);
+    json_object* hedges = json_object_new_object();
+    json_object_object_add(hedges, "sent", json_object_new_int64(sent));
+    json_object_object_add(hedges, "won", json_object_new_int64(won));
+    json_object_object_add(root, "hedges", hedges);
+
+    gchar* str = g_strdup(json_object_to_json_string(root));
+    json_object_put(root);
+    return str;
+}
+
+
+// Replaces the file at once, so readers never see it half written
+static void gfal2_zenodo_stats_dump(ZenodoStats* stats)
+{
+    GError* error = NULL;
+    gchar* str = gfal2_zenodo_stats_json(stats);
+    if (!g_file_set_contents(stats->path, str, -1, &error)) {
+        gfal_log(GFAL_VERBOSE_NORMAL, "Could not write the Zenodo stats to %s: %s",
+                stats->path, error->message);
+        g_error_free(error);
+    }
+    g_free(str);
+}
+
+
+static gpointer gfal2_zenodo_stats_dumper(gpointer data)
+{
+    ZenodoStats* stats = (ZenodoStats*)data;
+
+    g_mutex_lock(&stats->dumper_lock);
+    while (!stats->stopping) {
+        gint64 deadline = g_get_monotonic_time() + stats->interval;
+        while (!stats->stopping && g_cond_wait_until(&stats->dumper_cond, &stats->dumper_lock, deadline))
+            ;
+        g_mutex_unlock(&stats->dumper_lock);
+        gfal2_zenodo_stats_dump(stats);
+        g_mutex_lock(&stats->dumper_lock);
+    }
+    g_mutex_unlock(&stats->dumper_lock);
+    return NULL;
+}
+
+
+ZenodoStats* gfal2_zenodo_stats_new(gfal2_context_t context, ZenodoHandle* zenodo)
+{
+    ZenodoStats* stats = g_new0(ZenodoStats, 1);
+    stats->zenodo = zenodo;
+    int i;
+    for (i = 0; i < ZenodoOpCount; ++i)
+        g_mutex_init(&stats->ops[i].lock);
+
+    stats->path = gfal2_get_opt_string(context, "ZENODO", "STATS_FILE", NULL);
+    if (stats->path && stats->path[0]) {
+        stats->interval = gfal2_get_opt_integer_with_default(context, "ZENODO", "STATS_INTERVAL",
+                ZENODO_STATS_INTERVAL_DEFAULT);
+        if (stats->interval < 1)
+            stats->interval = 1;
+        stats->interval *= G_USEC_PER_SEC;
+        g_mutex_init(&stats->dumper_lock);
+        g_cond_init(&stats->dumper_cond);
+        stats->dumper = g_thread_new("zenodo-stats", gfal2_zenodo_stats_dumper, stats);
+    }
+    else {
+        g_free(stats->path);
+        stats->path = NULL;
+    }
+    return stats;
+}
+
+
+void gfal2_zenodo_stats_free(ZenodoStats* stats)
+{
+    if (!stats)
+        return;
+
+    // The last dump happens on the way out
+    if (stats->dumper) {
+        g_mutex_lock(&stats->dumper_lock);
+        stats->stopping = TRUE;
+        g_cond_signal(&stats->dumper_cond);
+        g_mutex_unlock(&stats->dumper_lock);
+        g_thread_join(stats->dumper);
+        g_mutex_clear(&stats->dumper_lock);
+        g_cond_clear(&stats->dumper_cond);
+    }
+
+    int i;
+    for (i = 0; i < ZenodoOpCount; ++i)
+        g_mutex_clear(&stats->ops[i].lock);
+    g_free(stats->path);
+    g_free(stats);
+}
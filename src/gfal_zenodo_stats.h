@@ -0,0 +1,90 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_STATS_H
+#define _GFAL_ZENODO_STATS_H
+
+#include "gfal_zenodo.h"
+
+/*
+ * Per operation counters and latency histograms
+ * Every HTTP request is accounted to the operation its thread is running,
+ * as set by gfal2_zenodo_stats_call or gfal2_zenodo_stats_attribute
+ */
+typedef enum {
+    ZenodoOpStat, ZenodoOpList, ZenodoOpDelete, ZenodoOpToken,
+    ZenodoOpRead, ZenodoOpWrite, ZenodoOpOther, ZenodoOpCount
+} ZenodoOperation;
+
+/*
+ * Phases of a request, as reported by CURLINFO_*_TIME
+ * Each one is the time from the start of the request to its end
+ */
+typedef enum {
+    ZenodoPhaseNameLookup, ZenodoPhaseConnect, ZenodoPhaseTLS,
+    ZenodoPhaseFirstByte, ZenodoPhaseTotal, ZenodoPhaseCount
+} ZenodoPhase;
+
+#define ZENODO_STATS_INTERVAL_DEFAULT 60
+#define ZENODO_STATS_XATTR "zenodo.stats"
+
+typedef struct ZenodoStats ZenodoStats;
+
+/*
+ * If STATS_FILE is set, a thread rewrites it every STATS_INTERVAL seconds
+ */
+ZenodoStats* gfal2_zenodo_stats_new(gfal2_context_t context, ZenodoHandle* zenodo);
+void gfal2_zenodo_stats_free(ZenodoStats* stats);
+
+/*
+ * Count a call to op, and account the requests of this thread to it
+ * Returns the previous operation of the thread
+ */
+ZenodoOperation gfal2_zenodo_stats_call(ZenodoStats* stats, ZenodoOperation op);
+
+/*
+ * Account the requests of this thread to op, without counting a call
+ * Returns the previous operation, to be restored afterwards
+ */
+ZenodoOperation gfal2_zenodo_stats_attribute(ZenodoOperation op);
+
+/*
+ * Operation the requests of this thread are accounted to
+ */
+ZenodoOperation gfal2_zenodo_stats_operation(void);
+
+/*
+ * Record a finished request. curl must not have been reset yet
+ * retried tells if this was not the first attempt
+ * late is how long, in microseconds, the request had been waiting when curl
+ * was started, as when a hedge answers for it. Added to every phase
+ */
+void gfal2_zenodo_stats_request(ZenodoStats* stats, CURL* curl, CURLcode result,
+        long response, gboolean retried, gint64 late);
+
+/*
+ * Latency below which a fraction q of the requests of op completed the phase,
+ * in microseconds, from the histogram. 0 if there are no samples yet
+ */
+gint64 gfal2_zenodo_stats_quantile(ZenodoStats* stats, ZenodoOperation op,
+        ZenodoPhase phase, double q);
+
+/*
+ * JSON document with all the counters, to be freed with g_free
+ */
+gchar* gfal2_zenodo_stats_json(ZenodoStats* stats);
+
+#endif
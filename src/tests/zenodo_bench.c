@@ -0,0 +1,770 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Benchmark of the plugin against the mock Zenodo server
+//
+//   cmake -DBUILD_BENCHMARKS=ON . && make && make benchmark
+//   src/tests/gfal2-zenodo-bench -t 16 -n 1000 -o HTTP2=true --output run.json
+//   src/tests/gfal2-zenodo-bench --h2-proxy /usr/bin/nghttpx -l 5
+//
+// The mock runs in this process. gfal2 loads the plugin from the build tree,
+// configured by a [ZENODO] section written to a temporary GFAL_CONFIG_DIR,
+// and each scenario runs its operations from all the threads at once
+//
+// The mock only speaks HTTP/1.1. With --h2-proxy, nghttpx terminates TLS in
+// front of it and offers HTTP/2, and the scenarios run twice, with HTTP2=false
+// and HTTP2=true, so both transports are compared against the same server
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <gfal_api.h>
+#include <glib/gstdio.h>
+#include <json.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "zenodo_mock.h"
+
+#define BENCH_STATS_SIZE 65536
+
+
+typedef struct Bench Bench;
+
+typedef struct {
+    const char* name;
+    // One operation on the item index
+    int (*run)(Bench* bench, int index, guint64* bytes, GError** error);
+} BenchScenario;
+
+
+struct Bench {
+    ZenodoMock* mock;
+    ZenodoMockConfig mock_config;
+    gfal2_context_t context;
+    char base[128];
+
+    int threads;
+    int ops;
+    gint64 write_size;
+    int block_size;
+    gchar** options;
+    gchar* config_dir;
+    // nghttpx in front of the mock, if any
+    GPid proxy;
+
+    // State of the scenario being run
+    const BenchScenario* scenario;
+    volatile gint next;
+    GMutex lock;
+    GArray* latencies;
+    guint64 bytes;
+    int errors;
+    gchar* first_error;
+};
+
+
+/*
+ * Scenarios. Items are spread over the depositions first, then their files
+ */
+
+static void bench_deposition_url(Bench* bench, int index, char* url, size_t size)
+{
+    snprintf(url, size, "%s/%" G_GINT64_FORMAT, bench->base,
+            gfal2_zenodo_mock_deposition_id(bench->mock, index % bench->mock_config.depositions));
+}
+
+
+static void bench_file_url(Bench* bench, int index, char* url, size_t size)
+{
+    int deposition = index % bench->mock_config.depositions;
+    int file = (index / bench->mock_config.depositions) % bench->mock_config.files;
+    char id[37];
+    gfal2_zenodo_mock_file_id(bench->mock, deposition, file, id);
+    snprintf(url, size, "%s/%" G_GINT64_FORMAT "/%s", bench->base,
+            gfal2_zenodo_mock_deposition_id(bench->mock, deposition), id);
+}
+
+
+// Files created by the write scenario, and removed by unlink
+static void bench_written_url(Bench* bench, int index, char* url, size_t size)
+{
+    snprintf(url, size, "%s/%" G_GINT64_FORMAT "/bench-%06d.dat", bench->base,
+            gfal2_zenodo_mock_deposition_id(bench->mock, index % bench->mock_config.depositions),
+            index);
+}
+
+
+static int bench_stat_deposition(Bench* bench, int index, guint64* bytes, GError** error)
+{
+    char url[GFAL_URL_MAX_LEN];
+    struct stat st;
+    bench_deposition_url(bench, index, url, sizeof(url));
+    return gfal2_stat(bench->context, url, &st, error);
+}
+
+
+static int bench_stat_file(Bench* bench, int index, guint64* bytes, GError** error)
+{
+    char url[GFAL_URL_MAX_LEN];
+    struct stat st;
+    bench_file_url(bench, index, url, sizeof(url));
+    return gfal2_stat(bench->context, url, &st, error);
+}
+
+
+static int bench_list(Bench* bench, const char* url, int expected, GError** error)
+{
+    DIR* dir = gfal2_opendir(bench->context, url, error);
+    if (!dir)
+        return -1;
+
+    GError* tmp_err = NULL;
+    int entries = 0;
+    while (gfal2_readdir(bench->context, dir, &tmp_err))
+        ++entries;
+    gfal2_closedir(bench->context, dir, NULL);
+
+    if (tmp_err) {
+        g_propagate_error(error, tmp_err);
+        return -1;
+    }
+    if (entries < expected) {
+        g_set_error(error, g_quark_from_static_string("zenodo-bench"), EIO,
+                "Listed %d entries out of %d", entries, expected);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int bench_list_depositions(Bench* bench, int index, guint64* bytes, GError** error)
+{
+    char url[GFAL_URL_MAX_LEN];
+    snprintf(url, sizeof(url), "%s/", bench->base);
+    return bench_list(bench, url, bench->mock_config.depositions, error);
+}
+
+
+static int bench_list_files(Bench* bench, int index, guint64* bytes, GError** error)
+{
+    char url[GFAL_URL_MAX_LEN];
+    bench_deposition_url(bench, index, url, sizeof(url));
+    return bench_list(bench, url, bench->mock_config.files, error);
+}
+
+
+static int bench_read(Bench* bench, int index, guint64* bytes, GError** error)
+{
+    char url[GFAL_URL_MAX_LEN];
+    bench_file_url(bench, index, url, sizeof(url));
+
+    int fd = gfal2_open(bench->context, url, O_RDONLY, error);
+    if (fd < 0)
+        return -1;
+
+    char* buffer = g_malloc(bench->block_size);
+    gint64 total = 0;
+    ssize_t ret;
+    while ((ret = gfal2_read(bench->context, fd, buffer, bench->block_size, error)) > 0)
+        total += ret;
+    g_free(buffer);
+
+    if (gfal2_close(bench->context, fd, ret < 0 ? NULL : error) < 0 || ret < 0)
+        return -1;
+    *bytes += total;
+    if (total != bench->mock_config.file_size) {
+        g_set_error(error, g_quark_from_static_string("zenodo-bench"), EIO,
+                "Read %" G_GINT64_FORMAT " bytes out of %" G_GINT64_FORMAT,
+                total, bench->mock_config.file_size);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int bench_write(Bench* bench, int index, guint64* bytes, GError** error)
+{
+    char url[GFAL_URL_MAX_LEN];
+    bench_written_url(bench, index, url, sizeof(url));
+
+    int fd = gfal2_open2(bench->context, url, O_WRONLY | O_CREAT, 0644, error);
+    if (fd < 0)
+        return -1;
+
+    char* buffer = g_malloc(bench->block_size);
+    memset(buffer, index & 0xFF, bench->block_size);
+    gint64 left = bench->write_size;
+    ssize_t ret = 0;
+    while (left > 0) {
+        ret = gfal2_write(bench->context, fd, buffer, MIN(left, bench->block_size), error);
+        if (ret < 0)
+            break;
+        left -= ret;
+    }
+    g_free(buffer);
+
+    // Errors of the upload are reported by close
+    if (gfal2_close(bench->context, fd, ret < 0 ? NULL : error) < 0 || ret < 0)
+        return -1;
+    *bytes += bench->write_size;
+    return 0;
+}
+
+
+static int bench_unlink(Bench* bench, int index, guint64* bytes, GError** error)
+{
+    char url[GFAL_URL_MAX_LEN];
+    bench_written_url(bench, index, url, sizeof(url));
+    return gfal2_unlink(bench->context, url, error);
+}
+
+
+static const BenchScenario bench_scenarios[] = {
+    {"stat_deposition", bench_stat_deposition},
+    {"stat_file", bench_stat_file},
+    {"list_files", bench_list_files},
+    {"list_depositions", bench_list_depositions},
+    {"read", bench_read},
+    {"write", bench_write},
+    {"unlink", bench_unlink},
+    {NULL, NULL}
+};
+
+
+/*
+ * Runner
+ */
+
+static gpointer bench_worker(gpointer data)
+{
+    Bench* bench = (Bench*)data;
+    GArray* latencies = g_array_new(FALSE, FALSE, sizeof(double));
+    guint64 bytes = 0;
+    int errors = 0;
+    gchar* first_error = NULL;
+    int index;
+
+    while ((index = g_atomic_int_add(&bench->next, 1)) < bench->ops) {
+        GError* error = NULL;
+        gint64 start = g_get_monotonic_time();
+        if (bench->scenario->run(bench, index, &bytes, &error) < 0) {
+            ++errors;
+            if (!first_error)
+                first_error = g_strdup(error ? error->message : "Unknown error");
+            g_clear_error(&error);
+            continue;
+        }
+        double elapsed = (g_get_monotonic_time() - start) / 1000.0;
+        g_array_append_val(latencies, elapsed);
+    }
+
+    g_mutex_lock(&bench->lock);
+    g_array_append_vals(bench->latencies, latencies->data, latencies->len);
+    bench->bytes += bytes;
+    bench->errors += errors;
+    if (!bench->first_error)
+        bench->first_error = first_error;
+    else
+        g_free(first_error);
+    g_mutex_unlock(&bench->lock);
+
+    g_array_free(latencies, TRUE);
+    return NULL;
+}
+
+
+static gint bench_compare_double(gconstpointer a, gconstpointer b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+static double bench_quantile(GArray* sorted, double q)
+{
+    if (sorted->len == 0)
+        return 0;
+    guint i = MIN(sorted->len - 1, (guint)(q * sorted->len));
+    return g_array_index(sorted, double, i);
+}
+
+
+static json_object* bench_plugin_stats(Bench* bench)
+{
+    char url[GFAL_URL_MAX_LEN];
+    char* buffer = g_malloc0(BENCH_STATS_SIZE);
+    json_object* stats = NULL;
+
+    snprintf(url, sizeof(url), "%s/", bench->base);
+    if (gfal2_getxattr(bench->context, url, "zenodo.stats", buffer, BENCH_STATS_SIZE - 1, NULL) > 0)
+        stats = json_tokener_parse(buffer);
+    g_free(buffer);
+    return stats;
+}
+
+
+// Connections opened by the plugin so far, over all operations
+static gint64 bench_plugin_connections(Bench* bench)
+{
+    json_object* stats = bench_plugin_stats(bench);
+    json_object *operations = NULL, *connections = NULL;
+    gint64 total = 0;
+
+    if (stats && json_object_object_get_ex(stats, "operations", &operations)) {
+        json_object_object_foreach(operations, name, op) {
+            (void)name;
+            if (json_object_object_get_ex(op, "connections", &connections))
+                total += json_object_get_int64(connections);
+        }
+    }
+    if (stats)
+        json_object_put(stats);
+    return total;
+}
+
+
+static json_object* bench_run_scenario(Bench* bench, const BenchScenario* scenario)
+{
+    gint64 connections = bench_plugin_connections(bench);
+    bench->scenario = scenario;
+    bench->next = 0;
+    bench->latencies = g_array_new(FALSE, FALSE, sizeof(double));
+    bench->bytes = 0;
+    bench->errors = 0;
+    bench->first_error = NULL;
+
+    GThread** workers = g_new0(GThread*, bench->threads);
+    gint64 start = g_get_monotonic_time();
+    int i;
+    for (i = 0; i < bench->threads; ++i)
+        workers[i] = g_thread_new("zenodo-bench", bench_worker, bench);
+    for (i = 0; i < bench->threads; ++i)
+        g_thread_join(workers[i]);
+    double seconds = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+    g_free(workers);
+    connections = bench_plugin_connections(bench) - connections;
+
+    g_array_sort(bench->latencies, bench_compare_double);
+    int done = bench->latencies->len;
+    double p50 = bench_quantile(bench->latencies, 0.50);
+    double p99 = bench_quantile(bench->latencies, 0.99);
+    double mbs = bench->bytes / 1048576.0 / seconds;
+
+    printf("%-18s %8d %7d %9.3f %10.1f %9.2f %9.2f %9.1f %7" G_GINT64_FORMAT "\n", scenario->name,
+            done, bench->errors, seconds, done / seconds, p50, p99, mbs, connections);
+    if (bench->first_error)
+        printf("    %s\n", bench->first_error);
+    fflush(stdout);
+
+    json_object* result = json_object_new_object();
+    json_object_object_add(result, "name", json_object_new_string(scenario->name));
+    json_object_object_add(result, "ops", json_object_new_int(done));
+    json_object_object_add(result, "errors", json_object_new_int(bench->errors));
+    json_object_object_add(result, "seconds", json_object_new_double(seconds));
+    json_object_object_add(result, "ops_per_second", json_object_new_double(done / seconds));
+    json_object_object_add(result, "p50_ms", json_object_new_double(p50));
+    json_object_object_add(result, "p99_ms", json_object_new_double(p99));
+    json_object_object_add(result, "bytes", json_object_new_int64(bench->bytes));
+    json_object_object_add(result, "connections", json_object_new_int64(connections));
+    if (bench->first_error)
+        json_object_object_add(result, "first_error", json_object_new_string(bench->first_error));
+
+    g_array_free(bench->latencies, TRUE);
+    g_free(bench->first_error);
+    bench->first_error = NULL;
+    return result;
+}
+
+
+static gboolean bench_has_option(gchar** options, const char* key)
+{
+    size_t len = strlen(key);
+    for (; options && *options; ++options)
+        if (strncmp(*options, key, len) == 0 && (*options)[len] == '=')
+            return TRUE;
+    return FALSE;
+}
+
+
+// gfal2 reads its configuration, and the plugin its transport settings,
+// when the context is created, so each run gets its own configuration
+static int bench_write_config(Bench* bench, gchar** extra, GError** error)
+{
+    static const char* defaults[] = {
+        "ACCESS_TOKEN=mock-token",
+        // Every operation has to reach the server
+        "STAT_CACHE_TTL=0",
+        "STAT_CACHE_NEGATIVE_TTL=0",
+        "RETRY_BASE_DELAY=10",
+        NULL
+    };
+    GString* config = g_string_new("[ZENODO]\n");
+    int i;
+
+    // Options given explicitly win over the defaults
+    for (i = 0; defaults[i]; ++i) {
+        gchar* key = g_strndup(defaults[i], strchr(defaults[i], '=') - defaults[i]);
+        if (!bench_has_option(bench->options, key) && !bench_has_option(extra, key))
+            g_string_append_printf(config, "%s\n", defaults[i]);
+        g_free(key);
+    }
+    for (i = 0; bench->options && bench->options[i]; ++i) {
+        gchar* key = g_strndup(bench->options[i], strcspn(bench->options[i], "="));
+        if (!bench_has_option(extra, key))
+            g_string_append_printf(config, "%s\n", bench->options[i]);
+        g_free(key);
+    }
+    for (i = 0; extra && extra[i]; ++i)
+        g_string_append_printf(config, "%s\n", extra[i]);
+    g_string_append(config, "\n[HTTP PLUGIN]\nINSECURE=true\n");
+
+    gchar* path = g_build_filename(bench->config_dir, "zenodo_plugin.conf", NULL);
+    gboolean ok = g_file_set_contents(path, config->str, config->len, error);
+    g_free(path);
+    g_string_free(config, TRUE);
+    return ok ? 0 : -1;
+}
+
+
+// Run the selected scenarios with a fresh context
+static json_object* bench_suite(Bench* bench, const char* label, gchar** extra,
+        gchar** scenarios, GError** error)
+{
+    if (bench_write_config(bench, extra, error) < 0)
+        return NULL;
+    bench->context = gfal2_context_new(error);
+    if (!bench->context)
+        return NULL;
+
+    printf("\n%s\n%-18s %8s %7s %9s %10s %9s %9s %9s %7s\n", label, "scenario", "ops", "errors",
+            "seconds", "ops/s", "p50 ms", "p99 ms", "MB/s", "conns");
+
+    json_object* suite = json_object_new_object();
+    json_object* results = json_object_new_array();
+    json_object_object_add(suite, "label", json_object_new_string(label));
+
+    const BenchScenario* scenario;
+    for (scenario = bench_scenarios; scenario->name; ++scenario) {
+        gboolean selected = (scenarios == NULL);
+        gchar** name;
+        for (name = scenarios; name && *name && !selected; ++name)
+            selected = strcmp(*name, scenario->name) == 0;
+        if (selected)
+            json_object_array_add(results, bench_run_scenario(bench, scenario));
+    }
+    json_object_object_add(suite, "scenarios", results);
+
+    json_object* stats = bench_plugin_stats(bench);
+    if (stats)
+        json_object_object_add(suite, "plugin_stats", stats);
+
+    gfal2_context_free(bench->context);
+    bench->context = NULL;
+    return suite;
+}
+
+
+/*
+ * HTTP/2 front, see the top of this file
+ */
+
+// Port nobody listens on now, for the proxy
+static int bench_free_port(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int port = -1;
+    if (fd >= 0 && bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (struct sockaddr*)&addr, &addrlen) == 0)
+        port = ntohs(addr.sin_port);
+    if (fd >= 0)
+        close(fd);
+    return port;
+}
+
+
+static gboolean bench_port_open(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    gboolean open = fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    if (fd >= 0)
+        close(fd);
+    return open;
+}
+
+
+static void bench_stop_proxy(Bench* bench)
+{
+    if (bench->proxy > 0) {
+        kill(bench->proxy, SIGTERM);
+        waitpid(bench->proxy, NULL, 0);
+        g_spawn_close_pid(bench->proxy);
+        bench->proxy = 0;
+    }
+
+    // nghttpx loads them in its workers, after it is listening
+    gchar* cert = g_build_filename(bench->config_dir, "proxy.crt", NULL);
+    gchar* key = g_build_filename(bench->config_dir, "proxy.key", NULL);
+    g_unlink(cert);
+    g_unlink(key);
+    g_free(cert);
+    g_free(key);
+}
+
+
+// Start nghttpx with the certificate of the mock, and return its port
+static int bench_start_proxy(Bench* bench, const char* nghttpx, GError** error)
+{
+    gchar* cert = g_build_filename(bench->config_dir, "proxy.crt", NULL);
+    gchar* key = g_build_filename(bench->config_dir, "proxy.key", NULL);
+    int port = bench_free_port();
+    int ret = -1;
+
+    if (port < 0) {
+        g_set_error(error, g_quark_from_static_string("zenodo-bench"), EIO,
+                "No free port for the proxy");
+        goto out;
+    }
+    if (gfal2_zenodo_mock_write_credentials(bench->mock, cert, key, error) < 0)
+        goto out;
+
+    gchar* frontend = g_strdup_printf("-f127.0.0.1,%d", port);
+    gchar* backend = g_strdup_printf("-b127.0.0.1,%d", gfal2_zenodo_mock_port(bench->mock));
+    gchar* argv[] = {(gchar*)nghttpx, frontend, backend, "--no-ocsp", "-L", "WARN",
+        key, cert, NULL};
+    gboolean spawned = g_spawn_async(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+            &bench->proxy, error);
+    g_free(frontend);
+    g_free(backend);
+    if (!spawned)
+        goto out;
+
+    // Give it up to five seconds to listen
+    int i;
+    for (i = 0; i < 100 && !bench_port_open(port); ++i)
+        g_usleep(50000);
+    if (i == 100) {
+        g_set_error(error, g_quark_from_static_string("zenodo-bench"), EIO,
+                "%s is not listening on port %d", nghttpx, port);
+        bench_stop_proxy(bench);
+        goto out;
+    }
+    ret = port;
+
+out:
+    g_free(cert);
+    g_free(key);
+    return ret;
+}
+
+
+static int bench_errors(json_object* suite)
+{
+    json_object *results = NULL, *errors = NULL;
+    int i, total = 0;
+    json_object_object_get_ex(suite, "scenarios", &results);
+    for (i = 0; results && i < json_object_array_length(results); ++i) {
+        if (json_object_object_get_ex(json_object_array_get_idx(results, i), "errors", &errors))
+            total += json_object_get_int(errors);
+    }
+    return total;
+}
+
+
+int main(int argc, char** argv)
+{
+    Bench bench;
+    memset(&bench, 0, sizeof(bench));
+    gfal2_zenodo_mock_config_defaults(&bench.mock_config);
+    bench.threads = 4;
+    bench.ops = 200;
+    bench.write_size = 1048576;
+    bench.block_size = 65536;
+    g_mutex_init(&bench.lock);
+
+    gint64 file_size = bench.mock_config.file_size;
+    gchar* scenario_list = NULL;
+    gchar* output = NULL;
+    gchar* plugin_dir = g_strdup(ZENODO_PLUGIN_DIR);
+    gchar* h2_proxy = NULL;
+    GError* error = NULL;
+
+    GOptionEntry entries[] = {
+        {"threads", 't', 0, G_OPTION_ARG_INT, &bench.threads, "Concurrent operations", "N"},
+        {"ops", 'n', 0, G_OPTION_ARG_INT, &bench.ops, "Operations per scenario", "N"},
+        {"scenarios", 0, 0, G_OPTION_ARG_STRING, &scenario_list,
+            "Comma separated scenarios, all by default", "LIST"},
+        {"write-size", 0, 0, G_OPTION_ARG_INT64, &bench.write_size, "Size of written files", "BYTES"},
+        {"block-size", 0, 0, G_OPTION_ARG_INT, &bench.block_size, "Size of reads and writes", "BYTES"},
+        {"option", 'o', 0, G_OPTION_ARG_STRING_ARRAY, &bench.options,
+            "Plugin setting, as in the [ZENODO] section", "KEY=VALUE"},
+        {"output", 0, 0, G_OPTION_ARG_FILENAME, &output, "Write the results as JSON", "PATH"},
+        {"plugin-dir", 0, 0, G_OPTION_ARG_FILENAME, &plugin_dir, "Where the plugin is", "DIR"},
+        {"h2-proxy", 0, 0, G_OPTION_ARG_FILENAME, &h2_proxy,
+            "Compare HTTP/1.1 and HTTP/2 through this nghttpx", "PATH"},
+        {"depositions", 'd', 0, G_OPTION_ARG_INT, &bench.mock_config.depositions,
+            "Depositions on the server", "N"},
+        {"files", 'f', 0, G_OPTION_ARG_INT, &bench.mock_config.files, "Files per deposition", "N"},
+        {"file-size", 's', 0, G_OPTION_ARG_INT64, &file_size, "Size of each file", "BYTES"},
+        {"max-page-size", 0, 0, G_OPTION_ARG_INT, &bench.mock_config.max_page_size,
+            "Longest page served", "N"},
+        {"latency", 'l', 0, G_OPTION_ARG_INT, &bench.mock_config.latency_ms,
+            "Server latency", "MS"},
+        {"jitter", 'j', 0, G_OPTION_ARG_INT, &bench.mock_config.jitter_ms,
+            "Random extra server latency", "MS"},
+        {"error-rate", 'e', 0, G_OPTION_ARG_DOUBLE, &bench.mock_config.error_rate,
+            "Fraction of 503 answers", "RATE"},
+        {NULL}
+    };
+
+    GOptionContext* options = g_option_context_new(NULL);
+    g_option_context_set_summary(options,
+            "Run the Zenodo plugin against a local mock server, and report\n"
+            "throughput and latency per operation");
+    g_option_context_add_main_entries(options, entries, NULL);
+    if (!g_option_context_parse(options, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(options);
+    bench.mock_config.file_size = file_size;
+    bench.threads = MAX(bench.threads, 1);
+    bench.block_size = MAX(bench.block_size, 1);
+    gchar** scenarios = scenario_list ? g_strsplit(scenario_list, ",", -1) : NULL;
+    // The proxy does the TLS
+    if (h2_proxy)
+        bench.mock_config.tls = FALSE;
+
+    bench.mock = gfal2_zenodo_mock_start(&bench.mock_config, &error);
+    if (!bench.mock) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    int port = gfal2_zenodo_mock_port(bench.mock);
+
+    bench.config_dir = g_dir_make_tmp("gfal2-zenodo-bench-XXXXXX", &error);
+    if (!bench.config_dir) {
+        fprintf(stderr, "%s\n", error->message);
+        gfal2_zenodo_mock_stop(bench.mock);
+        return 1;
+    }
+    g_setenv("GFAL_CONFIG_DIR", bench.config_dir, TRUE);
+    g_setenv("GFAL_PLUGIN_DIR", plugin_dir, TRUE);
+
+    printf("Mock server on 127.0.0.1:%d: %d depositions of %d files of %" G_GINT64_FORMAT " bytes\n",
+            port, bench.mock_config.depositions, bench.mock_config.files,
+            bench.mock_config.file_size);
+
+    json_object* runs = json_object_new_array();
+    int errors = 0;
+
+    if (h2_proxy) {
+        port = bench_start_proxy(&bench, h2_proxy, &error);
+        if (port > 0)
+            printf("HTTP/2 proxy on 127.0.0.1:%d\n", port);
+    }
+    snprintf(bench.base, sizeof(bench.base), "zenodo://127.0.0.1:%d", port);
+
+    // Same scenarios over both transports, through the same proxy
+    static const struct {
+        const char* label;
+        gchar* options[2];
+    } transports[] = {
+        {"http1.1", {"HTTP2=false", NULL}},
+        {"http2", {"HTTP2=true", NULL}}
+    };
+    int i;
+    for (i = 0; port > 0 && !error && i < (h2_proxy ? 2 : 1); ++i) {
+        json_object* suite;
+        if (h2_proxy)
+            suite = bench_suite(&bench, transports[i].label, (gchar**)transports[i].options,
+                    scenarios, &error);
+        else
+            suite = bench_suite(&bench, "default", NULL, scenarios, &error);
+        if (suite) {
+            errors += bench_errors(suite);
+            json_object_array_add(runs, suite);
+        }
+    }
+    bench_stop_proxy(&bench);
+
+    guint64 requests, connections;
+    gfal2_zenodo_mock_counters(bench.mock, &requests, &connections);
+    printf("\nServer: %" G_GUINT64_FORMAT " requests over %" G_GUINT64_FORMAT " connections\n",
+            requests, connections);
+
+    if (output && !error) {
+        json_object* root = json_object_new_object();
+        json_object* server = json_object_new_object();
+        json_object_object_add(root, "version", json_object_new_string(ZENODO_VERSION));
+        json_object_object_add(server, "depositions", json_object_new_int(bench.mock_config.depositions));
+        json_object_object_add(server, "files", json_object_new_int(bench.mock_config.files));
+        json_object_object_add(server, "file_size", json_object_new_int64(bench.mock_config.file_size));
+        json_object_object_add(server, "max_page_size", json_object_new_int(bench.mock_config.max_page_size));
+        json_object_object_add(server, "latency_ms", json_object_new_int(bench.mock_config.latency_ms));
+        json_object_object_add(server, "jitter_ms", json_object_new_int(bench.mock_config.jitter_ms));
+        json_object_object_add(server, "error_rate", json_object_new_double(bench.mock_config.error_rate));
+        json_object_object_add(server, "h2_proxy", json_object_new_boolean(h2_proxy != NULL));
+        json_object_object_add(server, "requests", json_object_new_int64(requests));
+        json_object_object_add(server, "connections", json_object_new_int64(connections));
+        json_object_object_add(root, "server", server);
+        json_object_object_add(root, "threads", json_object_new_int(bench.threads));
+        json_object_object_add(root, "ops", json_object_new_int(bench.ops));
+        json_object_object_add(root, "runs", json_object_get(runs));
+
+        const char* text = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY);
+        if (!g_file_set_contents(output, text, -1, &error))
+            fprintf(stderr, "%s\n", error->message);
+        json_object_put(root);
+    }
+
+    if (error) {
+        fprintf(stderr, "%s\n", error->message);
+        g_clear_error(&error);
+        errors = MAX(errors, 1);
+    }
+
+    gchar* config_file = g_build_filename(bench.config_dir, "zenodo_plugin.conf", NULL);
+    g_unlink(config_file);
+    g_rmdir(bench.config_dir);
+    g_free(config_file);
+    g_free(bench.config_dir);
+    json_object_put(runs);
+    gfal2_zenodo_mock_stop(bench.mock);
+    g_strfreev(scenarios);
+    g_strfreev(bench.options);
+    g_free(scenario_list);
+    g_free(output);
+    g_free(plugin_dir);
+    g_free(h2_proxy);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Microbenchmark of the decoding of listings, against keeping the json-c tree
+//
+//   src/tests/gfal2-zenodo-listing-bench -d 20000 -f 4
+//
+// The pages are the ones the mock server sends. Both ways keep every page of
+// the listing until the end, as a directory does until closedir, and fill the
+// dirent and stat of every entry, as readdirpp does. The memory is what the
+// heap grew by while the pages are held, so it counts the allocator overhead
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include "zenodo_mock.h"
+#include "gfal_zenodo_listing.h"
+
+
+typedef struct {
+    const char* name;
+    // Decode the page i into the slot i
+    int (*decode)(gpointer pages, int i, GString* body);
+    // Fill the dirent and stat of every entry of the page i, and return how many
+    int (*walk)(gpointer pages, int i);
+    void (*free)(gpointer pages, int i);
+    gsize slot_size;
+} BenchDecoder;
+
+typedef struct {
+    const char* name;
+    double bytes_per_entry;
+    double decode_us;
+    double walk_us;
+} BenchResult;
+
+
+static size_t bench_heap_used(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    return info.uordblks + info.hblkhd;
+}
+
+
+static int bench_tree_decode(gpointer pages, int i, GString* body)
+{
+    json_object** roots = pages;
+    roots[i] = json_tokener_parse(body->str);
+    return roots[i] ? 0 : -1;
+}
+
+
+static int bench_tree_walk(gpointer pages, int i)
+{
+    json_object** roots = pages;
+    struct dirent dent;
+    struct stat st;
+    int length = json_object_array_length(roots[i]);
+    int j;
+    for (j = 0; j < length; ++j)
+        gfal2_zenodo_deposition_to_stat(json_object_array_get_idx(roots[i], j), &dent, &st);
+    return length;
+}
+
+
+static void bench_tree_free(gpointer pages, int i)
+{
+    json_object** roots = pages;
+    json_object_put(roots[i]);
+}
+
+
+static int bench_listing_decode(gpointer pages, int i, GString* body)
+{
+    ZenodoListing* listings = pages;
+    return gfal2_zenodo_listing_decode(&listings[i], ZenodoListDepositions, body->str, body->len,
+            NULL);
+}
+
+
+static int bench_listing_walk(gpointer pages, int i)
+{
+    ZenodoListing* listings = pages;
+    struct dirent dent;
+    struct stat st;
+    int j;
+    for (j = 0; j < listings[i].length; ++j)
+        gfal2_zenodo_listing_entry(&listings[i], j, &dent, &st);
+    return listings[i].length;
+}
+
+
+static void bench_listing_free(gpointer pages, int i)
+{
+    ZenodoListing* listings = pages;
+    gfal2_zenodo_listing_clear(&listings[i]);
+}
+
+
+static const BenchDecoder decoders[] = {
+    {"json-c tree", bench_tree_decode, bench_tree_walk, bench_tree_free, sizeof(json_object*)},
+    {"listing", bench_listing_decode, bench_listing_walk, bench_listing_free, sizeof(ZenodoListing)},
+};
+
+
+static int bench_decoder(const BenchDecoder* decoder, GString** bodies, int npages, int rounds,
+        BenchResult* result)
+{
+    gpointer pages = g_malloc0(decoder->slot_size * npages);
+    gint64 decode_us = 0, walk_us = 0;
+    size_t held = 0;
+    int entries = 0;
+    int round, i;
+
+    result->name = decoder->name;
+    for (round = 0; round < rounds; ++round) {
+        size_t before = bench_heap_used();
+        gint64 start = g_get_monotonic_time();
+        for (i = 0; i < npages; ++i) {
+            if (decoder->decode(pages, i, bodies[i]) < 0) {
+                fprintf(stderr, "%s could not decode the page %d\n", decoder->name, i);
+                g_free(pages);
+                return -1;
+            }
+        }
+        gint64 decoded = g_get_monotonic_time();
+        entries = 0;
+        for (i = 0; i < npages; ++i)
+            entries += decoder->walk(pages, i);
+        walk_us += g_get_monotonic_time() - decoded;
+        decode_us += decoded - start;
+        held = bench_heap_used() - before;
+
+        for (i = 0; i < npages; ++i)
+            decoder->free(pages, i);
+    }
+    g_free(pages);
+
+    result->bytes_per_entry = (double)held / entries;
+    result->decode_us = (double)decode_us / rounds / entries;
+    result->walk_us = (double)walk_us / rounds / entries;
+    return entries;
+}
+
+
+int main(int argc, char** argv)
+{
+    ZenodoMockConfig config;
+    gfal2_zenodo_mock_config_defaults(&config);
+    config.depositions = 10000;
+    config.files = 4;
+    int page_size = 100;
+    int rounds = 5;
+    GError* error = NULL;
+
+    GOptionEntry entries[] = {
+        {"depositions", 'd', 0, G_OPTION_ARG_INT, &config.depositions, "Entries of the listing", "N"},
+        {"files", 'f', 0, G_OPTION_ARG_INT, &config.files, "Files per deposition", "N"},
+        {"page-size", 'p', 0, G_OPTION_ARG_INT, &page_size, "Entries per page", "N"},
+        {"rounds", 'r', 0, G_OPTION_ARG_INT, &rounds, "Times each decoder goes through the listing", "N"},
+        {NULL}
+    };
+
+    GOptionContext* options = g_option_context_new(NULL);
+    g_option_context_set_summary(options,
+            "Compare the memory and time taken by a listing of depositions,\n"
+            "kept as json-c trees or decoded by the plugin");
+    g_option_context_add_main_entries(options, entries, NULL);
+    if (!g_option_context_parse(options, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(options);
+    config.depositions = MAX(config.depositions, 1);
+    page_size = MAX(page_size, 1);
+    rounds = MAX(rounds, 1);
+
+    ZenodoMock* mock = gfal2_zenodo_mock_start(&config, &error);
+    if (!mock) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    int npages = (config.depositions + page_size - 1) / page_size;
+    GString** bodies = g_new0(GString*, npages);
+    gsize body_size = 0;
+    int i;
+    for (i = 0; i < npages; ++i) {
+        bodies[i] = gfal2_zenodo_mock_deposition_page(mock, i * page_size, page_size);
+        body_size += bodies[i]->len;
+    }
+    gfal2_zenodo_mock_stop(mock);
+
+    printf("%d depositions of %d files, in %d pages, %.1f bytes of JSON per entry\n",
+            config.depositions, config.files, npages, (double)body_size / config.depositions);
+    printf("%-12s %14s %12s %12s\n", "decoder", "bytes/entry", "decode us", "readdir us");
+
+    BenchResult results[G_N_ELEMENTS(decoders)];
+    int ret = 0;
+    for (i = 0; i < (int)G_N_ELEMENTS(decoders); ++i) {
+        if (bench_decoder(&decoders[i], bodies, npages, rounds, &results[i]) != config.depositions) {
+            fprintf(stderr, "%s did not return every entry\n", decoders[i].name);
+            ret = 1;
+            continue;
+        }
+        printf("%-12s %14.1f %12.3f %12.3f\n", results[i].name, results[i].bytes_per_entry,
+                results[i].decode_us, results[i].walk_us);
+    }
+    if (!ret)
+        printf("%.1f times less memory per entry\n",
+                results[0].bytes_per_entry / results[1].bytes_per_entry);
+
+    for (i = 0; i < npages; ++i)
+        g_string_free(bodies[i], TRUE);
+    g_free(bodies);
+    return ret;
+}
@@ -0,0 +1,1378 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Imitation of the Zenodo deposit API, for benchmarks and tests
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "zenodo_mock.h"
+
+// Generated files repeat a block of this many pseudo random bytes
+#define ZENODO_MOCK_PATTERN_SIZE 65536
+// Enough for the request line and headers
+#define ZENODO_MOCK_BUFFER_SIZE 16384
+#define ZENODO_MOCK_MAX_BODY (G_GINT64_CONSTANT(1) << 30)
+// Generated depositions are numbered from here
+#define ZENODO_MOCK_FIRST_ID 100000
+#define ZENODO_MOCK_EPOCH 1700000000
+// Responses are counted by status below this
+#define ZENODO_MOCK_MAX_STATUS 600
+
+
+typedef struct {
+    char id[37];
+    gchar* name;
+    gint64 size;
+    char md5[33];
+    // NULL for generated content
+    GByteArray* data;
+    gint64 modified;
+} MockFile;
+
+
+typedef struct {
+    gint64 id;
+    gchar* title;
+    char bucket[37];
+    GPtrArray* files;
+    gint64 created;
+    gint64 modified;
+} MockDeposition;
+
+
+struct ZenodoMock {
+    ZenodoMockConfig config;
+    int listen_fd;
+    int port;
+    EVP_PKEY* key;
+    X509* cert;
+    SSL_CTX* ssl_ctx;
+    GThread* acceptor;
+    volatile gint stopping;
+
+    // Protects the depositions and their files
+    GMutex lock;
+    GPtrArray* depositions;
+    GHashTable* by_id;
+    GHashTable* by_bucket;
+    gint64 next_id;
+    guint64 next_file;
+
+    unsigned char pattern[ZENODO_MOCK_PATTERN_SIZE];
+    char pattern_md5[33];
+
+    // Live connections, shut down on stop
+    GMutex connections_lock;
+    GCond connections_cond;
+    GList* connections;
+    guint64 accepted;
+    volatile gint requests;
+    volatile gint statuses[ZENODO_MOCK_MAX_STATUS];
+
+    // Faults injected by the tests, protected by the lock
+    int fail_next;
+    int fail_status;
+    int delay_next;
+    int delay_ms;
+    gint64 cut_next;
+    ZenodoMockObserver observer;
+    gpointer observer_data;
+};
+
+
+typedef struct {
+    ZenodoMock* mock;
+    int fd;
+    SSL* ssl;
+    char in[ZENODO_MOCK_BUFFER_SIZE];
+    size_t in_start, in_end;
+} MockConnection;
+
+
+typedef struct {
+    char method[16];
+    gchar* head;
+    gchar* path;
+    gchar* query;
+    gchar** segments;
+    guint nsegments;
+    GByteArray* body;
+    gboolean close;
+    char host[256];
+} MockRequest;
+
+
+static GQuark mock_domain(void)
+{
+    return g_quark_from_static_string("zenodo-mock");
+}
+
+
+static void mock_file_free(gpointer data)
+{
+    MockFile* file = (MockFile*)data;
+    g_free(file->name);
+    if (file->data)
+        g_byte_array_unref(file->data);
+    g_free(file);
+}
+
+
+static void mock_deposition_free(gpointer data)
+{
+    MockDeposition* deposition = (MockDeposition*)data;
+    g_free(deposition->title);
+    g_ptr_array_free(deposition->files, TRUE);
+    g_free(deposition);
+}
+
+
+static void mock_md5_hex(EVP_MD_CTX* md, char* hex)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0, i;
+    EVP_DigestFinal_ex(md, digest, &len);
+    for (i = 0; i < len; ++i)
+        sprintf(hex + i * 2, "%02x", digest[i]);
+}
+
+
+// Fill the pattern, and hash a generated file once for all of them
+static void mock_setup_pattern(ZenodoMock* mock)
+{
+    guint32 state = 0x2545F491;
+    size_t i;
+    for (i = 0; i < sizeof(mock->pattern); ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        mock->pattern[i] = state & 0xFF;
+    }
+
+    EVP_MD_CTX* md = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(md, EVP_md5(), NULL);
+    gint64 left = mock->config.file_size;
+    while (left > 0) {
+        size_t n = MIN(left, (gint64)sizeof(mock->pattern));
+        EVP_DigestUpdate(md, mock->pattern, n);
+        left -= n;
+    }
+    mock_md5_hex(md, mock->pattern_md5);
+    EVP_MD_CTX_free(md);
+}
+
+
+static MockDeposition* mock_deposition_new(ZenodoMock* mock, const char* title, gint64 when)
+{
+    MockDeposition* deposition = g_new0(MockDeposition, 1);
+    deposition->id = mock->next_id++;
+    deposition->title = g_strdup(title);
+    snprintf(deposition->bucket, sizeof(deposition->bucket), "%08x-0000-4000-a000-%012" G_GINT64_MODIFIER "x",
+            0xb0c4e700, deposition->id);
+    deposition->files = g_ptr_array_new_with_free_func(mock_file_free);
+    deposition->created = deposition->modified = when;
+
+    g_ptr_array_add(mock->depositions, deposition);
+    g_hash_table_insert(mock->by_id, &deposition->id, deposition);
+    g_hash_table_insert(mock->by_bucket, deposition->bucket, deposition);
+    return deposition;
+}
+
+
+static void mock_populate(ZenodoMock* mock)
+{
+    int i, j;
+    for (i = 0; i < mock->config.depositions; ++i) {
+        gchar* title = g_strdup_printf("Dataset %d", i);
+        MockDeposition* deposition = mock_deposition_new(mock, title, ZENODO_MOCK_EPOCH + i);
+        g_free(title);
+
+        for (j = 0; j < mock->config.files; ++j) {
+            MockFile* file = g_new0(MockFile, 1);
+            gfal2_zenodo_mock_file_id(mock, i, j, file->id);
+            file->name = g_strdup_printf("file-%05d.dat", j);
+            file->size = mock->config.file_size;
+            g_strlcpy(file->md5, mock->pattern_md5, sizeof(file->md5));
+            file->modified = deposition->created;
+            g_ptr_array_add(deposition->files, file);
+        }
+    }
+}
+
+
+static MockFile* mock_find_file(MockDeposition* deposition, const char* id, const char* name)
+{
+    guint i;
+    for (i = 0; i < deposition->files->len; ++i) {
+        MockFile* file = g_ptr_array_index(deposition->files, i);
+        if ((id && strcmp(file->id, id) == 0) || (name && strcmp(file->name, name) == 0))
+            return file;
+    }
+    return NULL;
+}
+
+
+static MockDeposition* mock_find_deposition(ZenodoMock* mock, const char* id)
+{
+    char* end = NULL;
+    gint64 value = g_ascii_strtoll(id, &end, 10);
+    if (!*id || *end)
+        return NULL;
+    return g_hash_table_lookup(mock->by_id, &value);
+}
+
+
+// TLS credentials, made up for each run
+static int mock_setup_credentials(ZenodoMock* mock, GError** error)
+{
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    if (!pctx || EVP_PKEY_keygen_init(pctx) <= 0 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) <= 0 ||
+        EVP_PKEY_keygen(pctx, &mock->key) <= 0) {
+        EVP_PKEY_CTX_free(pctx);
+        g_set_error(error, mock_domain(), EIO, "Could not generate a key");
+        return -1;
+    }
+    EVP_PKEY_CTX_free(pctx);
+
+    mock->cert = X509_new();
+    X509_set_version(mock->cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(mock->cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(mock->cert), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(mock->cert), 30 * 86400);
+    X509_set_pubkey(mock->cert, mock->key);
+
+    X509_NAME* name = X509_get_subject_name(mock->cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(mock->cert, name);
+
+    X509V3_CTX v3;
+    X509V3_set_ctx_nodb(&v3);
+    X509V3_set_ctx(&v3, mock->cert, mock->cert, NULL, NULL, 0);
+    X509_EXTENSION* san = X509V3_EXT_conf_nid(NULL, &v3, NID_subject_alt_name,
+            "DNS:localhost,IP:127.0.0.1");
+    if (san) {
+        X509_add_ext(mock->cert, san, -1);
+        X509_EXTENSION_free(san);
+    }
+
+    if (X509_sign(mock->cert, mock->key, EVP_sha256()) <= 0) {
+        g_set_error(error, mock_domain(), EIO, "Could not sign the certificate");
+        return -1;
+    }
+
+    if (mock->config.tls) {
+        mock->ssl_ctx = SSL_CTX_new(TLS_server_method());
+        if (!mock->ssl_ctx || SSL_CTX_use_certificate(mock->ssl_ctx, mock->cert) <= 0 ||
+            SSL_CTX_use_PrivateKey(mock->ssl_ctx, mock->key) <= 0) {
+            g_set_error(error, mock_domain(), EIO, "Could not set up TLS");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Connection I/O
+ */
+
+static ssize_t mock_recv(MockConnection* conn, void* buffer, size_t size)
+{
+    if (conn->ssl)
+        return SSL_read(conn->ssl, buffer, size);
+    ssize_t ret;
+    do {
+        ret = recv(conn->fd, buffer, size, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+
+static int mock_send(MockConnection* conn, const void* buffer, size_t size)
+{
+    const char* p = buffer;
+    while (size > 0) {
+        ssize_t ret;
+        if (conn->ssl)
+            ret = SSL_write(conn->ssl, p, size);
+        else
+            ret = send(conn->fd, p, size, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR && !conn->ssl)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+
+// Read more into the input buffer. Returns what was read, <= 0 on EOF or error
+static ssize_t mock_fill(MockConnection* conn)
+{
+    if (conn->in_start == conn->in_end) {
+        conn->in_start = conn->in_end = 0;
+    }
+    else if (conn->in_end == sizeof(conn->in) && conn->in_start > 0) {
+        memmove(conn->in, conn->in + conn->in_start, conn->in_end - conn->in_start);
+        conn->in_end -= conn->in_start;
+        conn->in_start = 0;
+    }
+    if (conn->in_end == sizeof(conn->in))
+        return -1;
+    ssize_t ret = mock_recv(conn, conn->in + conn->in_end, sizeof(conn->in) - conn->in_end);
+    if (ret > 0)
+        conn->in_end += ret;
+    return ret;
+}
+
+
+// Read up to and including the terminator, which is not part of the result
+static gchar* mock_read_until(MockConnection* conn, const char* terminator)
+{
+    size_t tlen = strlen(terminator);
+    while (TRUE) {
+        char* start = conn->in + conn->in_start;
+        char* found = g_strstr_len(start, conn->in_end - conn->in_start, terminator);
+        if (found) {
+            gchar* result = g_strndup(start, found - start);
+            conn->in_start += (found - start) + tlen;
+            return result;
+        }
+        if (mock_fill(conn) <= 0)
+            return NULL;
+    }
+}
+
+
+static int mock_read_exact(MockConnection* conn, GByteArray* out, gint64 size)
+{
+    while (size > 0) {
+        if (conn->in_start == conn->in_end && mock_fill(conn) <= 0)
+            return -1;
+        size_t n = MIN((gint64)(conn->in_end - conn->in_start), size);
+        g_byte_array_append(out, (guint8*)conn->in + conn->in_start, n);
+        conn->in_start += n;
+        size -= n;
+    }
+    return 0;
+}
+
+
+/*
+ * Requests
+ */
+
+// Value of a request header, trimmed. 0 if found
+static int mock_header(const MockRequest* req, const char* name, char* value, size_t size)
+{
+    size_t nlen = strlen(name);
+    const char* line = strstr(req->head, "\r\n");
+    while (line) {
+        line += 2;
+        if (g_ascii_strncasecmp(line, name, nlen) == 0 && line[nlen] == ':') {
+            const char* p = line + nlen + 1;
+            while (*p == ' ' || *p == '\t')
+                ++p;
+            const char* end = strstr(p, "\r\n");
+            if (!end)
+                end = p + strlen(p);
+            while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+                --end;
+            g_strlcpy(value, p, MIN(size, (size_t)(end - p) + 1));
+            return 0;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return -1;
+}
+
+
+// Value of a query parameter, unescaped, to be freed. NULL if absent
+static gchar* mock_query_param(const MockRequest* req, const char* name)
+{
+    if (!req->query)
+        return NULL;
+    gchar** params = g_strsplit(req->query, "&", -1);
+    gchar* value = NULL;
+    size_t nlen = strlen(name);
+    int i;
+    for (i = 0; params[i] && !value; ++i) {
+        if (strncmp(params[i], name, nlen) == 0 && params[i][nlen] == '=') {
+            g_strdelimit(params[i] + nlen + 1, "+", ' ');
+            value = g_uri_unescape_string(params[i] + nlen + 1, NULL);
+        }
+    }
+    g_strfreev(params);
+    return value;
+}
+
+
+static void mock_request_clear(MockRequest* req)
+{
+    g_free(req->head);
+    g_free(req->path);
+    g_free(req->query);
+    g_strfreev(req->segments);
+    if (req->body)
+        g_byte_array_unref(req->body);
+    memset(req, 0, sizeof(*req));
+}
+
+
+// Read the head and the body of the next request. -1 if the connection is done
+static int mock_read_request(MockConnection* conn, MockRequest* req)
+{
+    char value[256];
+
+    req->head = mock_read_until(conn, "\r\n\r\n");
+    if (!req->head)
+        return -1;
+
+    char target[ZENODO_MOCK_BUFFER_SIZE];
+    char version[16];
+    if (sscanf(req->head, "%15s %16383s %15s", req->method, target, version) != 3)
+        return -1;
+
+    char* query = strchr(target, '?');
+    if (query) {
+        *query++ = '\0';
+        req->query = g_strdup(query);
+    }
+    req->path = g_strdup(target);
+
+    // Segments of the path, unescaped
+    gchar** raw = g_strsplit(target + (target[0] == '/'), "/", -1);
+    req->nsegments = g_strv_length(raw);
+    req->segments = g_new0(gchar*, req->nsegments + 1);
+    guint i;
+    for (i = 0; i < req->nsegments; ++i) {
+        req->segments[i] = g_uri_unescape_string(raw[i], NULL);
+        if (!req->segments[i])
+            req->segments[i] = g_strdup(raw[i]);
+    }
+    g_strfreev(raw);
+    if (req->nsegments > 0 && req->segments[req->nsegments - 1][0] == '\0') {
+        g_free(req->segments[--req->nsegments]);
+        req->segments[req->nsegments] = NULL;
+    }
+
+    req->close = strcmp(version, "HTTP/1.0") == 0;
+    if (mock_header(req, "Connection", value, sizeof(value)) == 0)
+        req->close = g_ascii_strcasecmp(value, "close") == 0;
+    if (mock_header(req, "Host", req->host, sizeof(req->host)) < 0)
+        snprintf(req->host, sizeof(req->host), "127.0.0.1:%d", conn->mock->port);
+
+    // Body
+    gboolean chunked = mock_header(req, "Transfer-Encoding", value, sizeof(value)) == 0 &&
+            g_ascii_strcasecmp(value, "chunked") == 0;
+    gint64 length = 0;
+    if (!chunked && mock_header(req, "Content-Length", value, sizeof(value)) == 0)
+        length = g_ascii_strtoll(value, NULL, 10);
+    if (length < 0 || length > ZENODO_MOCK_MAX_BODY)
+        return -1;
+    if (!chunked && length == 0)
+        return 0;
+
+    if (mock_header(req, "Expect", value, sizeof(value)) == 0 &&
+        g_ascii_strcasecmp(value, "100-continue") == 0) {
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (mock_send(conn, cont, sizeof(cont) - 1) < 0)
+            return -1;
+    }
+
+    req->body = g_byte_array_new();
+    if (!chunked)
+        return mock_read_exact(conn, req->body, length);
+
+    while (TRUE) {
+        gchar* line = mock_read_until(conn, "\r\n");
+        if (!line)
+            return -1;
+        gint64 size = g_ascii_strtoll(line, NULL, 16);
+        g_free(line);
+        if (size < 0 || req->body->len + size > ZENODO_MOCK_MAX_BODY)
+            return -1;
+        if (size == 0)
+            break;
+        if (mock_read_exact(conn, req->body, size) < 0)
+            return -1;
+        line = mock_read_until(conn, "\r\n");
+        if (!line)
+            return -1;
+        g_free(line);
+    }
+    // Trailers, up to the empty line
+    while (TRUE) {
+        gchar* line = mock_read_until(conn, "\r\n");
+        if (!line)
+            return -1;
+        gboolean empty = line[0] == '\0';
+        g_free(line);
+        if (empty)
+            return 0;
+    }
+}
+
+
+/*
+ * Responses
+ */
+
+static const char* mock_reason(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
+        case 503: return "Service Unavailable";
+        default:  return "Unknown";
+    }
+}
+
+
+static void mock_http_date(gint64 when, char* buffer, size_t size)
+{
+    time_t t = when;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buffer, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+
+static void mock_iso_date(gint64 when, char* buffer, size_t size)
+{
+    time_t t = when;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buffer, size, "%Y-%m-%dT%H:%M:%S.000000+00:00", &tm);
+}
+
+
+// Status line and headers. extra, if given, is a set of complete header lines
+static GString* mock_response_head(const MockRequest* req, int status, const char* content_type,
+        gint64 length, const char* extra)
+{
+    GString* head = g_string_sized_new(256);
+    g_string_append_printf(head, "HTTP/1.1 %d %s\r\n", status, mock_reason(status));
+    if (content_type)
+        g_string_append_printf(head, "Content-Type: %s\r\n", content_type);
+    if (status != 204 && status != 304)
+        g_string_append_printf(head, "Content-Length: %" G_GINT64_FORMAT "\r\n", length);
+    if (req->close)
+        g_string_append(head, "Connection: close\r\n");
+    if (extra)
+        g_string_append(head, extra);
+    g_string_append(head, "\r\n");
+    return head;
+}
+
+
+static void mock_count_status(ZenodoMock* mock, int status)
+{
+    if (status > 0 && status < ZENODO_MOCK_MAX_STATUS)
+        g_atomic_int_inc(&mock->statuses[status]);
+}
+
+
+static int mock_respond(MockConnection* conn, const MockRequest* req, int status,
+        const char* extra, const GString* body)
+{
+    mock_count_status(conn->mock, status);
+    GString* head = mock_response_head(req, status, body ? "application/json" : NULL,
+            body ? body->len : 0, extra);
+    if (body && strcmp(req->method, "HEAD") != 0 && status != 304)
+        g_string_append_len(head, body->str, body->len);
+    int ret = mock_send(conn, head->str, head->len);
+    g_string_free(head, TRUE);
+    return ret;
+}
+
+
+// What a handler answers, sent once the lock is released
+typedef struct {
+    int status;
+    GString* headers;
+    GString* body;
+    // JSON documents get an ETag, and a 304 if the client has them
+    gboolean etag;
+} MockResponse;
+
+
+static void mock_set_error(MockResponse* resp, int status, const char* message)
+{
+    resp->status = status;
+    resp->body = g_string_new(NULL);
+    g_string_printf(resp->body, "{\"status\": %d, \"message\": \"%s\"}", status, message);
+}
+
+
+static void mock_set_json(MockResponse* resp, int status, GString* body)
+{
+    resp->status = status;
+    resp->body = body;
+    resp->etag = TRUE;
+}
+
+
+static int mock_send_response(MockConnection* conn, const MockRequest* req, MockResponse* resp)
+{
+    if (!resp->headers)
+        resp->headers = g_string_new(NULL);
+
+    if (resp->etag) {
+        guint64 hash = 14695981039346656037ULL;
+        gsize i;
+        for (i = 0; i < resp->body->len; ++i)
+            hash = (hash ^ (guchar)resp->body->str[i]) * 1099511628211ULL;
+
+        char etag[64], match[256];
+        snprintf(etag, sizeof(etag), "W/\"%016" G_GINT64_MODIFIER "x\"", hash);
+        g_string_append_printf(resp->headers, "ETag: %s\r\n", etag);
+        if (resp->status == 200 && mock_header(req, "If-None-Match", match, sizeof(match)) == 0 &&
+            strstr(match, etag + 2))
+            resp->status = 304;
+    }
+
+    int ret = mock_respond(conn, req, resp->status, resp->headers->str, resp->body);
+    g_string_free(resp->headers, TRUE);
+    if (resp->body)
+        g_string_free(resp->body, TRUE);
+    return ret;
+}
+
+
+static void mock_json_string(GString* out, const char* value)
+{
+    g_string_append_c(out, '"');
+    for (; *value; ++value) {
+        guchar c = *value;
+        if (c == '"' || c == '\\')
+            g_string_append_printf(out, "\\%c", c);
+        else if (c < 0x20)
+            g_string_append_printf(out, "\\u%04x", c);
+        else
+            g_string_append_c(out, c);
+    }
+    g_string_append_c(out, '"');
+}
+
+
+static void mock_json_file(GString* out, const MockRequest* req, const MockDeposition* deposition,
+        const MockFile* file)
+{
+    gchar* escaped = g_uri_escape_string(file->name, NULL, FALSE);
+    g_string_append_printf(out, "{\"id\": \"%s\", \"filename\": ", file->id);
+    mock_json_string(out, file->name);
+    g_string_append_printf(out, ", \"filesize\": %" G_GINT64_FORMAT ", \"checksum\": \"%s\", "
+            "\"links\": {\"self\": \"https://%s/api/deposit/depositions/%" G_GINT64_FORMAT "/files/%s\", "
+            "\"download\": \"https://%s/api/files/%s/%s\"}}",
+            file->size, file->md5, req->host, deposition->id, file->id,
+            req->host, deposition->bucket, escaped);
+    g_free(escaped);
+}
+
+
+static void mock_json_deposition(GString* out, const MockRequest* req,
+        const MockDeposition* deposition)
+{
+    char created[64], modified[64];
+    mock_iso_date(deposition->created, created, sizeof(created));
+    mock_iso_date(deposition->modified, modified, sizeof(modified));
+
+    g_string_append_printf(out, "{\"id\": %" G_GINT64_FORMAT ", \"title\": ", deposition->id);
+    mock_json_string(out, deposition->title);
+    g_string_append_printf(out, ", \"created\": \"%s\", \"modified\": \"%s\", \"owner\": 1, "
+            "\"state\": \"unsubmitted\", \"submitted\": false, \"metadata\": {\"title\": ",
+            created, modified);
+    mock_json_string(out, deposition->title);
+    g_string_append(out, "}, \"files\": [");
+    guint i;
+    for (i = 0; i < deposition->files->len; ++i) {
+        if (i)
+            g_string_append(out, ", ");
+        mock_json_file(out, req, deposition, g_ptr_array_index(deposition->files, i));
+    }
+    g_string_append_printf(out, "], \"links\": {"
+            "\"self\": \"https://%s/api/deposit/depositions/%" G_GINT64_FORMAT "\", "
+            "\"bucket\": \"https://%s/api/files/%s\"}}",
+            req->host, deposition->id, req->host, deposition->bucket);
+}
+
+
+/*
+ * Handlers. They run with the mock lock held
+ */
+
+static void mock_list_depositions(ZenodoMock* mock, const MockRequest* req, MockResponse* resp)
+{
+    gchar* value;
+    int page = 1, size = 10;
+
+    if ((value = mock_query_param(req, "page"))) {
+        page = MAX(atoi(value), 1);
+        g_free(value);
+    }
+    if ((value = mock_query_param(req, "size"))) {
+        size = MAX(atoi(value), 1);
+        g_free(value);
+    }
+    if (mock->config.max_page_size > 0)
+        size = MIN(size, mock->config.max_page_size);
+    gchar* search = mock_query_param(req, "q");
+
+    GPtrArray* matches = g_ptr_array_new();
+    guint i;
+    for (i = 0; i < mock->depositions->len; ++i) {
+        MockDeposition* deposition = g_ptr_array_index(mock->depositions, i);
+        if (!search || strstr(deposition->title, search))
+            g_ptr_array_add(matches, deposition);
+    }
+    g_free(search);
+
+    GString* body = g_string_new("[");
+    guint first = (guint)(page - 1) * size;
+    for (i = first; i < matches->len && i < first + size; ++i) {
+        if (i > first)
+            g_string_append(body, ", ");
+        mock_json_deposition(body, req, g_ptr_array_index(matches, i));
+    }
+    g_string_append_c(body, ']');
+    mock_set_json(resp, 200, body);
+
+    int last = MAX(1, (int)((matches->len + size - 1) / size));
+    resp->headers = g_string_new(NULL);
+    g_string_append_printf(resp->headers, "X-Total-Count: %u\r\nLink: ", matches->len);
+    if (page < last)
+        g_string_append_printf(resp->headers,
+                "<https://%s/api/deposit/depositions?page=%d&size=%d>; rel=\"next\", ",
+                req->host, page + 1, size);
+    g_string_append_printf(resp->headers,
+            "<https://%s/api/deposit/depositions?page=%d&size=%d>; rel=\"last\"\r\n",
+            req->host, last, size);
+    g_ptr_array_free(matches, TRUE);
+}
+
+
+// Only the title is looked at
+static void mock_create_deposition(ZenodoMock* mock, const MockRequest* req, MockResponse* resp)
+{
+    gchar* title = NULL;
+
+    if (req->body) {
+        gchar* text = g_strndup((gchar*)req->body->data, req->body->len);
+        char* p = strstr(text, "\"title\"");
+        if (p && (p = strchr(p + 7, '"'))) {
+            char* end = strchr(++p, '"');
+            if (end)
+                title = g_strndup(p, end - p);
+        }
+        g_free(text);
+    }
+
+    MockDeposition* deposition = mock_deposition_new(mock, title ? title : "",
+            g_get_real_time() / G_USEC_PER_SEC);
+    g_free(title);
+
+    GString* body = g_string_new(NULL);
+    mock_json_deposition(body, req, deposition);
+    mock_set_json(resp, 201, body);
+}
+
+
+// The body has been hashed already, without the lock
+static void mock_upload(ZenodoMock* mock, const MockRequest* req, MockDeposition* deposition,
+        const char* name, const char* md5, MockResponse* resp)
+{
+    MockFile* file = mock_find_file(deposition, NULL, name);
+    if (!file) {
+        file = g_new0(MockFile, 1);
+        snprintf(file->id, sizeof(file->id), "%08x-ffff-4000-8000-%012" G_GINT64_MODIFIER "x",
+                0xf11e0000, mock->next_file++);
+        file->name = g_strdup(name);
+        g_ptr_array_add(deposition->files, file);
+    }
+    else if (file->data) {
+        g_byte_array_unref(file->data);
+    }
+    file->data = req->body ? g_byte_array_ref(req->body) : g_byte_array_new();
+    file->size = file->data->len;
+    g_strlcpy(file->md5, md5, sizeof(file->md5));
+    file->modified = deposition->modified = g_get_real_time() / G_USEC_PER_SEC;
+
+    resp->status = 201;
+    resp->body = g_string_new("{\"key\": ");
+    mock_json_string(resp->body, name);
+    g_string_append_printf(resp->body, ", \"size\": %" G_GINT64_FORMAT ", \"checksum\": \"md5:%s\", "
+            "\"mimetype\": \"application/octet-stream\"}", file->size, file->md5);
+}
+
+
+// Send the content of a file, honouring Range and If-Range
+// Called with the lock held, and releases it
+static int mock_download(MockConnection* conn, const MockRequest* req, MockFile* file)
+{
+    ZenodoMock* mock = conn->mock;
+    gint64 size = file->size, modified = file->modified;
+    GByteArray* data = file->data ? g_byte_array_ref(file->data) : NULL;
+    char etag[40], last_modified[64], range[128], if_range[128];
+    snprintf(etag, sizeof(etag), "\"%s\"", file->md5);
+    gint64 cut = -1;
+    if (strcmp(req->method, "HEAD") != 0) {
+        cut = mock->cut_next;
+        mock->cut_next = -1;
+    }
+    g_mutex_unlock(&mock->lock);
+
+    mock_http_date(modified, last_modified, sizeof(last_modified));
+
+    gint64 first = 0, last = size - 1;
+    gboolean ranged = mock_header(req, "Range", range, sizeof(range)) == 0 &&
+            strncmp(range, "bytes=", 6) == 0;
+    if (ranged && mock_header(req, "If-Range", if_range, sizeof(if_range)) == 0)
+        ranged = strcmp(if_range, etag) == 0 || strcmp(if_range, last_modified) == 0;
+    if (ranged) {
+        char* end = NULL;
+        first = g_ascii_strtoll(range + 6, &end, 10);
+        if (end && *end == '-' && g_ascii_isdigit(end[1]))
+            last = MIN(g_ascii_strtoll(end + 1, NULL, 10), size - 1);
+        if (first >= size || first > last) {
+            char extra[64];
+            snprintf(extra, sizeof(extra), "Content-Range: bytes */%" G_GINT64_FORMAT "\r\n", size);
+            if (data)
+                g_byte_array_unref(data);
+            mock_count_status(mock, 416);
+            GString* head = mock_response_head(req, 416, NULL, 0, extra);
+            int ret = mock_send(conn, head->str, head->len);
+            g_string_free(head, TRUE);
+            return ret;
+        }
+    }
+
+    GString* extra = g_string_new(NULL);
+    g_string_append_printf(extra, "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n",
+            etag, last_modified);
+    if (ranged)
+        g_string_append_printf(extra, "Content-Range: bytes %" G_GINT64_FORMAT "-%" G_GINT64_FORMAT
+                "/%" G_GINT64_FORMAT "\r\n", first, last, size);
+    mock_count_status(mock, ranged ? 206 : 200);
+    GString* head = mock_response_head(req, ranged ? 206 : 200, "application/octet-stream",
+            last - first + 1, extra->str);
+    g_string_free(extra, TRUE);
+    int ret = mock_send(conn, head->str, head->len);
+    g_string_free(head, TRUE);
+
+    // A cut download drops the connection after that many bytes of the body
+    gint64 end = last;
+    if (cut >= 0 && first + cut <= last)
+        end = first + cut - 1;
+    else
+        cut = -1;
+
+    gint64 offset = first;
+    while (ret == 0 && offset <= end && strcmp(req->method, "HEAD") != 0) {
+        const guint8* p;
+        size_t n;
+        if (data) {
+            p = data->data + offset;
+            n = end - offset + 1;
+        }
+        else {
+            size_t in_block = offset % ZENODO_MOCK_PATTERN_SIZE;
+            p = mock->pattern + in_block;
+            n = MIN(ZENODO_MOCK_PATTERN_SIZE - in_block, (size_t)(end - offset + 1));
+        }
+        ret = mock_send(conn, p, n);
+        offset += n;
+    }
+    if (data)
+        g_byte_array_unref(data);
+    return cut >= 0 ? -1 : ret;
+}
+
+
+static void mock_file_list(const MockRequest* req, MockDeposition* deposition, MockResponse* resp)
+{
+    GString* body = g_string_new("[");
+    guint i;
+    for (i = 0; i < deposition->files->len; ++i) {
+        if (i)
+            g_string_append(body, ", ");
+        mock_json_file(body, req, deposition, g_ptr_array_index(deposition->files, i));
+    }
+    g_string_append_c(body, ']');
+    mock_set_json(resp, 200, body);
+}
+
+
+// Requests under /api/deposit/depositions and /api/files
+static int mock_dispatch_api(MockConnection* conn, const MockRequest* req, MockResponse* resp)
+{
+    ZenodoMock* mock = conn->mock;
+    gchar** seg = req->segments;
+    guint n = req->nsegments;
+    const char* method = req->method;
+    gboolean get = strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0;
+    gboolean put = strcmp(method, "PUT") == 0;
+    gboolean delete = strcmp(method, "DELETE") == 0;
+
+    // Uploads are hashed before taking the lock
+    char md5[33] = {0};
+    if (put) {
+        EVP_MD_CTX* md = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(md, EVP_md5(), NULL);
+        if (req->body)
+            EVP_DigestUpdate(md, req->body->data, req->body->len);
+        mock_md5_hex(md, md5);
+        EVP_MD_CTX_free(md);
+    }
+
+    g_mutex_lock(&mock->lock);
+
+    if (strcmp(seg[1], "files") == 0) {
+        MockDeposition* deposition = g_hash_table_lookup(mock->by_bucket, seg[2]);
+        MockFile* file = NULL;
+        if (!deposition)
+            mock_set_error(resp, 404, "Bucket not found");
+        else if (put)
+            mock_upload(mock, req, deposition, seg[3], md5, resp);
+        else if (!get)
+            mock_set_error(resp, 405, "Method not allowed");
+        else if ((file = mock_find_file(deposition, NULL, seg[3])))
+            return mock_download(conn, req, file);
+        else
+            mock_set_error(resp, 404, "Object not found");
+        g_mutex_unlock(&mock->lock);
+        return 0;
+    }
+
+    MockDeposition* deposition = NULL;
+    MockFile* file = NULL;
+    gboolean files = n >= 5 && strcmp(seg[4], "files") == 0;
+
+    if (n >= 4 && !(deposition = mock_find_deposition(mock, seg[3])))
+        mock_set_error(resp, 404, "PID does not exist");
+    else if (n == 6 && files && !(file = mock_find_file(deposition, seg[5], NULL)))
+        mock_set_error(resp, 404, "File does not exist");
+    else if (n == 3 && get)
+        mock_list_depositions(mock, req, resp);
+    else if (n == 3 && strcmp(method, "POST") == 0)
+        mock_create_deposition(mock, req, resp);
+    else if (n == 4 && get) {
+        GString* body = g_string_new(NULL);
+        mock_json_deposition(body, req, deposition);
+        mock_set_json(resp, 200, body);
+    }
+    else if (n == 4 && delete) {
+        g_hash_table_remove(mock->by_id, &deposition->id);
+        g_hash_table_remove(mock->by_bucket, deposition->bucket);
+        g_ptr_array_remove(mock->depositions, deposition);
+        resp->status = 204;
+    }
+    else if (n == 5 && files && get)
+        mock_file_list(req, deposition, resp);
+    else if (file && get) {
+        GString* body = g_string_new(NULL);
+        mock_json_file(body, req, deposition, file);
+        mock_set_json(resp, 200, body);
+    }
+    else if (file && delete) {
+        deposition->modified = g_get_real_time() / G_USEC_PER_SEC;
+        g_ptr_array_remove(deposition->files, file);
+        resp->status = 204;
+    }
+    else
+        mock_set_error(resp, n > 6 ? 404 : 405, "Not supported");
+
+    g_mutex_unlock(&mock->lock);
+    return 0;
+}
+
+
+static int mock_dispatch(MockConnection* conn, const MockRequest* req)
+{
+    gchar** seg = req->segments;
+    guint n = req->nsegments;
+    gboolean get = strcmp(req->method, "GET") == 0 || strcmp(req->method, "HEAD") == 0;
+    MockResponse resp;
+    memset(&resp, 0, sizeof(resp));
+
+    if (n == 2 && strcmp(seg[0], "oauth") == 0 && strcmp(seg[1], "token") == 0) {
+        resp.status = 200;
+        resp.body = g_string_new("{\"access_token\": \"mock-token\", "
+                "\"token_type\": \"Bearer\", \"expires_in\": 3600}");
+    }
+    else if (n == 2 && strcmp(seg[0], "api") == 0 && strcmp(seg[1], "records") == 0 && get) {
+        mock_set_json(&resp, 200, g_string_new("{\"hits\": {\"hits\": [], \"total\": 0}, \"links\": {}}"));
+    }
+    else if ((n >= 3 && n <= 6 && strcmp(seg[0], "api") == 0 && strcmp(seg[1], "deposit") == 0 &&
+              strcmp(seg[2], "depositions") == 0) ||
+             (n == 4 && strcmp(seg[0], "api") == 0 && strcmp(seg[1], "files") == 0)) {
+        if (mock_dispatch_api(conn, req, &resp) < 0)
+            return -1;
+        // Downloads are sent by their handler
+        if (!resp.status)
+            return 0;
+    }
+    else {
+        mock_set_error(&resp, 404, "Not found");
+    }
+    return mock_send_response(conn, req, &resp);
+}
+
+
+static gpointer mock_connection_thread(gpointer data)
+{
+    MockConnection* conn = (MockConnection*)data;
+    ZenodoMock* mock = conn->mock;
+
+    if (mock->ssl_ctx) {
+        conn->ssl = SSL_new(mock->ssl_ctx);
+        SSL_set_fd(conn->ssl, conn->fd);
+        if (SSL_accept(conn->ssl) <= 0) {
+            SSL_free(conn->ssl);
+            conn->ssl = NULL;
+            goto done;
+        }
+    }
+
+    while (!g_atomic_int_get(&mock->stopping)) {
+        MockRequest req;
+        memset(&req, 0, sizeof(req));
+        if (mock_read_request(conn, &req) < 0) {
+            mock_request_clear(&req);
+            break;
+        }
+        g_atomic_int_inc(&mock->requests);
+
+        int delay = mock->config.latency_ms;
+        if (mock->config.jitter_ms > 0)
+            delay += g_random_int_range(0, mock->config.jitter_ms + 1);
+
+        int fail = 0;
+        g_mutex_lock(&mock->lock);
+        if (mock->observer)
+            mock->observer(req.method, req.path, req.head, mock->observer_data);
+        if (mock->delay_next > 0) {
+            --mock->delay_next;
+            delay += mock->delay_ms;
+        }
+        if (mock->fail_next > 0) {
+            --mock->fail_next;
+            fail = mock->fail_status;
+        }
+        g_mutex_unlock(&mock->lock);
+
+        if (delay > 0)
+            g_usleep(delay * 1000);
+
+        if (!fail && mock->config.error_rate > 0 && g_random_double() < mock->config.error_rate)
+            fail = 503;
+
+        int ret;
+        if (fail) {
+            MockResponse resp;
+            memset(&resp, 0, sizeof(resp));
+            mock_set_error(&resp, fail, "Injected failure");
+            ret = mock_send_response(conn, &req, &resp);
+        }
+        else {
+            ret = mock_dispatch(conn, &req);
+        }
+
+        gboolean close = req.close;
+        mock_request_clear(&req);
+        if (ret < 0 || close)
+            break;
+    }
+
+    if (conn->ssl) {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+    }
+done:
+    g_mutex_lock(&mock->connections_lock);
+    mock->connections = g_list_remove(mock->connections, conn);
+    g_cond_broadcast(&mock->connections_cond);
+    g_mutex_unlock(&mock->connections_lock);
+    close(conn->fd);
+    g_free(conn);
+    return NULL;
+}
+
+
+static gpointer mock_accept_thread(gpointer data)
+{
+    ZenodoMock* mock = (ZenodoMock*)data;
+
+    while (!g_atomic_int_get(&mock->stopping)) {
+        int fd = accept(mock->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        MockConnection* conn = g_new0(MockConnection, 1);
+        conn->mock = mock;
+        conn->fd = fd;
+
+        g_mutex_lock(&mock->connections_lock);
+        mock->connections = g_list_prepend(mock->connections, conn);
+        ++mock->accepted;
+        g_mutex_unlock(&mock->connections_lock);
+
+        g_thread_unref(g_thread_new("zenodo-mock-conn", mock_connection_thread, conn));
+    }
+    return NULL;
+}
+
+
+void gfal2_zenodo_mock_config_defaults(ZenodoMockConfig* config)
+{
+    memset(config, 0, sizeof(*config));
+    config->tls = TRUE;
+    config->depositions = 100;
+    config->files = 10;
+    config->file_size = 1048576;
+    config->max_page_size = 100;
+}
+
+
+ZenodoMock* gfal2_zenodo_mock_start(const ZenodoMockConfig* config, GError** error)
+{
+    ZenodoMock* mock = g_new0(ZenodoMock, 1);
+    mock->config = *config;
+    mock->listen_fd = -1;
+    mock->next_id = ZENODO_MOCK_FIRST_ID;
+    mock->cut_next = -1;
+    g_mutex_init(&mock->lock);
+    g_mutex_init(&mock->connections_lock);
+    g_cond_init(&mock->connections_cond);
+    mock->depositions = g_ptr_array_new_with_free_func(mock_deposition_free);
+    mock->by_id = g_hash_table_new(g_int64_hash, g_int64_equal);
+    mock->by_bucket = g_hash_table_new(g_str_hash, g_str_equal);
+    // SSL_write goes through write(), so a client hanging up in the middle
+    // of a response, as a cancelled hedge does, must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    if (mock_setup_credentials(mock, error) < 0) {
+        gfal2_zenodo_mock_stop(mock);
+        return NULL;
+    }
+    mock_setup_pattern(mock);
+    mock_populate(mock);
+
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(config->port);
+
+    int one = 1;
+    mock->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (mock->listen_fd < 0 ||
+        setsockopt(mock->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        bind(mock->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(mock->listen_fd, 128) < 0 ||
+        getsockname(mock->listen_fd, (struct sockaddr*)&addr, &addrlen) < 0) {
+        g_set_error(error, mock_domain(), errno, "Could not listen on port %d: %s",
+                config->port, g_strerror(errno));
+        gfal2_zenodo_mock_stop(mock);
+        return NULL;
+    }
+    mock->port = ntohs(addr.sin_port);
+
+    mock->acceptor = g_thread_new("zenodo-mock", mock_accept_thread, mock);
+    return mock;
+}
+
+
+void gfal2_zenodo_mock_stop(ZenodoMock* mock)
+{
+    if (!mock)
+        return;
+    g_atomic_int_set(&mock->stopping, 1);
+
+    if (mock->listen_fd >= 0)
+        shutdown(mock->listen_fd, SHUT_RDWR);
+    if (mock->acceptor)
+        g_thread_join(mock->acceptor);
+    if (mock->listen_fd >= 0)
+        close(mock->listen_fd);
+
+    // Wake up the connections waiting for a request, and wait for them to go
+    g_mutex_lock(&mock->connections_lock);
+    GList* i;
+    for (i = mock->connections; i; i = i->next)
+        shutdown(((MockConnection*)i->data)->fd, SHUT_RDWR);
+    while (mock->connections)
+        g_cond_wait(&mock->connections_cond, &mock->connections_lock);
+    g_mutex_unlock(&mock->connections_lock);
+
+    g_hash_table_destroy(mock->by_id);
+    g_hash_table_destroy(mock->by_bucket);
+    g_ptr_array_free(mock->depositions, TRUE);
+    if (mock->ssl_ctx)
+        SSL_CTX_free(mock->ssl_ctx);
+    X509_free(mock->cert);
+    EVP_PKEY_free(mock->key);
+    g_mutex_clear(&mock->lock);
+    g_mutex_clear(&mock->connections_lock);
+    g_cond_clear(&mock->connections_cond);
+    g_free(mock);
+}
+
+
+int gfal2_zenodo_mock_port(ZenodoMock* mock)
+{
+    return mock->port;
+}
+
+
+gint64 gfal2_zenodo_mock_deposition_id(ZenodoMock* mock, int deposition)
+{
+    return ZENODO_MOCK_FIRST_ID + deposition;
+}
+
+
+void gfal2_zenodo_mock_file_id(ZenodoMock* mock, int deposition, int file, char* id)
+{
+    snprintf(id, 37, "%08x-0000-4000-8000-%012x", deposition, file);
+}
+
+
+const char* gfal2_zenodo_mock_file_md5(ZenodoMock* mock)
+{
+    return mock->pattern_md5;
+}
+
+
+GString* gfal2_zenodo_mock_deposition_page(ZenodoMock* mock, int first, int count)
+{
+    MockRequest req;
+    memset(&req, 0, sizeof(req));
+    snprintf(req.host, sizeof(req.host), "127.0.0.1:%d", mock->port);
+
+    GString* body = g_string_new("[");
+    g_mutex_lock(&mock->lock);
+    int i;
+    for (i = first; i < (int)mock->depositions->len && i < first + count; ++i) {
+        if (i > first)
+            g_string_append(body, ", ");
+        mock_json_deposition(body, &req, g_ptr_array_index(mock->depositions, i));
+    }
+    g_mutex_unlock(&mock->lock);
+    g_string_append_c(body, ']');
+    return body;
+}
+
+
+int gfal2_zenodo_mock_write_credentials(ZenodoMock* mock, const char* cert_path,
+        const char* key_path, GError** error)
+{
+    FILE* cert = fopen(cert_path, "w");
+    FILE* key = fopen(key_path, "w");
+    int ret = 0;
+
+    if (!cert || !key || PEM_write_X509(cert, mock->cert) <= 0 ||
+        PEM_write_PrivateKey(key, mock->key, NULL, NULL, 0, NULL, NULL) <= 0) {
+        g_set_error(error, mock_domain(), EIO, "Could not write %s and %s", cert_path, key_path);
+        ret = -1;
+    }
+    if (cert)
+        fclose(cert);
+    if (key)
+        fclose(key);
+    return ret;
+}
+
+
+void gfal2_zenodo_mock_counters(ZenodoMock* mock, guint64* requests, guint64* connections)
+{
+    *requests = (guint)g_atomic_int_get(&mock->requests);
+    g_mutex_lock(&mock->connections_lock);
+    *connections = mock->accepted;
+    g_mutex_unlock(&mock->connections_lock);
+}
+
+
+void gfal2_zenodo_mock_fail_next(ZenodoMock* mock, int count, int status)
+{
+    g_mutex_lock(&mock->lock);
+    mock->fail_next = count;
+    mock->fail_status = status;
+    g_mutex_unlock(&mock->lock);
+}
+
+
+void gfal2_zenodo_mock_delay_next(ZenodoMock* mock, int count, int ms)
+{
+    g_mutex_lock(&mock->lock);
+    mock->delay_next = count;
+    mock->delay_ms = ms;
+    g_mutex_unlock(&mock->lock);
+}
+
+
+void gfal2_zenodo_mock_cut_next_download(ZenodoMock* mock, gint64 bytes)
+{
+    g_mutex_lock(&mock->lock);
+    mock->cut_next = bytes;
+    g_mutex_unlock(&mock->lock);
+}
+
+
+void gfal2_zenodo_mock_observe(ZenodoMock* mock, ZenodoMockObserver observer, gpointer data)
+{
+    g_mutex_lock(&mock->lock);
+    mock->observer = observer;
+    mock->observer_data = data;
+    g_mutex_unlock(&mock->lock);
+}
+
+
+guint64 gfal2_zenodo_mock_responses(ZenodoMock* mock, int status)
+{
+    if (status <= 0 || status >= ZENODO_MOCK_MAX_STATUS)
+        return 0;
+    return (guint)g_atomic_int_get(&mock->statuses[status]);
+}
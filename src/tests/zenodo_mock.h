@@ -0,0 +1,118 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+#pragma once
+#ifndef _GFAL_ZENODO_MOCK_H
+#define _GFAL_ZENODO_MOCK_H
+
+#include <glib.h>
+
+/*
+ * In process imitation of the Zenodo deposit API, for benchmarks and tests
+ * It speaks HTTP/1.1 with keep-alive, over TLS with a self-signed certificate
+ * or in clear, i.e. behind a proxy that terminates TLS and HTTP/2
+ * Depositions and files are generated from the configuration. The content of
+ * the generated files is a fixed pattern, so nothing big is kept in memory,
+ * while uploaded files are kept as sent
+ */
+typedef struct {
+    // 0 takes any free port
+    int port;
+    gboolean tls;
+    int depositions;
+    int files;
+    gint64 file_size;
+    // Pages are never longer than this, whatever size the client asks for
+    int max_page_size;
+    // Added to every response, in milliseconds
+    int latency_ms;
+    int jitter_ms;
+    // Fraction of the requests answered with 503
+    double error_rate;
+} ZenodoMockConfig;
+
+typedef struct ZenodoMock ZenodoMock;
+
+void gfal2_zenodo_mock_config_defaults(ZenodoMockConfig* config);
+
+/*
+ * Starts listening on 127.0.0.1, and serving from a background thread
+ */
+ZenodoMock* gfal2_zenodo_mock_start(const ZenodoMockConfig* config, GError** error);
+void gfal2_zenodo_mock_stop(ZenodoMock* mock);
+
+int gfal2_zenodo_mock_port(ZenodoMock* mock);
+
+/*
+ * Ids of the generated depositions and files, by index
+ * The file id is written into id, which must hold 37 bytes
+ */
+gint64 gfal2_zenodo_mock_deposition_id(ZenodoMock* mock, int deposition);
+void gfal2_zenodo_mock_file_id(ZenodoMock* mock, int deposition, int file, char* id);
+
+/*
+ * MD5 of the generated files, as hex
+ */
+const char* gfal2_zenodo_mock_file_md5(ZenodoMock* mock);
+
+/*
+ * A page of the listing of depositions, as the server sends it
+ */
+GString* gfal2_zenodo_mock_deposition_page(ZenodoMock* mock, int first, int count);
+
+/*
+ * Write the certificate and key in PEM, so a proxy can present them
+ */
+int gfal2_zenodo_mock_write_credentials(ZenodoMock* mock, const char* cert_path,
+        const char* key_path, GError** error);
+
+/*
+ * Requests served and connections accepted so far
+ */
+void gfal2_zenodo_mock_counters(ZenodoMock* mock, guint64* requests, guint64* connections);
+
+/*
+ * Responses sent so far with this status
+ */
+guint64 gfal2_zenodo_mock_responses(ZenodoMock* mock, int status);
+
+/*
+ * Fault injection, for the tests. Each applies to the next requests
+ * received, whatever they are, and replaces what was left of the previous
+ * call
+ * The next count requests are answered with status, and not processed
+ */
+void gfal2_zenodo_mock_fail_next(ZenodoMock* mock, int count, int status);
+
+/*
+ * The next count requests are answered ms later than the others
+ */
+void gfal2_zenodo_mock_delay_next(ZenodoMock* mock, int count, int ms);
+
+/*
+ * The next download sends this many bytes of its body, and drops the connection
+ */
+void gfal2_zenodo_mock_cut_next_download(ZenodoMock* mock, gint64 bytes);
+
+/*
+ * Called with the method, path and head of each request as it is received,
+ * from the thread of its connection, and with the mock locked, so it must not
+ * call back into it. NULL stops it
+ */
+typedef void (*ZenodoMockObserver)(const char* method, const char* path, const char* head,
+        gpointer data);
+void gfal2_zenodo_mock_observe(ZenodoMock* mock, ZenodoMockObserver observer, gpointer data);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Standalone mock Zenodo server, i.e. for gfal-ls or a manual benchmark
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "zenodo_mock.h"
+
+
+int main(int argc, char** argv)
+{
+    ZenodoMockConfig config;
+    gfal2_zenodo_mock_config_defaults(&config);
+    gboolean plain = FALSE;
+    gint64 file_size = config.file_size;
+    gchar* cert_path = NULL;
+    gchar* key_path = NULL;
+    GError* error = NULL;
+
+    GOptionEntry entries[] = {
+        {"port", 'p', 0, G_OPTION_ARG_INT, &config.port, "Port to listen on, 0 for any", "PORT"},
+        {"plain", 0, 0, G_OPTION_ARG_NONE, &plain, "Speak HTTP without TLS, i.e. behind a proxy", NULL},
+        {"depositions", 'd', 0, G_OPTION_ARG_INT, &config.depositions, "Number of depositions", "N"},
+        {"files", 'f', 0, G_OPTION_ARG_INT, &config.files, "Files per deposition", "N"},
+        {"file-size", 's', 0, G_OPTION_ARG_INT64, &file_size, "Size of each file, in bytes", "BYTES"},
+        {"max-page-size", 0, 0, G_OPTION_ARG_INT, &config.max_page_size, "Longest page served", "N"},
+        {"latency", 'l', 0, G_OPTION_ARG_INT, &config.latency_ms, "Added to each response", "MS"},
+        {"jitter", 'j', 0, G_OPTION_ARG_INT, &config.jitter_ms, "Random extra latency", "MS"},
+        {"error-rate", 'e', 0, G_OPTION_ARG_DOUBLE, &config.error_rate, "Fraction of 503 answers", "RATE"},
+        {"cert", 0, 0, G_OPTION_ARG_FILENAME, &cert_path, "Write the certificate here", "PATH"},
+        {"key", 0, 0, G_OPTION_ARG_FILENAME, &key_path, "Write the private key here", "PATH"},
+        {NULL}
+    };
+
+    GOptionContext* options = g_option_context_new(NULL);
+    g_option_context_set_summary(options, "Imitation of the Zenodo deposit API");
+    g_option_context_add_main_entries(options, entries, NULL);
+    if (!g_option_context_parse(options, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(options);
+    config.tls = !plain;
+    config.file_size = file_size;
+
+    // Block the signals before any thread starts, so sigwait gets them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    ZenodoMock* mock = gfal2_zenodo_mock_start(&config, &error);
+    if (!mock) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    if (cert_path && key_path &&
+        gfal2_zenodo_mock_write_credentials(mock, cert_path, key_path, &error) < 0) {
+        fprintf(stderr, "%s\n", error->message);
+        gfal2_zenodo_mock_stop(mock);
+        return 1;
+    }
+
+    printf("Listening on %s://127.0.0.1:%d\n", plain ? "http" : "https",
+            gfal2_zenodo_mock_port(mock));
+    printf("First deposition: %" G_GINT64_FORMAT "\n", gfal2_zenodo_mock_deposition_id(mock, 0));
+    fflush(stdout);
+
+    int sig;
+    sigwait(&signals, &sig);
+
+    guint64 requests, connections;
+    gfal2_zenodo_mock_counters(mock, &requests, &connections);
+    printf("Served %" G_GUINT64_FORMAT " requests over %" G_GUINT64_FORMAT " connections\n",
+            requests, connections);
+    gfal2_zenodo_mock_stop(mock);
+    g_free(cert_path);
+    g_free(key_path);
+    return 0;
+}
@@ -0,0 +1,676 @@
+/*
+ *  Copyright 2014 CERN
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+**/
+
+// Behaviour of the plugin against the mock Zenodo server
+//
+//   cmake . && make && ctest                      one ctest per case
+//   src/tests/gfal2-zenodo-test                   all the tests
+//   src/tests/gfal2-zenodo-test retry_backoff     only some
+//
+// Each test gets its own mock and gfal2 context, configured by a [ZENODO]
+// section written to a temporary GFAL_CONFIG_DIR, as the benchmark does.
+// Faults are injected by the mock, and what the plugin did is told by the
+// requests the mock saw and by the zenodo.stats attribute of the root
+
+#include <fcntl.h>
+#include <gfal_api.h>
+#include <glib/gstdio.h>
+#include <json.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "zenodo_mock.h"
+
+#define TEST_STATS_SIZE 65536
+#define TEST_THREADS 8
+
+
+typedef struct {
+    ZenodoMock* mock;
+    ZenodoMockConfig mock_config;
+    gfal2_context_t context;
+    gchar* config_dir;
+    char base[128];
+    const char* const* options;
+    GError* error;
+} Test;
+
+typedef struct {
+    const char* name;
+    // Settings of the [ZENODO] section, besides the access token
+    const char* options[8];
+    int (*run)(Test* test);
+} TestCase;
+
+
+#define TEST_ASSERT(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            return -1; \
+        } \
+    } while (0)
+
+// A gfal2 call that must succeed
+#define TEST_CALL(test, call) \
+    do { \
+        if ((call) < 0) { \
+            fprintf(stderr, "%s:%d: %s: %s\n", __FILE__, __LINE__, #call, \
+                    (test)->error ? (test)->error->message : "failed"); \
+            g_clear_error(&(test)->error); \
+            return -1; \
+        } \
+    } while (0)
+
+// A gfal2 call that must fail, with expected as errno if it is not 0
+#define TEST_FAIL(test, call, expected) \
+    do { \
+        int ret_ = (call); \
+        int code_ = (test)->error ? (test)->error->code : 0; \
+        g_clear_error(&(test)->error); \
+        if (ret_ >= 0 || ((expected) != 0 && code_ != (expected))) { \
+            fprintf(stderr, "%s:%d: %s: returned %d, errno %d instead of %d\n", \
+                    __FILE__, __LINE__, #call, ret_, code_, (expected)); \
+            return -1; \
+        } \
+    } while (0)
+
+
+/*
+ * Helpers
+ */
+
+static void test_deposition_url(Test* test, int deposition, char* url, size_t size)
+{
+    snprintf(url, size, "%s/%" G_GINT64_FORMAT, test->base,
+            gfal2_zenodo_mock_deposition_id(test->mock, deposition));
+}
+
+
+static void test_file_url(Test* test, int deposition, int file, char* url, size_t size)
+{
+    char id[37];
+    gfal2_zenodo_mock_file_id(test->mock, deposition, file, id);
+    snprintf(url, size, "%s/%" G_GINT64_FORMAT "/%s", test->base,
+            gfal2_zenodo_mock_deposition_id(test->mock, deposition), id);
+}
+
+
+// A file that is not there until a test writes it
+static void test_created_url(Test* test, int deposition, char* url, size_t size)
+{
+    snprintf(url, size, "%s/%" G_GINT64_FORMAT "/created.dat", test->base,
+            gfal2_zenodo_mock_deposition_id(test->mock, deposition));
+}
+
+
+static guint64 test_requests(Test* test)
+{
+    guint64 requests, connections;
+    gfal2_zenodo_mock_counters(test->mock, &requests, &connections);
+    return requests;
+}
+
+
+// Write the configuration, and create a context that reads it
+static gfal2_context_t test_context_new(Test* test, const char* extra, GError** error)
+{
+    GString* config = g_string_new("[ZENODO]\nACCESS_TOKEN=mock-token\n");
+    int i;
+    for (i = 0; test->options[i]; ++i)
+        g_string_append_printf(config, "%s\n", test->options[i]);
+    if (extra)
+        g_string_append_printf(config, "%s\n", extra);
+    g_string_append(config, "\n[HTTP PLUGIN]\nINSECURE=true\n");
+
+    gchar* path = g_build_filename(test->config_dir, "zenodo_plugin.conf", NULL);
+    gboolean ok = g_file_set_contents(path, config->str, config->len, error);
+    g_free(path);
+    g_string_free(config, TRUE);
+    return ok ? gfal2_context_new(error) : NULL;
+}
+
+
+// A counter of the zenodo.stats document, by its path. -1 if it is not there
+static gint64 test_stats(Test* test, const char* first, ...)
+{
+    char url[GFAL_URL_MAX_LEN];
+    snprintf(url, sizeof(url), "%s/", test->base);
+    char* buffer = g_malloc0(TEST_STATS_SIZE);
+    GError* error = NULL;
+    ssize_t ret = gfal2_getxattr(test->context, url, "zenodo.stats", buffer,
+            TEST_STATS_SIZE - 1, &error);
+    if (ret < 0) {
+        fprintf(stderr, "Could not get zenodo.stats: %s\n", error->message);
+        g_error_free(error);
+        g_free(buffer);
+        return -1;
+    }
+
+    json_object* root = json_tokener_parse(buffer);
+    g_free(buffer);
+    json_object* node = root;
+    va_list args;
+    va_start(args, first);
+    const char* key;
+    for (key = first; key && node; key = va_arg(args, const char*))
+        if (!json_object_object_get_ex(node, key, &node))
+            node = NULL;
+    va_end(args);
+
+    gint64 value = node ? json_object_get_int64(node) : -1;
+    json_object_put(root);
+    return value;
+}
+
+
+// Number of entries, or -1
+static int test_list(Test* test, const char* url)
+{
+    DIR* dir = gfal2_opendir(test->context, url, &test->error);
+    if (!dir)
+        return -1;
+    int entries = 0;
+    while (gfal2_readdir(test->context, dir, &test->error))
+        ++entries;
+    gfal2_closedir(test->context, dir, NULL);
+    return test->error ? -1 : entries;
+}
+
+
+static int test_write(gfal2_context_t context, const char* url, gint64 size, GError** error)
+{
+    int fd = gfal2_open2(context, url, O_WRONLY | O_CREAT, 0644, error);
+    if (fd < 0)
+        return -1;
+
+    char buffer[4096];
+    memset(buffer, 'z', sizeof(buffer));
+    ssize_t ret = 0;
+    while (size > 0 && ret >= 0) {
+        ret = gfal2_write(context, fd, buffer, MIN(size, (gint64)sizeof(buffer)), error);
+        size -= MAX(ret, 0);
+    }
+    // Errors of the upload are reported by close
+    if (gfal2_close(context, fd, ret < 0 ? NULL : error) < 0 || ret < 0)
+        return -1;
+    return 0;
+}
+
+
+// Read the whole file, and put its MD5 in md5, as hex
+static int test_read_md5(Test* test, const char* url, char* md5, size_t size)
+{
+    int fd = gfal2_open(test->context, url, O_RDONLY, &test->error);
+    if (fd < 0)
+        return -1;
+
+    GChecksum* checksum = g_checksum_new(G_CHECKSUM_MD5);
+    guchar buffer[65536];
+    ssize_t ret;
+    while ((ret = gfal2_read(test->context, fd, buffer, sizeof(buffer), &test->error)) > 0)
+        g_checksum_update(checksum, buffer, ret);
+    g_strlcpy(md5, g_checksum_get_string(checksum), size);
+    g_checksum_free(checksum);
+
+    if (gfal2_close(test->context, fd, ret < 0 ? NULL : &test->error) < 0 || ret < 0)
+        return -1;
+    return 0;
+}
+
+
+/*
+ * Tests
+ */
+
+// Entries are reused until something changes them through the plugin
+static int test_cache_invalidation(Test* test)
+{
+    char deposition[GFAL_URL_MAX_LEN], file[GFAL_URL_MAX_LEN], created[GFAL_URL_MAX_LEN];
+    struct stat st;
+    test_deposition_url(test, 0, deposition, sizeof(deposition));
+    test_file_url(test, 0, 0, file, sizeof(file));
+    test_created_url(test, 0, created, sizeof(created));
+
+    TEST_CALL(test, gfal2_stat(test->context, file, &st, &test->error));
+    TEST_CALL(test, gfal2_stat(test->context, deposition, &st, &test->error));
+    guint64 before = test_requests(test);
+    TEST_CALL(test, gfal2_stat(test->context, file, &st, &test->error));
+    TEST_ASSERT(st.st_size == test->mock_config.file_size);
+    TEST_CALL(test, gfal2_stat(test->context, deposition, &st, &test->error));
+    TEST_ASSERT(test_requests(test) == before);
+    TEST_ASSERT(test_stats(test, "stat_cache", "hits", NULL) >= 2);
+
+    // Missing files are remembered until they are written
+    TEST_FAIL(test, gfal2_stat(test->context, created, &st, &test->error), ENOENT);
+    before = test_requests(test);
+    TEST_FAIL(test, gfal2_stat(test->context, created, &st, &test->error), ENOENT);
+    TEST_ASSERT(test_requests(test) == before);
+
+    // Which changes their deposition too
+    time_t modified = st.st_mtime;
+    TEST_CALL(test, test_write(test->context, created, 1000, &test->error));
+    TEST_CALL(test, gfal2_stat(test->context, created, &st, &test->error));
+    TEST_ASSERT(st.st_size == 1000);
+    TEST_CALL(test, gfal2_stat(test->context, deposition, &st, &test->error));
+    TEST_ASSERT(st.st_mtime > modified);
+
+    // Deleted files are forgotten
+    TEST_CALL(test, gfal2_unlink(test->context, file, &test->error));
+    TEST_FAIL(test, gfal2_stat(test->context, file, &st, &test->error), ENOENT);
+    TEST_ASSERT(test_list(test, deposition) == test->mock_config.files);
+    return 0;
+}
+
+
+static int test_retry_backoff(Test* test)
+{
+    char url[GFAL_URL_MAX_LEN];
+    struct stat st;
+    test_deposition_url(test, 0, url, sizeof(url));
+
+    // Two 503 are retried after [50, 100] then [100, 200] ms
+    gfal2_zenodo_mock_fail_next(test->mock, 2, 503);
+    guint64 before = test_requests(test);
+    gint64 start = g_get_monotonic_time();
+    TEST_CALL(test, gfal2_stat(test->context, url, &st, &test->error));
+    gint64 elapsed = g_get_monotonic_time() - start;
+    TEST_ASSERT(test_requests(test) - before == 3);
+    TEST_ASSERT(elapsed >= 150 * 1000);
+    TEST_ASSERT(test_stats(test, "operations", "stat", "retries", NULL) == 2);
+
+    // Up to RETRY_MAX times
+    gfal2_zenodo_mock_fail_next(test->mock, 10, 503);
+    before = test_requests(test);
+    TEST_FAIL(test, gfal2_stat(test->context, url, &st, &test->error), 0);
+    TEST_ASSERT(test_requests(test) - before == 4);
+
+    // Other failures are final
+    gfal2_zenodo_mock_fail_next(test->mock, 1, 404);
+    before = test_requests(test);
+    TEST_FAIL(test, gfal2_stat(test->context, url, &st, &test->error), ENOENT);
+    TEST_ASSERT(test_requests(test) - before == 1);
+
+    TEST_CALL(test, gfal2_stat(test->context, url, &st, &test->error));
+    return 0;
+}
+
+
+static int test_name_resolution(Test* test)
+{
+    char url[GFAL_URL_MAX_LEN];
+    struct stat by_id, by_name;
+
+    // Title and filename of generated entries
+    test_file_url(test, 1, 2, url, sizeof(url));
+    TEST_CALL(test, gfal2_stat(test->context, url, &by_id, &test->error));
+    snprintf(url, sizeof(url), "%s/Dataset%%201/file-00002.dat", test->base);
+    TEST_CALL(test, gfal2_stat(test->context, url, &by_name, &test->error));
+    TEST_ASSERT(by_name.st_size == by_id.st_size && by_name.st_mtime == by_id.st_mtime);
+
+    // Colons in names are not separators
+    snprintf(url, sizeof(url), "%s/Run:2024", test->base);
+    TEST_CALL(test, gfal2_mkdir(test->context, url, 0755, &test->error));
+    TEST_CALL(test, gfal2_stat(test->context, url, &by_name, &test->error));
+    TEST_ASSERT(S_ISDIR(by_name.st_mode));
+    snprintf(url, sizeof(url), "%s/Run:2024/a:b.txt", test->base);
+    TEST_CALL(test, test_write(test->context, url, 10, &test->error));
+    TEST_CALL(test, gfal2_stat(test->context, url, &by_name, &test->error));
+    TEST_ASSERT(by_name.st_size == 10);
+
+    // Names that look like ids need an empty id
+    snprintf(url, sizeof(url), "%s/:2024", test->base);
+    TEST_CALL(test, gfal2_mkdir(test->context, url, 0755, &test->error));
+    TEST_CALL(test, gfal2_stat(test->context, url, &by_name, &test->error));
+    TEST_ASSERT(S_ISDIR(by_name.st_mode));
+    snprintf(url, sizeof(url), "%s/2024", test->base);
+    TEST_FAIL(test, gfal2_stat(test->context, url, &by_name, &test->error), ENOENT);
+
+    snprintf(url, sizeof(url), "%s/Dataset%%201/missing.dat", test->base);
+    TEST_FAIL(test, gfal2_stat(test->context, url, &by_name, &test->error), ENOENT);
+    return 0;
+}
+
+
+// Listings are revalidated, and reused when the server answers 304
+static int test_etag_revalidation(Test* test)
+{
+    char url[GFAL_URL_MAX_LEN], created[GFAL_URL_MAX_LEN];
+    test_deposition_url(test, 0, url, sizeof(url));
+
+    TEST_ASSERT(test_list(test, url) == test->mock_config.files);
+    guint64 not_modified = gfal2_zenodo_mock_responses(test->mock, 304);
+    TEST_ASSERT(test_list(test, url) == test->mock_config.files);
+    TEST_ASSERT(gfal2_zenodo_mock_responses(test->mock, 304) > not_modified);
+    TEST_ASSERT(test_stats(test, "revalidation", "not_modified", NULL) > 0);
+
+    // A change is seen
+    test_created_url(test, 0, created, sizeof(created));
+    TEST_CALL(test, test_write(test->context, created, 10, &test->error));
+    TEST_ASSERT(test_list(test, url) == test->mock_config.files + 1);
+    return 0;
+}
+
+
+static void test_count_if_range(const char* method, const char* path, const char* head,
+        gpointer data)
+{
+    if (strstr(head, "\r\nIf-Range:"))
+        g_atomic_int_inc((volatile gint*)data);
+}
+
+
+// A broken download continues where it stopped, not from the start
+static int test_download_resume(Test* test)
+{
+    char url[GFAL_URL_MAX_LEN], md5[33];
+    volatile gint if_range = 0;
+    test_file_url(test, 0, 0, url, sizeof(url));
+
+    gfal2_zenodo_mock_observe(test->mock, test_count_if_range, (gpointer)&if_range);
+    gfal2_zenodo_mock_cut_next_download(test->mock, 300000);
+    int ret = test_read_md5(test, url, md5, sizeof(md5));
+    gfal2_zenodo_mock_observe(test->mock, NULL, NULL);
+
+    TEST_CALL(test, ret);
+    TEST_ASSERT(strcmp(md5, gfal2_zenodo_mock_file_md5(test->mock)) == 0);
+    TEST_ASSERT(g_atomic_int_get(&if_range) > 0);
+    TEST_ASSERT(gfal2_zenodo_mock_responses(test->mock, 206) > 1);
+    return 0;
+}
+
+
+// A request much slower than usual is sent again, and the copy answers first
+static int test_hedging(Test* test)
+{
+    char url[GFAL_URL_MAX_LEN];
+    struct stat st;
+    int i;
+
+    // History for the quantile
+    for (i = 0; i < 20; ++i) {
+        test_deposition_url(test, i % test->mock_config.depositions, url, sizeof(url));
+        TEST_CALL(test, gfal2_stat(test->context, url, &st, &test->error));
+    }
+
+    gint64 won = test_stats(test, "hedges", "won", NULL);
+    gfal2_zenodo_mock_delay_next(test->mock, 1, 3000);
+    test_deposition_url(test, 0, url, sizeof(url));
+    gint64 start = g_get_monotonic_time();
+    TEST_CALL(test, gfal2_stat(test->context, url, &st, &test->error));
+    TEST_ASSERT(g_get_monotonic_time() - start < 1500 * 1000);
+    TEST_ASSERT(S_ISDIR(st.st_mode));
+    TEST_ASSERT(test_stats(test, "hedges", "won", NULL) > won);
+    return 0;
+}
+
+
+typedef struct {
+    Test* test;
+    gfal2_context_t context;
+    int index;
+    volatile gint* errors;
+    volatile gint done;
+} TestStatMapWorker;
+
+
+static gpointer test_statmap_lookup(gpointer data)
+{
+    TestStatMapWorker* worker = (TestStatMapWorker*)data;
+    char url[GFAL_URL_MAX_LEN];
+    struct stat st;
+    GError* error = NULL;
+
+    test_file_url(worker->test, 0, 0, url, sizeof(url));
+    if (gfal2_stat(worker->context, url, &st, &error) < 0 ||
+        st.st_size != worker->test->mock_config.file_size) {
+        fprintf(stderr, "%s: %s\n", url, error ? error->message : "wrong size");
+        g_clear_error(&error);
+        g_atomic_int_inc(worker->errors);
+    }
+    g_atomic_int_set(&worker->done, 1);
+    return NULL;
+}
+
+
+// Stat its own file and the generated ones, checking every size
+static gpointer test_statmap_worker(gpointer data)
+{
+    TestStatMapWorker* worker = (TestStatMapWorker*)data;
+    Test* test = worker->test;
+    int total = test->mock_config.depositions * test->mock_config.files;
+    char url[GFAL_URL_MAX_LEN], own[GFAL_URL_MAX_LEN];
+    struct stat st;
+    GError* error = NULL;
+    int i;
+
+    test_deposition_url(test, worker->index % test->mock_config.depositions, own, sizeof(own));
+    g_strlcat(own, "/", sizeof(own));
+    snprintf(own + strlen(own), sizeof(own) - strlen(own), "worker-%d.dat", worker->index);
+    if (test_write(worker->context, own, 1000 + worker->index, &error) < 0) {
+        fprintf(stderr, "%s: %s\n", own, error->message);
+        g_clear_error(&error);
+        g_atomic_int_inc(worker->errors);
+        return NULL;
+    }
+
+    for (i = 0; i < 2000; ++i) {
+        int item = (i * 7 + worker->index) % total;
+        gint64 expected = test->mock_config.file_size;
+        if (i % 4 == 0) {
+            g_strlcpy(url, own, sizeof(url));
+            expected = 1000 + worker->index;
+        }
+        else {
+            test_file_url(test, item % test->mock_config.depositions,
+                    item / test->mock_config.depositions, url, sizeof(url));
+        }
+
+        if (gfal2_stat(worker->context, url, &st, &error) < 0 || st.st_size != expected) {
+            fprintf(stderr, "%s: %s\n", url, error ? error->message : "wrong size");
+            g_clear_error(&error);
+            g_atomic_int_inc(worker->errors);
+        }
+    }
+    return NULL;
+}
+
+
+// Handles sharing a STAT_CACHE_DIR, as processes do, each with its own mapping
+static int test_statmap_locking(Test* test)
+{
+    gchar* dir = g_build_filename(test->config_dir, "statmap", NULL);
+    gchar* setting = g_strdup_printf("STAT_CACHE_DIR=%s", dir);
+    g_mkdir(dir, 0700);
+    gfal2_context_t contexts[2];
+    contexts[0] = test_context_new(test, setting, &test->error);
+    contexts[1] = contexts[0] ? test_context_new(test, setting, &test->error) : NULL;
+    g_free(setting);
+    TEST_CALL(test, contexts[1] ? 0 : -1);
+
+    // Entries put by one are found by the other
+    char url[GFAL_URL_MAX_LEN];
+    struct stat st;
+    int i;
+    for (i = 0; i < test->mock_config.files; ++i) {
+        test_file_url(test, 0, i, url, sizeof(url));
+        TEST_CALL(test, gfal2_stat(contexts[0], url, &st, &test->error));
+    }
+    guint64 before = test_requests(test);
+    for (i = 0; i < test->mock_config.files; ++i) {
+        test_file_url(test, 0, i, url, sizeof(url));
+        TEST_CALL(test, gfal2_stat(contexts[1], url, &st, &test->error));
+        TEST_ASSERT(st.st_size == test->mock_config.file_size);
+    }
+    TEST_ASSERT(test_requests(test) == before);
+
+    // Lookups wait for whoever holds the file, as another process would
+    volatile gint errors = 0;
+    GDir* files = g_dir_open(dir, 0, NULL);
+    const char* name = files ? g_dir_read_name(files) : NULL;
+    gchar* path = name ? g_build_filename(dir, name, NULL) : NULL;
+    if (files)
+        g_dir_close(files);
+    TEST_ASSERT(path != NULL);
+    int fd = open(path, O_RDWR);
+    g_free(path);
+    TEST_ASSERT(fd >= 0);
+
+    TestStatMapWorker workers[TEST_THREADS];
+    memset(workers, 0, sizeof(workers));
+    workers[0].test = test;
+    workers[0].context = contexts[1];
+    workers[0].errors = &errors;
+    flock(fd, LOCK_EX);
+    GThread* lookup = g_thread_new("zenodo-test", test_statmap_lookup, &workers[0]);
+    g_usleep(200000);
+    gint waited = !g_atomic_int_get(&workers[0].done);
+    flock(fd, LOCK_UN);
+    g_thread_join(lookup);
+    close(fd);
+    TEST_ASSERT(waited);
+    TEST_ASSERT(g_atomic_int_get(&workers[0].done));
+
+    // And both can use it at once, with far more entries than slots
+    GThread* threads[TEST_THREADS];
+    for (i = 0; i < TEST_THREADS; ++i) {
+        workers[i].test = test;
+        workers[i].context = contexts[i % 2];
+        workers[i].index = i;
+        workers[i].errors = &errors;
+        threads[i] = g_thread_new("zenodo-test", test_statmap_worker, &workers[i]);
+    }
+    for (i = 0; i < TEST_THREADS; ++i)
+        g_thread_join(threads[i]);
+
+    gfal2_context_free(contexts[0]);
+    gfal2_context_free(contexts[1]);
+    files = g_dir_open(dir, 0, NULL);
+    while (files && (name = g_dir_read_name(files))) {
+        gchar* path = g_build_filename(dir, name, NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    if (files)
+        g_dir_close(files);
+    g_rmdir(dir);
+    g_free(dir);
+
+    TEST_ASSERT(g_atomic_int_get(&errors) == 0);
+    return 0;
+}
+
+
+static const TestCase test_cases[] = {
+    {"cache_invalidation", {"STAT_CACHE_TTL=60", "STAT_CACHE_NEGATIVE_TTL=60", NULL},
+        test_cache_invalidation},
+    {"retry_backoff", {"STAT_CACHE_TTL=0", "STAT_CACHE_NEGATIVE_TTL=0", "RETRY_MAX=3",
+        "RETRY_BASE_DELAY=100", NULL}, test_retry_backoff},
+    {"name_resolution", {NULL}, test_name_resolution},
+    {"etag_revalidation", {"STAT_CACHE_TTL=0", "STAT_CACHE_NEGATIVE_TTL=0", NULL},
+        test_etag_revalidation},
+    {"download_resume", {"DOWNLOAD_STREAMS=1", "RETRY_BASE_DELAY=10", NULL}, test_download_resume},
+    {"hedging", {"STAT_CACHE_TTL=0", "STAT_CACHE_NEGATIVE_TTL=0", "HEDGE=true",
+        "HEDGE_QUANTILE=50", "HEDGE_BUDGET=100", "HEDGE_MIN_DELAY=100", NULL}, test_hedging},
+    // The memory cache keeps one entry, so lookups go to the shared file
+    {"statmap_locking", {"STAT_CACHE_SLOTS=8", "STAT_CACHE_MAX_ENTRIES=1", NULL},
+        test_statmap_locking},
+    {NULL, {NULL}, NULL}
+};
+
+
+/*
+ * Runner
+ */
+
+static int test_run(const TestCase* test_case)
+{
+    Test test;
+    memset(&test, 0, sizeof(test));
+    test.options = test_case->options;
+    gfal2_zenodo_mock_config_defaults(&test.mock_config);
+    test.mock_config.depositions = 5;
+    test.mock_config.files = 4;
+    test.mock_config.file_size = 2 * 1048576;
+
+    int ret = -1;
+    test.mock = gfal2_zenodo_mock_start(&test.mock_config, &test.error);
+    if (test.mock) {
+        snprintf(test.base, sizeof(test.base), "zenodo://127.0.0.1:%d",
+                gfal2_zenodo_mock_port(test.mock));
+        test.config_dir = g_dir_make_tmp("gfal2-zenodo-test-XXXXXX", &test.error);
+    }
+    if (test.config_dir) {
+        g_setenv("GFAL_CONFIG_DIR", test.config_dir, TRUE);
+        test.context = test_context_new(&test, NULL, &test.error);
+    }
+    if (test.context) {
+        ret = test_case->run(&test);
+        gfal2_context_free(test.context);
+    }
+    else {
+        fprintf(stderr, "%s\n", test.error->message);
+    }
+    g_clear_error(&test.error);
+
+    if (test.config_dir) {
+        gchar* config_file = g_build_filename(test.config_dir, "zenodo_plugin.conf", NULL);
+        g_unlink(config_file);
+        g_rmdir(test.config_dir);
+        g_free(config_file);
+        g_free(test.config_dir);
+    }
+    if (test.mock)
+        gfal2_zenodo_mock_stop(test.mock);
+    return ret;
+}
+
+
+int main(int argc, char** argv)
+{
+    g_setenv("GFAL_PLUGIN_DIR", ZENODO_PLUGIN_DIR, FALSE);
+
+    int failed = 0, i;
+    for (i = 1; i < argc; ++i) {
+        const TestCase* test_case;
+        for (test_case = test_cases; test_case->name; ++test_case)
+            if (strcmp(test_case->name, argv[i]) == 0)
+                break;
+        if (!test_case->name) {
+            fprintf(stderr, "Unknown test %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    const TestCase* test_case;
+    for (test_case = test_cases; test_case->name; ++test_case) {
+        gboolean selected = (argc < 2);
+        for (i = 1; i < argc && !selected; ++i)
+            selected = strcmp(argv[i], test_case->name) == 0;
+        if (!selected)
+            continue;
+
+        int ret = test_run(test_case);
+        printf("%-20s %s\n", test_case->name, ret == 0 ? "ok" : "FAILED");
+        fflush(stdout);
+        if (ret != 0)
+            ++failed;
+    }
+    return failed ? 1 : 0;
+}